@@ -0,0 +1,8 @@
+uniform vec4 color;
+
+void main(void)
+{
+    // premultiplied alpha blending
+    gl_FragColor.rgb = color.a * color.rgb;
+    gl_FragColor.a = color.a;
+}
@@ -0,0 +1,12 @@
+//
+// Solid color, no texture. Cheap to compile, used while other programs are still compiling.
+//
+
+uniform vec4 color;
+uniform mat4 modelViewProjMat;
+attribute vec3 position;
+
+void main(void)
+{
+    gl_Position = modelViewProjMat * vec4(position, 1);
+}
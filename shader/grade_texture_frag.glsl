@@ -0,0 +1,85 @@
+uniform vec4 color;
+uniform sampler2D colorTexture;
+
+// 3D lut, nearest filtered, see LutTexture
+uniform sampler3D gradeTexture;
+uniform float gradeSize;
+uniform vec3 gradeDomainMin;
+uniform vec3 gradeDomainScale;  // 1 / (max - min)
+
+// rows of the ColorMatrix applied after the grade, offset in w and scaled to [0, 1]. the cpu pipeline grades,
+// pre-multiplies and then converts, and so does this shader.
+uniform vec4 convertR;
+uniform vec4 convertG;
+uniform vec4 convertB;
+
+varying vec2 frag_uv;
+
+vec3 fetchLattice(vec3 lattice)
+{
+    return texture3D(gradeTexture, (lattice + 0.5) / gradeSize).rgb;
+}
+
+// tetrahedral interpolation, the same as CubeLut::Apply: walk from corner 000 to 111 along the axis
+// with the largest fraction first, then the second largest.
+vec3 grade(vec3 rgb)
+{
+    vec3 p = clamp((rgb - gradeDomainMin) * gradeDomainScale, 0.0, 1.0) * (gradeSize - 1.0);
+    vec3 cell = min(floor(p), vec3(gradeSize - 2.0));
+    vec3 f = p - cell;
+
+    vec3 step1;
+    vec3 step2;
+    vec3 w;
+    if (f.r >= f.g)
+    {
+        if (f.g >= f.b)
+        {
+            step1 = vec3(1.0, 0.0, 0.0); step2 = vec3(1.0, 1.0, 0.0); w = f.rgb;
+        }
+        else if (f.r >= f.b)
+        {
+            step1 = vec3(1.0, 0.0, 0.0); step2 = vec3(1.0, 0.0, 1.0); w = f.rbg;
+        }
+        else
+        {
+            step1 = vec3(0.0, 0.0, 1.0); step2 = vec3(1.0, 0.0, 1.0); w = f.brg;
+        }
+    }
+    else
+    {
+        if (f.g < f.b)
+        {
+            step1 = vec3(0.0, 0.0, 1.0); step2 = vec3(0.0, 1.0, 1.0); w = f.bgr;
+        }
+        else if (f.r >= f.b)
+        {
+            step1 = vec3(0.0, 1.0, 0.0); step2 = vec3(1.0, 1.0, 0.0); w = f.grb;
+        }
+        else
+        {
+            step1 = vec3(0.0, 1.0, 0.0); step2 = vec3(0.0, 1.0, 1.0); w = f.gbr;
+        }
+    }
+
+    vec3 c0 = fetchLattice(cell);
+    vec3 c1 = fetchLattice(cell + step1);
+    vec3 c2 = fetchLattice(cell + step2);
+    vec3 c3 = fetchLattice(cell + 1.0);
+    return c0 + w.x * (c1 - c0) + w.y * (c2 - c1) + w.z * (c3 - c2);
+}
+
+void main(void)
+{
+    vec4 texColor = texture2D(colorTexture, frag_uv);
+
+    // the lut grades straight color, the texture is pre-multiplied
+    vec3 straight = texColor.a > 0.0 ? texColor.rgb / texColor.a : texColor.rgb;
+    vec3 graded = clamp(grade(straight), 0.0, 1.0) * texColor.a;
+    vec3 converted = clamp(vec3(dot(convertR.xyz, graded), dot(convertG.xyz, graded), dot(convertB.xyz, graded)) +
+                           vec3(convertR.w, convertG.w, convertB.w), 0.0, 1.0);
+
+    // premultiplied alpha blending
+    gl_FragColor.rgb = color.a * color.rgb * converted;
+    gl_FragColor.a = color.a * texColor.a;
+}
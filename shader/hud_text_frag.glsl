@@ -0,0 +1,14 @@
+uniform sampler2D glyphTexture;
+
+varying vec2 frag_uv;
+varying vec4 frag_color;
+
+void main(void)
+{
+    // single channel glyph coverage
+    float coverage = texture2D(glyphTexture, frag_uv).r;
+
+    // premultiplied alpha blending
+    gl_FragColor.rgb = coverage * frag_color.a * frag_color.rgb;
+    gl_FragColor.a = coverage * frag_color.a;
+}
@@ -0,0 +1,18 @@
+//
+// Hud text, a whole frame of glyph quads in one draw, color per vertex.
+//
+
+uniform mat4 modelViewProjMat;
+attribute vec2 position;
+attribute vec2 uv;
+attribute vec4 color;
+
+varying vec2 frag_uv;
+varying vec4 frag_color;
+
+void main(void)
+{
+    gl_Position = modelViewProjMat * vec4(position, 0, 1);
+    frag_uv = uv;
+    frag_color = color;
+}
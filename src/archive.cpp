@@ -0,0 +1,458 @@
+#include "archive.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdio.h>
+#include <string.h>
+#ifdef IMGTOY_LZ4
+#include <lz4.h>
+#endif
+#ifdef IMGTOY_ZSTD
+#include <zstd.h>
+#endif
+
+#include "hash.h"
+#include "log.h"
+
+namespace fs = std::filesystem;
+
+static const char ARCHIVE_MAGIC[8] = {'I', 'M', 'G', 'T', 'O', 'Y', 'P', 'K'};
+
+// packing is done once, unpacking at every startup, so spend time on the ratio.
+static const int ZSTD_LEVEL = 19;
+
+static std::vector<Archive*> s_archives;
+
+static const char* s_compressionNames[(int)ArchiveCompression::NUM_COMPRESSIONS] = {"none", "lz4", "zstd"};
+
+bool ParseArchiveCompression(const char* str, ArchiveCompression* compressionOut)
+{
+    for (int i = 0; i < (int)ArchiveCompression::NUM_COMPRESSIONS; i++)
+    {
+        if (!strcmp(str, s_compressionNames[i]))
+        {
+            *compressionOut = (ArchiveCompression)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool IsCompressionSupported(ArchiveCompression compression)
+{
+    switch (compression)
+    {
+    case ArchiveCompression::None:
+        return true;
+#ifdef IMGTOY_LZ4
+    case ArchiveCompression::LZ4:
+        return true;
+#endif
+#ifdef IMGTOY_ZSTD
+    case ArchiveCompression::Zstd:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+ArchiveCompression GetDefaultCompression()
+{
+    if (IsCompressionSupported(ArchiveCompression::LZ4))
+    {
+        return ArchiveCompression::LZ4;
+    }
+    if (IsCompressionSupported(ArchiveCompression::Zstd))
+    {
+        return ArchiveCompression::Zstd;
+    }
+    return ArchiveCompression::None;
+}
+
+// one spelling per file: forward slashes, no "./" or doubled slashes.
+static std::string NormalizePath(const std::string& path)
+{
+    std::string result;
+    result.reserve(path.size());
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        char c = path[i] == '\\' ? '/' : path[i];
+        if (c == '/' && (result.empty() || result.back() == '/'))
+        {
+            continue;
+        }
+        if (c == '.' && (result.empty() || result.back() == '/') && (i + 1 == path.size() || path[i + 1] == '/' || path[i + 1] == '\\'))
+        {
+            i++;
+            continue;
+        }
+        result.push_back(c);
+    }
+    return result;
+}
+
+// returns 0 if dst is too small or the data does not compress.
+static size_t Compress(ArchiveCompression compression, const uint8_t* src, size_t srcSize, std::vector<uint8_t>& dst)
+{
+    switch (compression)
+    {
+#ifdef IMGTOY_LZ4
+    case ArchiveCompression::LZ4:
+    {
+        if (srcSize > (size_t)LZ4_MAX_INPUT_SIZE)
+        {
+            return 0;
+        }
+        dst.resize((size_t)LZ4_compressBound((int)srcSize));
+        int result = LZ4_compress_default((const char*)src, (char*)dst.data(), (int)srcSize, (int)dst.size());
+        return result > 0 ? (size_t)result : 0;
+    }
+#endif
+#ifdef IMGTOY_ZSTD
+    case ArchiveCompression::Zstd:
+    {
+        dst.resize(ZSTD_compressBound(srcSize));
+        size_t result = ZSTD_compress(dst.data(), dst.size(), src, srcSize, ZSTD_LEVEL);
+        return ZSTD_isError(result) ? 0 : result;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+static bool Decompress(ArchiveCompression compression, const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    switch (compression)
+    {
+#ifdef IMGTOY_LZ4
+    case ArchiveCompression::LZ4:
+        return LZ4_decompress_safe((const char*)src, (char*)dst, (int)srcSize, (int)dstSize) == (int)dstSize;
+#endif
+#ifdef IMGTOY_ZSTD
+    case ArchiveCompression::Zstd:
+        return ZSTD_decompress(dst, dstSize, src, srcSize) == dstSize;
+#endif
+    default:
+        return false;
+    }
+}
+
+//
+// Archive
+//
+
+Archive::Archive() : header(nullptr), entries(nullptr), names(nullptr)
+{
+}
+
+bool Archive::Open(const std::string& filenameIn)
+{
+    Close();
+    filename = filenameIn;
+
+    // entries are read in whatever order the program asks for them, Read prefetches each one.
+    if (!file.Open(filename, false))
+    {
+        Log::printf("Error: Failed to open archive \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    const ArchiveHeader* h = (const ArchiveHeader*)file.data;
+    if (file.size < sizeof(ArchiveHeader) || memcmp(h->magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) || h->version != ARCHIVE_VERSION)
+    {
+        Log::printf("Error: \"%s\" is not an archive this version can read\n", filename.c_str());
+        Close();
+        return false;
+    }
+
+    // everything is checked once here, so Find and Read can trust the table of contents.
+    bool valid = h->tocOffset % sizeof(uint64_t) == 0 &&
+                 h->tocOffset <= file.size && (file.size - h->tocOffset) / sizeof(ArchiveEntry) >= h->numEntries &&
+                 h->namesOffset <= file.size && file.size - h->namesOffset >= h->namesSize;
+    const ArchiveEntry* e = (const ArchiveEntry*)(file.data + h->tocOffset);
+    for (uint32_t i = 0; valid && i < h->numEntries; i++)
+    {
+        valid = e[i].offset <= file.size && file.size - e[i].offset >= e[i].storedSize &&
+                (uint64_t)e[i].nameOffset + e[i].nameSize <= h->namesSize &&
+                e[i].compression < (uint32_t)ArchiveCompression::NUM_COMPRESSIONS &&
+                (e[i].compression != (uint32_t)ArchiveCompression::None || e[i].storedSize == e[i].size) &&
+                (i == 0 || e[i - 1].pathHash <= e[i].pathHash);
+    }
+    if (!valid)
+    {
+        Log::printf("Error: archive \"%s\" is corrupt\n", filename.c_str());
+        Close();
+        return false;
+    }
+
+    header = h;
+    entries = e;
+    names = (const char*)file.data + h->namesOffset;
+    return true;
+}
+
+void Archive::Close()
+{
+    file.Close();
+    header = nullptr;
+    entries = nullptr;
+    names = nullptr;
+}
+
+const ArchiveEntry* Archive::Find(const std::string& pathIn) const
+{
+    if (!header)
+    {
+        return nullptr;
+    }
+
+    const std::string path = NormalizePath(pathIn);
+    const uint64_t hash = XXHash64(path.data(), path.size());
+    const ArchiveEntry* end = entries + header->numEntries;
+    const ArchiveEntry* it = std::lower_bound(entries, end, hash, [](const ArchiveEntry& entry, uint64_t value) { return entry.pathHash < value; });
+    for (; it != end && it->pathHash == hash; ++it)
+    {
+        if (it->nameSize == path.size() && !memcmp(names + it->nameOffset, path.data(), path.size()))
+        {
+            return it;
+        }
+    }
+    return nullptr;
+}
+
+bool Archive::Read(const ArchiveEntry* entry, std::vector<uint8_t>& buffer, const uint8_t** dataOut, size_t* sizeOut) const
+{
+    const uint8_t* stored = file.data + entry->offset;
+    file.Prefetch(entry->offset, entry->storedSize);
+
+    ArchiveCompression compression = (ArchiveCompression)entry->compression;
+    if (compression == ArchiveCompression::None)
+    {
+        *dataOut = stored;
+        *sizeOut = entry->size;
+        return true;
+    }
+
+    if (!IsCompressionSupported(compression))
+    {
+        Log::printf("Error: \"%s\" in archive \"%s\" is %s compressed, this build can't read it\n",
+                    GetPath(entry).c_str(), filename.c_str(), s_compressionNames[(int)compression]);
+        return false;
+    }
+    buffer.resize(entry->size);
+    if (!Decompress(compression, stored, entry->storedSize, buffer.data(), buffer.size()))
+    {
+        Log::printf("Error: failed to decompress \"%s\" in archive \"%s\"\n", GetPath(entry).c_str(), filename.c_str());
+        return false;
+    }
+    *dataOut = buffer.data();
+    *sizeOut = buffer.size();
+    return true;
+}
+
+std::string Archive::GetPath(const ArchiveEntry* entry) const
+{
+    return std::string(names + entry->nameOffset, entry->nameSize);
+}
+
+//
+// mounting
+//
+
+ArchiveFile::ArchiveFile() : data(nullptr), size(0)
+{
+}
+
+bool MountArchive(const std::string& filename)
+{
+    Archive* archive = new Archive();
+    if (!archive->Open(filename))
+    {
+        delete archive;
+        return false;
+    }
+    Log::printf("mounted archive \"%s\", %u files\n", filename.c_str(), archive->header->numEntries);
+    s_archives.push_back(archive);
+    return true;
+}
+
+void UnmountArchives()
+{
+    for (auto archive : s_archives)
+    {
+        delete archive;
+    }
+    s_archives.clear();
+}
+
+bool ReadFromArchives(const std::string& filename, ArchiveFile& fileOut)
+{
+    for (auto it = s_archives.rbegin(); it != s_archives.rend(); ++it)
+    {
+        const ArchiveEntry* entry = (*it)->Find(filename);
+        if (entry && (*it)->Read(entry, fileOut.buffer, &fileOut.data, &fileOut.size))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+// packing
+//
+
+struct PackItem
+{
+    std::string path;
+    uint64_t hash;
+};
+
+static bool WritePadding(FILE* fp, uint64_t* offset)
+{
+    static const uint8_t s_zeros[ARCHIVE_ALIGNMENT] = {};
+    size_t padding = (size_t)((ARCHIVE_ALIGNMENT - *offset % ARCHIVE_ALIGNMENT) % ARCHIVE_ALIGNMENT);
+    *offset += padding;
+    return fwrite(s_zeros, 1, padding, fp) == padding;
+}
+
+bool BuildArchive(const std::string& archiveFilename, const std::vector<std::string>& inputs, ArchiveCompression compression)
+{
+    if (!IsCompressionSupported(compression))
+    {
+        Log::printf("Error: this build has no %s compression\n", s_compressionNames[(int)compression]);
+        return false;
+    }
+
+    const fs::path root = fs::path(GetRootPath());
+    std::error_code ec;
+    const fs::path archivePath = fs::weakly_canonical(root / archiveFilename, ec);
+
+    std::vector<PackItem> items;
+    for (const auto& input : inputs)
+    {
+        const fs::path inputPath = root / input;
+        if (fs::is_regular_file(inputPath, ec))
+        {
+            items.push_back({NormalizePath(input), 0});
+            continue;
+        }
+        for (fs::recursive_directory_iterator it(inputPath, ec), endIt; !ec && it != endIt; it.increment(ec))
+        {
+            // an archive written into one of its own inputs would pack the last one.
+            std::error_code pathEc;
+            if (it->is_regular_file() && fs::weakly_canonical(it->path(), pathEc) != archivePath)
+            {
+                items.push_back({NormalizePath(input + "/" + it->path().lexically_relative(inputPath).generic_string()), 0});
+            }
+        }
+        if (ec)
+        {
+            Log::printf("Error: failed to list \"%s\": %s\n", inputPath.string().c_str(), ec.message().c_str());
+            return false;
+        }
+    }
+    for (auto& item : items)
+    {
+        item.hash = XXHash64(item.path.data(), item.path.size());
+    }
+    std::sort(items.begin(), items.end(), [](const PackItem& a, const PackItem& b)
+    {
+        return a.hash != b.hash ? a.hash < b.hash : a.path < b.path;
+    });
+    items.erase(std::unique(items.begin(), items.end(), [](const PackItem& a, const PackItem& b) { return a.path == b.path; }), items.end());
+
+    // written next to the archive and renamed over it, a mounted archive is never truncated under its mapping.
+    const std::string tmpFilename = archiveFilename + ".tmp";
+    const std::string fullTmpFilename = GetRootPath() + tmpFilename;
+#ifdef _WIN32
+    FILE* fp = nullptr;
+    fopen_s(&fp, fullTmpFilename.c_str(), "wb");
+#else
+    FILE* fp = fopen(fullTmpFilename.c_str(), "wb");
+#endif
+    if (!fp)
+    {
+        Log::printf("Error: Failed to fopen \"%s\"\n", fullTmpFilename.c_str());
+        return false;
+    }
+
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version = ARCHIVE_VERSION;
+    header.numEntries = (uint32_t)items.size();
+
+    std::vector<ArchiveEntry> entries(items.size());
+    std::string names;
+    std::vector<uint8_t> compressed;
+    uint64_t offset = sizeof(header);
+    uint64_t totalSize = 0;
+    int numCompressed = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (size_t i = 0; ok && i < items.size(); i++)
+    {
+        MappedFile input;
+        if (!input.Open(items[i].path))
+        {
+            Log::printf("Error: failed to read \"%s\"\n", items[i].path.c_str());
+            ok = false;
+            break;
+        }
+
+        ArchiveEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.pathHash = items[i].hash;
+        entry.size = input.size;
+        entry.nameOffset = (uint32_t)names.size();
+        entry.nameSize = (uint32_t)items[i].path.size();
+        names += items[i].path;
+
+        const uint8_t* stored = input.data;
+        entry.storedSize = input.size;
+        entry.compression = (uint32_t)ArchiveCompression::None;
+        size_t compressedSize = compression == ArchiveCompression::None ? 0 : Compress(compression, input.data, input.size, compressed);
+        if (compressedSize > 0 && compressedSize <= input.size - input.size / 8)
+        {
+            stored = compressed.data();
+            entry.storedSize = compressedSize;
+            entry.compression = (uint32_t)compression;
+            numCompressed++;
+        }
+
+        ok = WritePadding(fp, &offset);
+        entry.offset = offset;
+        ok = ok && fwrite(stored, 1, (size_t)entry.storedSize, fp) == entry.storedSize;
+        offset += entry.storedSize;
+        totalSize += entry.size;
+    }
+
+    ok = ok && WritePadding(fp, &offset);
+    header.tocOffset = offset;
+    ok = ok && fwrite(entries.data(), sizeof(ArchiveEntry), entries.size(), fp) == entries.size();
+    offset += sizeof(ArchiveEntry) * entries.size();
+    header.namesOffset = offset;
+    header.namesSize = names.size();
+    ok = ok && fwrite(names.data(), 1, names.size(), fp) == names.size();
+    offset += names.size();
+
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (ok)
+    {
+        fs::rename(root / tmpFilename, root / archiveFilename, ec);
+        ok = !ec;
+    }
+    if (!ok)
+    {
+        Log::printf("Error: failed to write archive \"%s\"\n", archiveFilename.c_str());
+        fs::remove(root / tmpFilename, ec);
+        return false;
+    }
+
+    Log::printf("packed %d files, %.2f MB into %.2f MB, %d stored %s compressed\n", (int)items.size(),
+                totalSize / (1024.0 * 1024.0), offset / (1024.0 * 1024.0), numCompressed, s_compressionNames[(int)compression]);
+    return true;
+}
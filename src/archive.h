@@ -0,0 +1,100 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "util.h"
+
+enum class ArchiveCompression
+{
+    None = 0,
+    LZ4,   // IMGTOY_LZ4 builds only
+    Zstd,  // IMGTOY_ZSTD builds only
+    NUM_COMPRESSIONS
+};
+
+bool ParseArchiveCompression(const char* str, ArchiveCompression* compressionOut);
+bool IsCompressionSupported(ArchiveCompression compression);
+
+// fastest to decompress of the ones this build has, None if it has neither.
+ArchiveCompression GetDefaultCompression();
+
+// Pack file layout, all little endian:
+//   ArchiveHeader
+//   entry data, every entry starts on an ARCHIVE_ALIGNMENT boundary so it maps onto whole pages
+//   ArchiveEntry[numEntries], sorted by pathHash then by path
+//   paths, not null terminated
+static const uint32_t ARCHIVE_VERSION = 1;
+static const uint64_t ARCHIVE_ALIGNMENT = 4096;
+
+struct ArchiveHeader
+{
+    char magic[8];  // "IMGTOYPK"
+    uint32_t version;
+    uint32_t numEntries;
+    uint64_t tocOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+};
+
+struct ArchiveEntry
+{
+    uint64_t pathHash;  // XXHash64 of the path
+    uint64_t offset;
+    uint64_t storedSize;
+    uint64_t size;      // after decompression
+    uint32_t nameOffset;
+    uint32_t nameSize;
+    uint32_t compression;
+    uint32_t reserved;
+};
+
+// A mapped pack file, the table of contents is used in place.
+struct Archive
+{
+    Archive();
+
+    // filename is relative to the root path.
+    bool Open(const std::string& filename);
+    void Close();
+
+    // path relative to the root path, as passed to LoadFile or Image::Load.
+    const ArchiveEntry* Find(const std::string& path) const;
+
+    // uncompressed entries point straight into the mapping, compressed ones are decompressed into buffer.
+    bool Read(const ArchiveEntry* entry, std::vector<uint8_t>& buffer, const uint8_t** dataOut, size_t* sizeOut) const;
+
+    std::string GetPath(const ArchiveEntry* entry) const;
+
+    std::string filename;
+    MappedFile file;
+    const ArchiveHeader* header;
+    const ArchiveEntry* entries;
+    const char* names;
+};
+
+// The bytes of one file found in a mounted archive, valid until the archives are unmounted.
+struct ArchiveFile
+{
+    ArchiveFile();
+
+    const uint8_t* data;
+    size_t size;
+    std::vector<uint8_t> buffer;  // holds the bytes of compressed entries
+};
+
+// LoadFile and Image::Load look in mounted archives, newest first, before going to disk.
+// Mount before any loading threads start, lookups don't lock.
+bool MountArchive(const std::string& filename);
+void UnmountArchives();
+
+// false if no mounted archive has filename (relative to the root path).
+bool ReadFromArchives(const std::string& filename, ArchiveFile& fileOut);
+
+// Packs every file under inputs (files or directories relative to the root path) into archiveFilename.
+// Each entry keeps the path it would be loaded by, and is only stored compressed if that saves at least 1/8.
+bool BuildArchive(const std::string& archiveFilename, const std::vector<std::string>& inputs, ArchiveCompression compression);
+
+#endif
@@ -0,0 +1,338 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#include "convert.h"
+#include "cubelut.h"
+#include "hash.h"
+#include "image.h"
+#include "log.h"
+#include "parallel.h"
+#include "pixelops.h"
+#include "util.h"
+
+namespace fs = std::filesystem;
+
+// bump whenever processImage output changes, so every cached result is rebuilt.
+static const int CONVERT_VERSION = 1;
+
+static const char* INDEX_FILENAME = "index.txt";
+static const char* INDEX_HEADER = "imgtoy batch index 1";
+
+// what produced the output at one path, keyed by the output filename relative to the root path,
+// so several output directories can share a cache.
+struct IndexEntry
+{
+    uint64_t contentHash;
+    uint64_t paramsHash;
+    uint64_t inputSize;
+    int64_t inputTime;
+};
+
+typedef std::unordered_map<std::string, IndexEntry> BatchIndex;
+
+BatchOptions::BatchOptions() : standard(ColorStandard::BT709), range(ColorRange::Limited), lut(nullptr)
+{
+}
+
+BatchStats::BatchStats() : numFiles(0), numUpToDate(0), numFromCache(0), numConverted(0), numFailed(0)
+{
+}
+
+// one line per file: content hash, params hash, input size, input time, relative path (last, it may have spaces)
+static void LoadIndex(const fs::path& filename, BatchIndex& index)
+{
+    std::ifstream ifs(filename);
+    std::string line;
+    if (!std::getline(ifs, line) || line != INDEX_HEADER)
+    {
+        return;
+    }
+
+    while (std::getline(ifs, line))
+    {
+        unsigned long long contentHash, paramsHash, inputSize;
+        long long inputTime;
+        int pathStart = 0;
+        if (sscanf(line.c_str(), "%llx %llx %llu %lld %n", &contentHash, &paramsHash, &inputSize, &inputTime, &pathStart) == 4 && pathStart > 0)
+        {
+            index[line.substr(pathStart)] = {contentHash, paramsHash, inputSize, inputTime};
+        }
+    }
+}
+
+// written to a temp file and renamed over the old one, so a crash never leaves half an index.
+static bool SaveIndex(const fs::path& filename, const BatchIndex& index)
+{
+    std::vector<std::string> paths;
+    for (const auto& entry : index)
+    {
+        paths.push_back(entry.first);
+    }
+    std::sort(paths.begin(), paths.end());
+
+    fs::path tmpFilename = filename;
+    tmpFilename += ".tmp";
+    {
+        std::ofstream ofs(tmpFilename, std::ofstream::out | std::ofstream::trunc);
+        if (!ofs.good())
+        {
+            return false;
+        }
+        ofs << INDEX_HEADER << "\n";
+        char line[128];
+        for (const auto& path : paths)
+        {
+            const IndexEntry& e = index.at(path);
+            snprintf(line, sizeof(line), "%016llx %016llx %llu %lld ", (unsigned long long)e.contentHash, (unsigned long long)e.paramsHash,
+                     (unsigned long long)e.inputSize, (long long)e.inputTime);
+            ofs << line << path << "\n";
+        }
+        if (!ofs.good())
+        {
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(tmpFilename, filename, ec);
+    return !ec;
+}
+
+// outputs share storage with the cache when they can, so they must never be edited in place.
+static bool LinkFromCache(const fs::path& cached, const fs::path& output)
+{
+    std::error_code ec;
+    fs::create_directories(output.parent_path(), ec);
+    fs::remove(output, ec);
+    fs::create_hard_link(cached, output, ec);
+    if (ec)
+    {
+        // different file system, or links not supported
+        ec.clear();
+        fs::copy_file(cached, output, fs::copy_options::overwrite_existing, ec);
+    }
+    return !ec;
+}
+
+static std::string HexString(uint64_t value)
+{
+    char str[17];
+    snprintf(str, sizeof(str), "%016llx", (unsigned long long)value);
+    return str;
+}
+
+enum class BatchResult
+{
+    UpToDate,
+    FromCache,
+    Converted,
+    Failed
+};
+
+bool RunBatch(const std::string& inDir, const std::string& outDir, const BatchOptions& options, BatchStats& stats)
+{
+    const std::string cacheDir = options.cacheDir.empty() ? outDir + "/.imgtoy_cache" : options.cacheDir;
+    const fs::path inRoot = fs::path(GetRootPath() + inDir);
+    const fs::path outRoot = fs::path(GetRootPath() + outDir);
+    const fs::path cacheRoot = fs::path(GetRootPath() + cacheDir);
+
+    std::error_code ec;
+    fs::create_directories(cacheRoot, ec);
+    if (ec)
+    {
+        Log::printf("Error: failed to create cache directory \"%s\": %s\n", cacheRoot.string().c_str(), ec.message().c_str());
+        return false;
+    }
+
+    // the output and the cache (OUT/.imgtoy_cache by default) may be under the input, their pngs aren't inputs.
+    std::vector<std::string> files;
+    for (fs::recursive_directory_iterator it(inRoot, ec), endIt; !ec && it != endIt; it.increment(ec))
+    {
+        std::error_code sameEc;
+        if (it->is_directory() && (fs::equivalent(it->path(), outRoot, sameEc) || fs::equivalent(it->path(), cacheRoot, sameEc)))
+        {
+            it.disable_recursion_pending();
+        }
+        else if (it->is_regular_file() && HasExtension(it->path().filename().string(), ".png"))
+        {
+            files.push_back(it->path().lexically_relative(inRoot).generic_string());
+        }
+    }
+    if (ec)
+    {
+        Log::printf("Error: failed to list \"%s\": %s\n", inRoot.string().c_str(), ec.message().c_str());
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    // everything that changes the output bytes goes into the key, the lut by its entries and domain.
+    // without a lut the key is what it always was, so existing caches stay valid.
+    char params[160];
+    int paramsLen = snprintf(params, sizeof(params), "imgtoy convert v%d standard %d range %d", CONVERT_VERSION, (int)options.standard,
+                             (int)options.range);
+    if (options.lut)
+    {
+        const CubeLut& lut = *options.lut;
+        uint64_t lutHash = XXHash64(lut.domainMin, sizeof(lut.domainMin), (uint64_t)lut.size);
+        lutHash = XXHash64(lut.domainMax, sizeof(lut.domainMax), lutHash);
+        lutHash = XXHash64(lut.table.data(), lut.table.size() * sizeof(float), lutHash);
+        snprintf(params + paramsLen, sizeof(params) - paramsLen, " lut %016llx", (unsigned long long)lutHash);
+    }
+    const uint64_t paramsHash = XXHash64(params, strlen(params));
+
+    BatchIndex oldIndex;
+    LoadIndex(cacheRoot / INDEX_FILENAME, oldIndex);
+
+    std::vector<IndexEntry> entries(files.size());
+    std::vector<BatchResult> results(files.size(), BatchResult::Failed);
+
+    // the ParallelFor calls inside processImage run serially here, the parallelism is across files.
+    ParallelFor(0, files.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const std::string& rel = files[i];
+            const fs::path inPath = inRoot / rel;
+            const fs::path outPath = outRoot / rel;
+            std::error_code fileEc;
+
+            IndexEntry& entry = entries[i];
+            entry.paramsHash = paramsHash;
+            entry.inputSize = fs::file_size(inPath, fileEc);
+            if (!fileEc)
+            {
+                entry.inputTime = (int64_t)fs::last_write_time(inPath, fileEc).time_since_epoch().count();
+            }
+            if (fileEc)
+            {
+                Log::printf("Error: failed to stat \"%s\"\n", inPath.string().c_str());
+                continue;
+            }
+
+            auto old = oldIndex.find(outDir + "/" + rel);
+            bool known = old != oldIndex.end() && old->second.paramsHash == paramsHash && fs::exists(outPath, fileEc);
+
+            // same size and time as last run, don't even read it.
+            if (known && old->second.inputSize == entry.inputSize && old->second.inputTime == entry.inputTime)
+            {
+                entry.contentHash = old->second.contentHash;
+                results[i] = BatchResult::UpToDate;
+                continue;
+            }
+
+            // hashed and decoded from the same mapping, the file is only read once.
+            MappedFile file;
+            if (!file.Open(inDir + "/" + rel))
+            {
+                Log::printf("Error: failed to read \"%s\"\n", inPath.string().c_str());
+                continue;
+            }
+            entry.contentHash = XXHash64(file.data, file.size);
+
+            // touched but not changed
+            if (known && old->second.contentHash == entry.contentHash)
+            {
+                results[i] = BatchResult::UpToDate;
+                continue;
+            }
+
+            uint64_t key = XXHash64(&entry.contentHash, sizeof(entry.contentHash), paramsHash);
+            const std::string cacheName = HexString(key) + ".png";
+            const fs::path cachePath = cacheRoot / cacheName;
+            if (fs::exists(cachePath, fileEc))
+            {
+                results[i] = LinkFromCache(cachePath, outPath) ? BatchResult::FromCache : BatchResult::Failed;
+                continue;
+            }
+
+            // the lut grades straight color, so it loads without pre-multiplying and does that after the grade.
+            // gray images have nothing for a color lut to grade.
+            Image img;
+            if (!img.LoadFromMemory(file.data, file.size, !options.lut))
+            {
+                Log::printf("Error: failed to decode \"%s\"\n", inPath.string().c_str());
+                continue;
+            }
+            file.Close();
+            if (options.lut)
+            {
+                PixelPipeline pipeline;
+                if (img.pixelFormat == PixelFormat::RGB || img.pixelFormat == PixelFormat::RGBA)
+                {
+                    pipeline.Lut3D(*options.lut);
+                }
+                pipeline.Premultiply();
+                AddProcessStages(pipeline, img.pixelFormat, options.standard, options.range);
+                pipeline.Execute(img);
+            }
+            else
+            {
+                processImage(img, options.standard, options.range);
+            }
+
+            // two inputs with the same bytes race for the same cache entry, each writes its own temp file
+            // and the rename makes whichever lands last the entry, they are identical anyway.
+            const std::string tmpName = cacheName + "." + std::to_string(i) + ".tmp";
+            if (!img.Save(cacheDir + "/" + tmpName))
+            {
+                continue;
+            }
+            fs::rename(cacheRoot / tmpName, cachePath, fileEc);
+            if (fileEc)
+            {
+                Log::printf("Error: failed to add \"%s\" to the cache\n", cachePath.string().c_str());
+                fs::remove(cacheRoot / tmpName, fileEc);
+                continue;
+            }
+            results[i] = LinkFromCache(cachePath, outPath) ? BatchResult::Converted : BatchResult::Failed;
+        }
+    });
+
+    // entries for files that are gone are dropped, failed files are left out so they are retried,
+    // and entries of other output directories are kept as they were.
+    BatchIndex newIndex;
+    const std::string outPrefix = outDir + "/";
+    for (const auto& entry : oldIndex)
+    {
+        if (entry.first.compare(0, outPrefix.size(), outPrefix) != 0)
+        {
+            newIndex.insert(entry);
+        }
+    }
+    stats = BatchStats();
+    stats.numFiles = (int)files.size();
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        switch (results[i])
+        {
+        case BatchResult::UpToDate:
+            stats.numUpToDate++;
+            break;
+        case BatchResult::FromCache:
+            stats.numFromCache++;
+            break;
+        case BatchResult::Converted:
+            stats.numConverted++;
+            break;
+        default:
+            Log::printf("FAIL %s\n", files[i].c_str());
+            stats.numFailed++;
+            continue;
+        }
+        newIndex[outPrefix + files[i]] = entries[i];
+    }
+
+    if (!SaveIndex(cacheRoot / INDEX_FILENAME, newIndex))
+    {
+        Log::printf("Error: failed to save batch index in \"%s\"\n", cacheRoot.string().c_str());
+        return false;
+    }
+    return stats.numFailed == 0;
+}
@@ -0,0 +1,41 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+
+#include "colormatrix.h"
+
+struct CubeLut;
+
+struct BatchOptions
+{
+    BatchOptions();
+
+    ColorStandard standard;
+    ColorRange range;
+
+    // graded before the conversion when set, its contents are part of the cache key.
+    const CubeLut* lut;
+
+    // converted pngs named by the hash of their input bytes and the settings, plus the index.
+    // defaults to outDir/.imgtoy_cache
+    std::string cacheDir;
+};
+
+struct BatchStats
+{
+    BatchStats();
+
+    int numFiles;
+    int numUpToDate;   // output already there and the index says input and settings are unchanged
+    int numFromCache;  // hard-linked (or copied) out of the cache, no decode or encode
+    int numConverted;
+    int numFailed;
+};
+
+// Runs Load -> (3D lut) -> processImage -> Save over every png under inDir, writing the same relative paths under outDir.
+// Work is keyed on an xxHash64 of the input bytes and the settings, so unchanged files cost a stat (or a hash),
+// not a decode and an encode. Files run in parallel, directories are relative to the root path.
+bool RunBatch(const std::string& inDir, const std::string& outDir, const BatchOptions& options, BatchStats& stats);
+
+#endif
@@ -0,0 +1,352 @@
+#include "colormatrix.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "image.h"
+#include "log.h"
+#include "parallel.h"
+#include "simd.h"
+
+// luma weights, Kg = 1 - Kr - Kb
+static const double s_kr[(int)ColorStandard::NUM_STANDARDS] = {0.299, 0.2126, 0.2627};
+static const double s_kb[(int)ColorStandard::NUM_STANDARDS] = {0.114, 0.0722, 0.0593};
+
+ColorMatrix MakeColorMatrix(const double coeffs[3][4])
+{
+    ColorMatrix result;
+    const double scale = (double)(1 << ColorMatrix::SHIFT);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            result.coeffs[i][j] = coeffs[i][j];
+            result.m[i][j] = (int32_t)lround(coeffs[i][j] * scale);
+        }
+        // bias so the shift rounds to nearest instead of truncating.
+        result.m[i][3] += 1 << (ColorMatrix::SHIFT - 1);
+    }
+    return result;
+}
+
+ColorMatrix MakeIdentityColorMatrix()
+{
+    const double coeffs[3][4] = {
+        {1.0, 0.0, 0.0, 0.0},
+        {0.0, 1.0, 0.0, 0.0},
+        {0.0, 0.0, 1.0, 0.0}
+    };
+    return MakeColorMatrix(coeffs);
+}
+
+ColorMatrix MakeRGBToYUV(ColorStandard standard, ColorRange range)
+{
+    double kr = s_kr[(int)standard];
+    double kb = s_kb[(int)standard];
+    double kg = 1.0 - kr - kb;
+
+    // full range: Y in [0, 255], UV in [-127.5, 127.5] around 128
+    double yScale = 1.0;
+    double uvScale = 1.0;
+    double yOffset = 0.0;
+    if (range == ColorRange::Limited)
+    {
+        yScale = 219.0 / 255.0;
+        uvScale = 224.0 / 255.0;
+        yOffset = 16.0;
+    }
+
+    double uScale = uvScale / (2.0 * (1.0 - kb));
+    double vScale = uvScale / (2.0 * (1.0 - kr));
+    const double coeffs[3][4] = {
+        {yScale * kr, yScale * kg, yScale * kb, yOffset},
+        {-uScale * kr, -uScale * kg, uScale * (1.0 - kb), 128.0},
+        {vScale * (1.0 - kr), -vScale * kg, -vScale * kb, 128.0}
+    };
+    return MakeColorMatrix(coeffs);
+}
+
+ColorMatrix MakeYUVToRGB(ColorStandard standard, ColorRange range)
+{
+    return InvertColorMatrix(MakeRGBToYUV(standard, range));
+}
+
+ColorMatrix InvertColorMatrix(const ColorMatrix& matrix)
+{
+    const double (*a)[4] = matrix.coeffs;
+    double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+                 a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+                 a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    if (det == 0.0)
+    {
+        Log::printf("Error: color matrix is not invertible\n");
+        return MakeIdentityColorMatrix();
+    }
+
+    double inv[3][4];
+    double invDet = 1.0 / det;
+    inv[0][0] = (a[1][1] * a[2][2] - a[1][2] * a[2][1]) * invDet;
+    inv[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * invDet;
+    inv[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * invDet;
+    inv[1][0] = (a[1][2] * a[2][0] - a[1][0] * a[2][2]) * invDet;
+    inv[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * invDet;
+    inv[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * invDet;
+    inv[2][0] = (a[1][0] * a[2][1] - a[1][1] * a[2][0]) * invDet;
+    inv[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * invDet;
+    inv[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * invDet;
+
+    // x = A^-1 (y - t)
+    for (int i = 0; i < 3; i++)
+    {
+        inv[i][3] = -(inv[i][0] * a[0][3] + inv[i][1] * a[1][3] + inv[i][2] * a[2][3]);
+    }
+    return MakeColorMatrix(inv);
+}
+
+ColorMatrix MultiplyColorMatrix(const ColorMatrix& a, const ColorMatrix& b)
+{
+    double result[3][4];
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            double sum = (j == 3) ? a.coeffs[i][3] : 0.0;
+            for (int k = 0; k < 3; k++)
+            {
+                sum += a.coeffs[i][k] * b.coeffs[k][j];
+            }
+            result[i][j] = sum;
+        }
+    }
+    return MakeColorMatrix(result);
+}
+
+static inline uint8_t Clamp255(int32_t v)
+{
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static void ApplyScalar(uint8_t* p, size_t numPixels, int pixelSize, const ColorMatrix& matrix)
+{
+    const int32_t (*m)[4] = matrix.m;
+    for (size_t i = 0; i < numPixels; i++, p += pixelSize)
+    {
+        int32_t c0 = p[0], c1 = p[1], c2 = p[2];
+        p[0] = Clamp255((m[0][0] * c0 + m[0][1] * c1 + m[0][2] * c2 + m[0][3]) >> ColorMatrix::SHIFT);
+        p[1] = Clamp255((m[1][0] * c0 + m[1][1] * c1 + m[1][2] * c2 + m[1][3]) >> ColorMatrix::SHIFT);
+        p[2] = Clamp255((m[2][0] * c0 + m[2][1] * c1 + m[2][2] * c2 + m[2][3]) >> ColorMatrix::SHIFT);
+    }
+}
+
+static bool FitsInt16(const ColorMatrix& matrix)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            if (matrix.m[i][j] < -32768 || matrix.m[i][j] > 32767)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static inline uint32_t Load32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+//
+// The simd kernels work on pixels in 32 bit lanes, c0 in the low byte. Masking the lane with 0x00ff00ff gives
+// (c0, c2) as a pair of int16 and shifting it first gives (c1, c3), so each output channel is two madds.
+// All shuffles stay inside 128 bit lanes, which lets the avx2 version be the same code at twice the width.
+// For 3 byte pixels the fourth byte of a lane is the next pixel's c0. It is written back unchanged, so blocks
+// must stop one pixel short of the end of the range.
+//
+
+#if defined(SIMD_SSE2)
+struct MatrixConstants128
+{
+    __m128i c02[3];
+    __m128i c13[3];
+    __m128i offset[3];
+};
+
+static void MakeConstants(const ColorMatrix& matrix, MatrixConstants128& k)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        k.c02[i] = _mm_set1_epi32((int32_t)(((uint32_t)matrix.m[i][2] << 16) | ((uint32_t)matrix.m[i][0] & 0xffff)));
+        k.c13[i] = _mm_set1_epi32(matrix.m[i][1] & 0xffff);
+        k.offset[i] = _mm_set1_epi32(matrix.m[i][3]);
+    }
+}
+
+static inline __m128i Apply4(__m128i px, const MatrixConstants128& k)
+{
+    const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+    __m128i c02 = _mm_and_si128(px, mask);
+    __m128i c13 = _mm_and_si128(_mm_srli_epi32(px, 8), mask);
+    __m128i out[3];
+    for (int i = 0; i < 3; i++)
+    {
+        __m128i sum = _mm_add_epi32(_mm_madd_epi16(c02, k.c02[i]), _mm_madd_epi16(c13, k.c13[i]));
+        out[i] = _mm_srai_epi32(_mm_add_epi32(sum, k.offset[i]), ColorMatrix::SHIFT);
+    }
+
+    // saturate to bytes as planes c0 c2 c1 c3, then interleave back to c0 c1 c2 c3 per pixel.
+    __m128i c3 = _mm_srli_epi32(px, 24);
+    __m128i planar = _mm_packus_epi16(_mm_packs_epi32(out[0], out[2]), _mm_packs_epi32(out[1], c3));
+    __m128i t = _mm_unpacklo_epi8(planar, _mm_srli_si128(planar, 8));
+    return _mm_unpacklo_epi16(t, _mm_srli_si128(t, 8));
+}
+#endif
+
+#if defined(SIMD_AVX2)
+struct MatrixConstants256
+{
+    __m256i c02[3];
+    __m256i c13[3];
+    __m256i offset[3];
+};
+
+static void MakeConstants(const ColorMatrix& matrix, MatrixConstants256& k)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        k.c02[i] = _mm256_set1_epi32((int32_t)(((uint32_t)matrix.m[i][2] << 16) | ((uint32_t)matrix.m[i][0] & 0xffff)));
+        k.c13[i] = _mm256_set1_epi32(matrix.m[i][1] & 0xffff);
+        k.offset[i] = _mm256_set1_epi32(matrix.m[i][3]);
+    }
+}
+
+static inline __m256i Apply8(__m256i px, const MatrixConstants256& k)
+{
+    const __m256i mask = _mm256_set1_epi32(0x00ff00ff);
+    __m256i c02 = _mm256_and_si256(px, mask);
+    __m256i c13 = _mm256_and_si256(_mm256_srli_epi32(px, 8), mask);
+    __m256i out[3];
+    for (int i = 0; i < 3; i++)
+    {
+        __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(c02, k.c02[i]), _mm256_madd_epi16(c13, k.c13[i]));
+        out[i] = _mm256_srai_epi32(_mm256_add_epi32(sum, k.offset[i]), ColorMatrix::SHIFT);
+    }
+
+    __m256i c3 = _mm256_srli_epi32(px, 24);
+    __m256i planar = _mm256_packus_epi16(_mm256_packs_epi32(out[0], out[2]), _mm256_packs_epi32(out[1], c3));
+    __m256i t = _mm256_unpacklo_epi8(planar, _mm256_srli_si256(planar, 8));
+    return _mm256_unpacklo_epi16(t, _mm256_srli_si256(t, 8));
+}
+#endif
+
+void ApplyColorMatrix(uint8_t* pixels, size_t numPixels, int pixelSize, const ColorMatrix& matrix)
+{
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    if (FitsInt16(matrix))
+    {
+        if (pixelSize == 4)
+        {
+#if defined(SIMD_AVX2)
+            MatrixConstants256 k8;
+            MakeConstants(matrix, k8);
+            for (; i + 8 <= numPixels; i += 8)
+            {
+                __m256i* p = (__m256i*)(pixels + i * 4);
+                _mm256_storeu_si256(p, Apply8(_mm256_loadu_si256(p), k8));
+            }
+#endif
+            MatrixConstants128 k;
+            MakeConstants(matrix, k);
+            for (; i + 4 <= numPixels; i += 4)
+            {
+                __m128i* p = (__m128i*)(pixels + i * 4);
+                _mm_storeu_si128(p, Apply4(_mm_loadu_si128(p), k));
+            }
+        }
+        else if (pixelSize == 3)
+        {
+#if defined(SIMD_AVX2)
+            MatrixConstants256 k8;
+            MakeConstants(matrix, k8);
+            for (; i + 8 < numPixels; i += 8)
+            {
+                uint8_t* p = pixels + i * 3;
+                __m256i px = _mm256_setr_epi32(Load32(p), Load32(p + 3), Load32(p + 6), Load32(p + 9),
+                                               Load32(p + 12), Load32(p + 15), Load32(p + 18), Load32(p + 21));
+                uint32_t lanes[8];
+                _mm256_storeu_si256((__m256i*)lanes, Apply8(px, k8));
+                for (int j = 0; j < 8; j++)
+                {
+                    memcpy(p + j * 3, &lanes[j], 4);
+                }
+            }
+#endif
+            MatrixConstants128 k;
+            MakeConstants(matrix, k);
+            for (; i + 4 < numPixels; i += 4)
+            {
+                uint8_t* p = pixels + i * 3;
+                __m128i px = _mm_setr_epi32(Load32(p), Load32(p + 3), Load32(p + 6), Load32(p + 9));
+                uint32_t lanes[4];
+                _mm_storeu_si128((__m128i*)lanes, Apply4(px, k));
+                for (int j = 0; j < 4; j++)
+                {
+                    memcpy(p + j * 3, &lanes[j], 4);
+                }
+            }
+        }
+    }
+#endif
+    ApplyScalar(pixels + i * pixelSize, numPixels - i, pixelSize, matrix);
+}
+
+bool ApplyColorMatrix(Image& img, const ColorMatrix& matrix)
+{
+    if (img.pixelFormat != PixelFormat::RGB && img.pixelFormat != PixelFormat::RGBA)
+    {
+        Log::printf("Error: color matrix needs an RGB or RGBA image\n");
+        return false;
+    }
+
+    int pixelSize = (int)img.GetPixelSize();
+    uint8_t* pixels = img.data.data();
+    ParallelFor(0, (size_t)img.width * img.height, 1 << 14, [&](size_t begin, size_t end)
+    {
+        ApplyColorMatrix(pixels + begin * pixelSize, end - begin, pixelSize, matrix);
+    });
+    return true;
+}
+
+bool ParseColorStandard(const char* name, ColorStandard* standardOut)
+{
+    static const char* s_standardNames[(int)ColorStandard::NUM_STANDARDS] = {"601", "709", "2020"};
+    for (int i = 0; i < (int)ColorStandard::NUM_STANDARDS; i++)
+    {
+        if (!strcmp(name, s_standardNames[i]))
+        {
+            *standardOut = (ColorStandard)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseColorRange(const char* name, ColorRange* rangeOut)
+{
+    if (!strcmp(name, "limited"))
+    {
+        *rangeOut = ColorRange::Limited;
+        return true;
+    }
+    else if (!strcmp(name, "full"))
+    {
+        *rangeOut = ColorRange::Full;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,60 @@
+#ifndef COLORMATRIX_H
+#define COLORMATRIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Image;
+
+enum class ColorStandard {
+    BT601 = 0,
+    BT709,
+    BT2020,
+    NUM_STANDARDS
+};
+
+enum class ColorRange {
+    Limited = 0,  // studio swing, Y in [16, 235], UV in [16, 240]
+    Full
+};
+
+// 3x4 fixed point matrix applied to the first three channels of a pixel:
+//   out[i] = (m[i][0] * c0 + m[i][1] * c1 + m[i][2] * c2 + m[i][3]) >> SHIFT
+// m[i][3] holds the offset and the rounding bias, already scaled by 1 << SHIFT.
+// coeffs keeps the exact double matrix, so inverses and products don't accumulate rounding.
+struct ColorMatrix
+{
+    // 13 bits keeps every coefficient (up to ~2.14 for BT.2020 limited) inside an int16, for _mm_madd_epi16.
+    static const int SHIFT = 13;
+
+    int32_t m[3][4];
+    double coeffs[3][4];
+};
+
+ColorMatrix MakeColorMatrix(const double coeffs[3][4]);
+ColorMatrix MakeIdentityColorMatrix();
+
+// RGB -> YUV (Y in the first channel, U in the second, V in the third)
+ColorMatrix MakeRGBToYUV(ColorStandard standard, ColorRange range);
+
+// YUV -> RGB, the exact inverse of MakeRGBToYUV
+ColorMatrix MakeYUVToRGB(ColorStandard standard, ColorRange range);
+
+ColorMatrix InvertColorMatrix(const ColorMatrix& matrix);
+
+// a applied after b
+ColorMatrix MultiplyColorMatrix(const ColorMatrix& a, const ColorMatrix& b);
+
+// in place, pixelSize is 3 or 4 (the fourth channel is left alone), results are clamped to [0, 255].
+void ApplyColorMatrix(uint8_t* pixels, size_t numPixels, int pixelSize, const ColorMatrix& matrix);
+
+// RGB and RGBA images only, multi-threaded.
+bool ApplyColorMatrix(Image& img, const ColorMatrix& matrix);
+
+// returns false if name is not one of 601, 709 or 2020
+bool ParseColorStandard(const char* name, ColorStandard* standardOut);
+
+// returns false if name is not one of full or limited
+bool ParseColorRange(const char* name, ColorRange* rangeOut);
+
+#endif
@@ -0,0 +1,324 @@
+#include "compare.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+#include "image.h"
+#include "log.h"
+#include "parallel.h"
+#include "simd.h"
+#include "util.h"
+
+// sums of one channel over one window, everything ssim needs.
+struct WindowSums
+{
+    uint64_t a, b, aa, bb, ab;
+};
+
+static void DiffSpan(const uint8_t* a, const uint8_t* b, size_t count, int& maxDiff, uint64_t& numDiffs, uint64_t& sumSq)
+{
+    size_t i = 0;
+    int localMax = 0;
+#if defined(SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(1);
+    __m128i vmax = zero;
+    __m128i equalCount = zero;
+    while (i + 16 <= count)
+    {
+        // 32 bit lanes gain at most 4 * 255^2 per block, so flush to 64 bits every 4096 blocks.
+        __m128i sq = zero;
+        size_t blockEnd = std::min(count - 15, i + 4096 * 16);
+        for (; i < blockEnd; i += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            vmax = _mm_max_epu8(vmax, d);
+            equalCount = _mm_add_epi64(equalCount, _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(d, zero), ones), zero));
+            __m128i lo = _mm_unpacklo_epi8(d, zero);
+            __m128i hi = _mm_unpackhi_epi8(d, zero);
+            sq = _mm_add_epi32(sq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, sq);
+        sumSq += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    uint8_t maxBytes[16];
+    _mm_storeu_si128((__m128i*)maxBytes, vmax);
+    for (int k = 0; k < 16; k++)
+    {
+        localMax = std::max(localMax, (int)maxBytes[k]);
+    }
+    uint64_t equal[2];
+    _mm_storeu_si128((__m128i*)equal, equalCount);
+    numDiffs += i - (equal[0] + equal[1]);
+#endif
+    for (; i < count; i++)
+    {
+        int d = abs((int)a[i] - (int)b[i]);
+        localMax = std::max(localMax, d);
+        numDiffs += d ? 1 : 0;
+        sumSq += (uint64_t)(d * d);
+    }
+    maxDiff = std::max(maxDiff, localMax);
+}
+
+// rowsA and rowsB point at the first pixel of the window in each of its rows, planes of one channel.
+static void SumWindow(const uint8_t* const* rowsA, const uint8_t* const* rowsB, int windowWidth, int windowHeight, WindowSums& sums)
+{
+#if defined(SIMD_SSE2)
+    if (windowWidth == 8)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sa = zero, sb = zero, saa = zero, sbb = zero, sab = zero;
+        for (int r = 0; r < windowHeight; r++)
+        {
+            __m128i a8 = _mm_loadl_epi64((const __m128i*)rowsA[r]);
+            __m128i b8 = _mm_loadl_epi64((const __m128i*)rowsB[r]);
+            sa = _mm_add_epi64(sa, _mm_sad_epu8(a8, zero));
+            sb = _mm_add_epi64(sb, _mm_sad_epu8(b8, zero));
+            __m128i a16 = _mm_unpacklo_epi8(a8, zero);
+            __m128i b16 = _mm_unpacklo_epi8(b8, zero);
+            saa = _mm_add_epi32(saa, _mm_madd_epi16(a16, a16));
+            sbb = _mm_add_epi32(sbb, _mm_madd_epi16(b16, b16));
+            sab = _mm_add_epi32(sab, _mm_madd_epi16(a16, b16));
+        }
+        uint32_t lanes[4];
+        sums.a = (uint64_t)_mm_cvtsi128_si32(sa);
+        sums.b = (uint64_t)_mm_cvtsi128_si32(sb);
+        _mm_storeu_si128((__m128i*)lanes, saa);
+        sums.aa = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_si128((__m128i*)lanes, sbb);
+        sums.bb = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm_storeu_si128((__m128i*)lanes, sab);
+        sums.ab = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        return;
+    }
+#endif
+    sums = {0, 0, 0, 0, 0};
+    for (int r = 0; r < windowHeight; r++)
+    {
+        for (int x = 0; x < windowWidth; x++)
+        {
+            uint32_t a = rowsA[r][x];
+            uint32_t b = rowsB[r][x];
+            sums.a += a;
+            sums.b += b;
+            sums.aa += a * a;
+            sums.bb += b * b;
+            sums.ab += a * b;
+        }
+    }
+}
+
+static double WindowSSIM(const WindowSums& sums, int numPixels)
+{
+    const double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+    const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+    double n = numPixels;
+    double muA = sums.a / n;
+    double muB = sums.b / n;
+    double varA = sums.aa / n - muA * muA;
+    double varB = sums.bb / n - muB * muB;
+    double cov = sums.ab / n - muA * muB;
+    return ((2.0 * muA * muB + C1) * (2.0 * cov + C2)) / ((muA * muA + muB * muB + C1) * (varA + varB + C2));
+}
+
+bool CompareImages(const Image& a, const Image& b, CompareResult& result)
+{
+    if (a.width != b.width || a.height != b.height || a.pixelFormat != b.pixelFormat)
+    {
+        Log::printf("Error: can't compare a %ux%u image with a %ux%u image of a different format\n", a.width, a.height, b.width, b.height);
+        return false;
+    }
+
+    const int channels = (int)a.GetPixelSize();
+    const size_t rowSize = (size_t)a.width * channels;
+    std::mutex mutex;
+
+    // per-value differences
+    int maxDiff = 0;
+    uint64_t numDiffs = 0;
+    uint64_t sumSq = 0;
+    ParallelFor(0, a.height, 16, [&](size_t begin, size_t end)
+    {
+        int localMax = 0;
+        uint64_t localDiffs = 0;
+        uint64_t localSq = 0;
+        DiffSpan(a.data.data() + begin * rowSize, b.data.data() + begin * rowSize, (end - begin) * rowSize, localMax, localDiffs, localSq);
+        std::lock_guard<std::mutex> lock(mutex);
+        maxDiff = std::max(maxDiff, localMax);
+        numDiffs += localDiffs;
+        sumSq += localSq;
+    });
+
+    // ssim over 8x8 windows every 4 pixels, smaller images are one window.
+    const int windowWidth = std::min((int)a.width, 8);
+    const int windowHeight = std::min((int)a.height, 8);
+    const int numBandsY = ((int)a.height - windowHeight) / 4 + 1;
+    const int numWindowsX = ((int)a.width - windowWidth) / 4 + 1;
+    double ssimSum = 0.0;
+    ParallelFor(0, numBandsY, 4, [&](size_t begin, size_t end)
+    {
+        // one band of rows split into a plane per channel, so windows are contiguous bytes.
+        std::vector<uint8_t> planesA((size_t)channels * windowHeight * a.width);
+        std::vector<uint8_t> planesB(planesA.size());
+        const uint8_t* rowsA[8];
+        const uint8_t* rowsB[8];
+        double localSum = 0.0;
+        for (size_t band = begin; band < end; band++)
+        {
+            size_t y0 = band * 4;
+            for (int r = 0; r < windowHeight; r++)
+            {
+                const uint8_t* srcA = a.data.data() + (y0 + r) * rowSize;
+                const uint8_t* srcB = b.data.data() + (y0 + r) * rowSize;
+                for (int c = 0; c < channels; c++)
+                {
+                    uint8_t* dstA = planesA.data() + ((size_t)c * windowHeight + r) * a.width;
+                    uint8_t* dstB = planesB.data() + ((size_t)c * windowHeight + r) * a.width;
+                    for (uint32_t x = 0; x < a.width; x++)
+                    {
+                        dstA[x] = srcA[x * channels + c];
+                        dstB[x] = srcB[x * channels + c];
+                    }
+                }
+            }
+
+            for (int c = 0; c < channels; c++)
+            {
+                for (int wx = 0; wx < numWindowsX; wx++)
+                {
+                    for (int r = 0; r < windowHeight; r++)
+                    {
+                        rowsA[r] = planesA.data() + ((size_t)c * windowHeight + r) * a.width + wx * 4;
+                        rowsB[r] = planesB.data() + ((size_t)c * windowHeight + r) * a.width + wx * 4;
+                    }
+                    WindowSums sums;
+                    SumWindow(rowsA, rowsB, windowWidth, windowHeight, sums);
+                    localSum += WindowSSIM(sums, windowWidth * windowHeight);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ssimSum += localSum;
+    });
+
+    const double numValues = (double)rowSize * a.height;
+    result.maxAbsDiff = maxDiff;
+    result.numDiffs = numDiffs;
+    result.mse = numValues > 0.0 ? sumSq / numValues : 0.0;
+    result.psnr = result.mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / result.mse) : INFINITY;
+    result.ssim = ssimSum / ((double)numBandsY * numWindowsX * channels);
+    return true;
+}
+
+bool CompareFiles(const std::string& a, const std::string& b, CompareResult& result)
+{
+    Image imgA, imgB;
+    if (!imgA.Load(a) || !imgB.Load(b))
+    {
+        return false;
+    }
+    return CompareImages(imgA, imgB, result);
+}
+
+std::string FormatCompareResult(const CompareResult& result)
+{
+    char line[256];
+    if (isinf(result.psnr))
+    {
+        snprintf(line, sizeof(line), "max diff %d, %llu values differ, psnr inf, ssim %.6f",
+                 result.maxAbsDiff, (unsigned long long)result.numDiffs, result.ssim);
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "max diff %d, %llu values differ, psnr %.2f dB, ssim %.6f",
+                 result.maxAbsDiff, (unsigned long long)result.numDiffs, result.psnr, result.ssim);
+    }
+    return line;
+}
+
+// relative paths of every png under root, sorted so the report order is stable.
+static bool ListPNGs(const std::filesystem::path& root, std::vector<std::string>& files)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(root, ec), endIt; !ec && it != endIt; it.increment(ec))
+    {
+        if (it->is_regular_file() && HasExtension(it->path().filename().string(), ".png"))
+        {
+            files.push_back(it->path().lexically_relative(root).generic_string());
+        }
+    }
+    if (ec)
+    {
+        Log::printf("Error: failed to list \"%s\": %s\n", root.string().c_str(), ec.message().c_str());
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+    return true;
+}
+
+int CompareDirectories(const std::string& dirA, const std::string& dirB, int tolerance)
+{
+    std::vector<std::string> filesA;
+    std::vector<std::string> filesB;
+    if (!ListPNGs(GetRootPath() + dirA, filesA) || !ListPNGs(GetRootPath() + dirB, filesB))
+    {
+        return 1;
+    }
+
+    // a file on only one side fails without a compare, extra outputs in B count as much as missing ones.
+    int numFailed = 0;
+    std::vector<std::string> files;
+    std::vector<std::string> onlyInA;
+    std::vector<std::string> onlyInB;
+    std::set_intersection(filesA.begin(), filesA.end(), filesB.begin(), filesB.end(), std::back_inserter(files));
+    std::set_difference(filesA.begin(), filesA.end(), filesB.begin(), filesB.end(), std::back_inserter(onlyInA));
+    std::set_difference(filesB.begin(), filesB.end(), filesA.begin(), filesA.end(), std::back_inserter(onlyInB));
+    for (const std::string& file : onlyInA)
+    {
+        Log::printf("FAIL %s: missing from \"%s\"\n", file.c_str(), dirB.c_str());
+        numFailed++;
+    }
+    for (const std::string& file : onlyInB)
+    {
+        Log::printf("FAIL %s: missing from \"%s\"\n", file.c_str(), dirA.c_str());
+        numFailed++;
+    }
+
+    // the ParallelFor inside CompareImages runs serially here, the parallelism is across files.
+    std::vector<CompareResult> results(files.size());
+    std::vector<char> compared(files.size(), 0);
+    ParallelFor(0, files.size(), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            compared[i] = CompareFiles(dirA + "/" + files[i], dirB + "/" + files[i], results[i]) ? 1 : 0;
+        }
+    });
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!compared[i])
+        {
+            Log::printf("FAIL %s: could not compare\n", files[i].c_str());
+            numFailed++;
+        }
+        else if (results[i].maxAbsDiff > tolerance)
+        {
+            Log::printf("FAIL %s: %s\n", files[i].c_str(), FormatCompareResult(results[i]).c_str());
+            numFailed++;
+        }
+    }
+    Log::printf("compared %d files, %d only on one side, %d failed\n", (int)files.size(), (int)(onlyInA.size() + onlyInB.size()), numFailed);
+    return numFailed;
+}
@@ -0,0 +1,33 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <stdint.h>
+#include <string>
+
+struct Image;
+
+struct CompareResult
+{
+    int maxAbsDiff;      // largest difference of any channel of any pixel
+    uint64_t numDiffs;   // channel values that differ at all
+    double mse;          // mean squared error over every channel
+    double psnr;         // dB, INFINITY for identical images
+    double ssim;         // mean over 8x8 windows (stride 4) and channels, 1.0 for identical images
+};
+
+// a and b must have the same size and pixel format, multi-threaded.
+bool CompareImages(const Image& a, const Image& b, CompareResult& result);
+
+// loads both with Image::Load, alpha pre-multiplied, and compares them.
+bool CompareFiles(const std::string& a, const std::string& b, CompareResult& result);
+
+// Compares every png under dirA with the file at the same relative path under dirB, files in parallel.
+// A file passes if its maxAbsDiff is at most tolerance. A png under only one of the two directories fails,
+// failures and missing files are logged.
+// Returns the number of files that failed.
+int CompareDirectories(const std::string& dirA, const std::string& dirB, int tolerance);
+
+// one line: max diff, differing values, psnr and ssim
+std::string FormatCompareResult(const CompareResult& result);
+
+#endif
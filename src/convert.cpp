@@ -0,0 +1,83 @@
+#include "convert.h"
+
+#include <glm/glm.hpp>
+
+#include "image.h"
+#include "pixelops.h"
+
+// [0, 255]
+float GrayToLuma(float g, ColorRange range)
+{
+    if (range == ColorRange::Full)
+    {
+        return g;
+    }
+    return 0.859f * g + 16.0f;
+}
+
+// [0, 255]
+float LumaToGray(float y, ColorRange range)
+{
+    if (range == ColorRange::Full)
+    {
+        return y;
+    }
+    return (y - 16.0f) / 0.859f;
+}
+
+// [0, 255]
+float linearToSRGB(float i)
+{
+    float l = i / 255.0f;
+    float s;
+    if (l <= 0.0031308f)
+    {
+        s = l * 12.92f;
+    }
+    else
+    {
+        s = 1.055f * glm::pow(l, 1.0f/2.4f) - 0.055f;
+    }
+    return s * 255.0f;
+}
+
+void MakeSRGBTable(uint8_t table[256])
+{
+    for (int i = 0; i < 256; i++)
+    {
+        table[i] = (uint8_t)glm::clamp(linearToSRGB((float)i), 0.0f, 255.0f);
+    }
+}
+
+void AddProcessStages(PixelPipeline& pipeline, PixelFormat pixelFormat, ColorStandard standard, ColorRange range)
+{
+    // convert from RGB to YUV
+    if (pixelFormat == PixelFormat::RGB || pixelFormat == PixelFormat::RGBA)
+    {
+        pipeline.Matrix(MakeRGBToYUV(standard, range));
+    }
+    else
+    {
+        // gray only has luma
+        uint8_t table[256];
+        for (int i = 0; i < 256; i++)
+        {
+            table[i] = (uint8_t)glm::clamp(GrayToLuma((float)i, range) + 0.5f, 0.0f, 255.0f);
+        }
+        pipeline.Lut(table, 0x1);
+    }
+
+    /*
+    // apply 2.2 gamma to each pixel.
+    uint8_t srgbTable[256];
+    MakeSRGBTable(srgbTable);
+    pipeline.Lut(srgbTable, 0xf);
+    */
+}
+
+void processImage(Image& img, ColorStandard standard, ColorRange range)
+{
+    PixelPipeline pipeline;
+    AddProcessStages(pipeline, img.pixelFormat, standard, range);
+    pipeline.Execute(img);
+}
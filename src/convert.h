@@ -0,0 +1,31 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+
+#include "colormatrix.h"
+#include "image.h"
+
+struct PixelPipeline;
+
+// [0, 255]
+float GrayToLuma(float g, ColorRange range = ColorRange::Limited);
+
+// [0, 255]
+float LumaToGray(float y, ColorRange range = ColorRange::Limited);
+
+// [0, 255]
+float linearToSRGB(float i);
+
+// linearToSRGB baked into a table, for PixelPipeline::Lut
+void MakeSRGBTable(uint8_t table[256]);
+
+// appends the stages processImage runs for images of pixelFormat,
+// so callers can fuse them with their own stages (pre-multiply after a Load(filename, false) for example).
+void AddProcessStages(PixelPipeline& pipeline, PixelFormat pixelFormat, ColorStandard standard, ColorRange range);
+
+// converts RGB pixels to YUV in place, gray images only get their luma remapped.
+// only depends on the pixels themselves, so it can be run on any stripe of rows.
+void processImage(Image& img, ColorStandard standard = ColorStandard::BT709, ColorRange range = ColorRange::Limited);
+
+#endif
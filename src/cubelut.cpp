@@ -0,0 +1,323 @@
+#include "cubelut.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "memtrack.h"
+#include "simd.h"
+#include "util.h"
+
+CubeLut::CubeLut() : size(0)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        domainMin[c] = 0.0f;
+        domainMax[c] = 1.0f;
+    }
+    memset(cellOffsets, 0, sizeof(cellOffsets));
+    memset(cellFractions, 0, sizeof(cellFractions));
+}
+
+bool CubeLut::Load(const std::string& filename)
+{
+    std::string text;
+    if (!LoadFile(filename, text))
+    {
+        Log::printf("Error: Failed to open \"%s\"\n", filename.c_str());
+        return false;
+    }
+    return Parse(text, filename);
+}
+
+// parses count floats separated by whitespace, false if there are fewer or anything else follows.
+static bool ParseFloats(const char* s, float* out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        char* end;
+        out[i] = strtof(s, &end);
+        if (end == s)
+        {
+            return false;
+        }
+        s = end;
+    }
+    while (*s == ' ' || *s == '\t' || *s == '\r')
+    {
+        s++;
+    }
+    return *s == 0;
+}
+
+bool CubeLut::Parse(const std::string& text, const std::string& name)
+{
+    size = 0;
+    title.clear();
+    table.clear();
+    for (int c = 0; c < 3; c++)
+    {
+        domainMin[c] = 0.0f;
+        domainMax[c] = 1.0f;
+    }
+
+    size_t numEntries = 0;
+    size_t entriesRead = 0;
+    int lineNumber = 0;
+    size_t pos = 0;
+    std::string line;
+    while (pos < text.size())
+    {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+        line.assign(text, pos, end - pos);
+        pos = end + 1;
+        lineNumber++;
+
+        const char* s = line.c_str();
+        while (*s == ' ' || *s == '\t')
+        {
+            s++;
+        }
+        if (*s == 0 || *s == '\r' || *s == '#')
+        {
+            continue;
+        }
+
+        // keywords come before the data, every data line starts with a number.
+        if ((*s >= '0' && *s <= '9') || *s == '-' || *s == '+' || *s == '.')
+        {
+            if (size == 0)
+            {
+                Log::printf("Error: \"%s\" line %d: data before LUT_3D_SIZE\n", name.c_str(), lineNumber);
+                return false;
+            }
+            if (entriesRead == numEntries)
+            {
+                Log::printf("Error: \"%s\" line %d: more than %zu entries\n", name.c_str(), lineNumber, numEntries);
+                return false;
+            }
+            float* entry = &table[entriesRead * 4];
+            if (!ParseFloats(s, entry, 3))
+            {
+                Log::printf("Error: \"%s\" line %d: expected 3 numbers\n", name.c_str(), lineNumber);
+                return false;
+            }
+            entry[0] *= 255.0f;
+            entry[1] *= 255.0f;
+            entry[2] *= 255.0f;
+            entriesRead++;
+        }
+        else if (!strncmp(s, "TITLE", 5))
+        {
+            const char* open = strchr(s, '"');
+            const char* close = open ? strrchr(open + 1, '"') : nullptr;
+            title = close ? std::string(open + 1, close) : std::string();
+        }
+        else if (!strncmp(s, "LUT_3D_SIZE", 11))
+        {
+            const int n = atoi(s + 11);
+            if (n < MIN_SIZE || n > MAX_SIZE || size != 0)
+            {
+                Log::printf("Error: \"%s\" line %d: bad LUT_3D_SIZE, %d to %d once\n", name.c_str(), lineNumber, MIN_SIZE, MAX_SIZE);
+                return false;
+            }
+            size = n;
+            numEntries = (size_t)n * n * n;
+            table.assign(numEntries * 4, 0.0f);
+        }
+        else if (!strncmp(s, "DOMAIN_MIN", 10) || !strncmp(s, "DOMAIN_MAX", 10))
+        {
+            float* domain = s[8] == 'I' ? domainMin : domainMax;
+            if (!ParseFloats(s + 10, domain, 3))
+            {
+                Log::printf("Error: \"%s\" line %d: expected 3 numbers\n", name.c_str(), lineNumber);
+                return false;
+            }
+        }
+        else if (!strncmp(s, "LUT_3D_INPUT_RANGE", 18))
+        {
+            // resolve writes one range for all three channels
+            float range[2];
+            if (!ParseFloats(s + 18, range, 2))
+            {
+                Log::printf("Error: \"%s\" line %d: expected 2 numbers\n", name.c_str(), lineNumber);
+                return false;
+            }
+            for (int c = 0; c < 3; c++)
+            {
+                domainMin[c] = range[0];
+                domainMax[c] = range[1];
+            }
+        }
+        else if (!strncmp(s, "LUT_1D_SIZE", 11))
+        {
+            Log::printf("Error: \"%s\" is a 1D lut, only 3D luts are supported\n", name.c_str());
+            return false;
+        }
+        else
+        {
+            // LUT_1D_INPUT_RANGE and vendor keywords don't change a 3D lut.
+            continue;
+        }
+    }
+
+    if (size == 0 || entriesRead != numEntries)
+    {
+        Log::printf("Error: \"%s\" has %zu of %zu entries\n", name.c_str(), entriesRead, numEntries);
+        size = 0;
+        return false;
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        if (!(domainMax[c] > domainMin[c]))
+        {
+            Log::printf("Error: \"%s\" has an empty domain\n", name.c_str());
+            size = 0;
+            return false;
+        }
+    }
+
+    // the last cell also covers the top edge, where the fraction is 1, so the far corner is always in the table.
+    const uint32_t strides[3] = {4, 4 * (uint32_t)size, 4 * (uint32_t)size * size};
+    for (int c = 0; c < 3; c++)
+    {
+        const float scale = (size - 1) / (domainMax[c] - domainMin[c]);
+        for (int v = 0; v < 256; v++)
+        {
+            const float x = std::min(std::max((v / 255.0f - domainMin[c]) * scale, 0.0f), (float)(size - 1));
+            const int cell = std::min((int)x, size - 2);
+            cellOffsets[c][v] = cell * strides[c];
+            cellFractions[c][v] = x - cell;
+        }
+    }
+    return true;
+}
+
+// the tetrahedron a point of the unit cube falls in, by which of its fractions are >= which:
+// bit 0 r >= g, bit 1 g >= b, bit 2 r >= b. The walk from corner 000 to 111 goes along the axis with the largest
+// fraction first, then the second. The two impossible combinations get any valid order.
+static const uint8_t s_tetrahedronOrder[8][3] = {
+    {2, 1, 0},  // b > g > r
+    {2, 0, 1},  // b > r >= g
+    {1, 2, 0},  // g >= b > r
+    {2, 1, 0},  // impossible
+    {2, 1, 0},  // impossible
+    {0, 2, 1},  // r >= b > g
+    {1, 0, 2},  // g > r >= b
+    {0, 1, 2},  // r >= g >= b
+};
+
+void CubeLut::Apply(uint8_t* pixels, size_t numPixels, int pixelSize) const
+{
+    if (size < MIN_SIZE || pixelSize < 3)
+    {
+        return;
+    }
+
+    // offsets of the second and third corner of each tetrahedron from the first, the fourth is always 111.
+    const uint32_t strides[3] = {4, 4 * (uint32_t)size, 4 * (uint32_t)size * size};
+    uint32_t steps[8][2];
+    for (int k = 0; k < 8; k++)
+    {
+        steps[k][0] = strides[s_tetrahedronOrder[k][0]];
+        steps[k][1] = steps[k][0] + strides[s_tetrahedronOrder[k][1]];
+    }
+    const uint32_t farCorner = strides[0] + strides[1] + strides[2];
+
+    const float* lattice = table.data();
+    uint8_t* p = pixels;
+    for (size_t i = 0; i < numPixels; i++, p += pixelSize)
+    {
+        const float* c0 = lattice + cellOffsets[0][p[0]] + cellOffsets[1][p[1]] + cellOffsets[2][p[2]];
+        const float f[3] = {cellFractions[0][p[0]], cellFractions[1][p[1]], cellFractions[2][p[2]]};
+        const int k = (f[0] >= f[1] ? 1 : 0) | (f[1] >= f[2] ? 2 : 0) | (f[0] >= f[2] ? 4 : 0);
+        const uint8_t* order = s_tetrahedronOrder[k];
+        const float* c1 = c0 + steps[k][0];
+        const float* c2 = c0 + steps[k][1];
+        const float* c3 = c0 + farCorner;
+        const float x = f[order[0]];
+        const float y = f[order[1]];
+        const float z = f[order[2]];
+
+#if defined(SIMD_SSE2)
+        // one lattice point per register, c0 + x (c1 - c0) + y (c2 - c1) + z (c3 - c2)
+        const __m128 v0 = _mm_loadu_ps(c0);
+        const __m128 v1 = _mm_loadu_ps(c1);
+        const __m128 v2 = _mm_loadu_ps(c2);
+        const __m128 v3 = _mm_loadu_ps(c3);
+        __m128 sum = _mm_add_ps(v0, _mm_mul_ps(_mm_set1_ps(x), _mm_sub_ps(v1, v0)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(y), _mm_sub_ps(v2, v1)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(z), _mm_sub_ps(v3, v2)));
+
+        // clamp and round half up, the same as the scalar path
+        sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+        __m128i packed = _mm_cvttps_epi32(_mm_add_ps(sum, _mm_set1_ps(0.5f)));
+        packed = _mm_packs_epi32(packed, packed);
+        packed = _mm_packus_epi16(packed, packed);
+        const uint32_t rgb = (uint32_t)_mm_cvtsi128_si32(packed);
+        p[0] = (uint8_t)rgb;
+        p[1] = (uint8_t)(rgb >> 8);
+        p[2] = (uint8_t)(rgb >> 16);
+#else
+        for (int c = 0; c < 3; c++)
+        {
+            const float v = c0[c] + x * (c1[c] - c0[c]) + y * (c2[c] - c1[c]) + z * (c3[c] - c2[c]);
+            p[c] = (uint8_t)(std::min(std::max(v, 0.0f), 255.0f) + 0.5f);
+        }
+#endif
+    }
+}
+
+//
+// LutTexture
+//
+
+LutTexture::LutTexture(const CubeLut& lut) : texture(0), size(lut.size)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        domainMin[c] = lut.domainMin[c];
+        domainMax[c] = lut.domainMax[c];
+    }
+
+    // the table is pre-scaled for 8 bit output, the shader wants [0, 1].
+    std::vector<float> texels(lut.table.size());
+    for (size_t i = 0; i < texels.size(); i++)
+    {
+        texels[i] = lut.table[i] * (1.0f / 255.0f);
+    }
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, size, size, size, 0, GL_RGBA, GL_FLOAT, texels.data());
+
+    // drivers pad RGB16F to 8 bytes a texel
+    gpuBytes = (size_t)size * size * size * 8;
+    MemTrack::Alloc(MemCategory::Texture, gpuBytes);
+}
+
+LutTexture::~LutTexture()
+{
+    glDeleteTextures(1, &texture);
+    MemTrack::Free(MemCategory::Texture, gpuBytes);
+}
+
+void LutTexture::Apply(int unit) const
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_3D, texture);
+}
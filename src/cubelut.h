@@ -0,0 +1,60 @@
+#ifndef CUBELUT_H
+#define CUBELUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// 3D color lookup table from an Adobe / Resolve .cube file, for grading.
+// Entries are RGBA floats (alpha unused) so a lattice point is one aligned 16 byte load, red varies fastest, then
+// green, then blue, the same order as the file. Values outside [0, 1] are kept, the output clamps.
+struct CubeLut
+{
+    static const int MIN_SIZE = 2;
+    static const int MAX_SIZE = 256;
+
+    CubeLut();
+
+    // relative to the root path, mounted archives are searched first like LoadFile.
+    bool Load(const std::string& filename);
+
+    // parses the text of a .cube file, name is only used in error messages.
+    bool Parse(const std::string& text, const std::string& name);
+
+    // the 4 floats of lattice point r, g, b.
+    const float* GetEntry(int r, int g, int b) const { return &table[4 * (((size_t)b * size + g) * size + r)]; }
+
+    // tetrahedral interpolation of 8 bit RGB (the first three channels of each pixel), alpha and any other channels
+    // are left alone. Grades straight color, pre-multiplied pixels need their alpha divided out first.
+    void Apply(uint8_t* pixels, size_t numPixels, int pixelSize) const;
+
+    int size;
+    float domainMin[3];
+    float domainMax[3];
+    std::string title;
+    std::vector<float> table;  // pre-scaled by 255
+
+    // per channel and 8 bit input value, the float offset of the lattice cell along that axis and the position
+    // inside it, with the domain applied. built by Parse.
+    uint32_t cellOffsets[3][256];
+    float cellFractions[3][256];
+};
+
+// the lut as a GL_RGB16F 3D texture, nearest filtered so the shader can fetch the four corners of a
+// tetrahedron itself (shader/grade_texture_frag.glsl), the same interpolation as CubeLut::Apply.
+struct LutTexture
+{
+    explicit LutTexture(const CubeLut& lut);
+    ~LutTexture();
+
+    void Apply(int unit) const;
+
+    uint32_t texture;
+    int size;
+    float domainMin[3];
+    float domainMax[3];
+    size_t gpuBytes;
+};
+
+#endif
@@ -0,0 +1,557 @@
+#include "filter.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "image.h"
+#include "log.h"
+#include "parallel.h"
+#include "simd.h"
+
+// output tile of Convolve, small enough that its intermediate rows stay in L2.
+static const uint32_t TILE_WIDTH = 256;
+static const uint32_t TILE_HEIGHT = 64;
+
+struct FilterTile
+{
+    uint32_t x0, x1;
+    uint32_t y0, y1;
+};
+
+static void MakeTiles(uint32_t width, uint32_t height, uint32_t tileWidth, uint32_t tileHeight, std::vector<FilterTile>& tiles)
+{
+    tiles.clear();
+    for (uint32_t y = 0; y < height; y += tileHeight)
+    {
+        for (uint32_t x = 0; x < width; x += tileWidth)
+        {
+            tiles.push_back({x, std::min(x + tileWidth, width), y, std::min(y + tileHeight, height)});
+        }
+    }
+}
+
+// maps a pixel index outside [0, size) back inside, the way the gl wrap modes map texture coordinates.
+static int WrapIndex(int i, int size, WrapType wrap)
+{
+    if (i >= 0 && i < size)
+    {
+        return i;
+    }
+    switch (wrap)
+    {
+    case WrapType::Repeat:
+    {
+        const int m = i % size;
+        return m < 0 ? m + size : m;
+    }
+    case WrapType::MirroredRepeat:
+    {
+        const int period = 2 * size;
+        int m = i % period;
+        m = m < 0 ? m + period : m;
+        return m < size ? m : period - 1 - m;
+    }
+    case WrapType::MirrorClampToEdge:
+        return i < 0 ? std::min(-1 - i, size - 1) : size - 1;
+    case WrapType::ClampToEdge:
+    default:
+        return i < 0 ? 0 : size - 1;
+    }
+}
+
+// pixels [x0 - radius, x1 + radius) of row y, with the ones past the edges wrapped.
+static void GatherRow(const Image& src, uint32_t y, int x0, int x1, int radius, WrapType wrap, uint8_t* out)
+{
+    const int width = (int)src.width;
+    const int channels = (int)src.GetPixelSize();
+    const uint8_t* row = src.data.data() + (size_t)y * width * channels;
+    const int begin = x0 - radius;
+    const int end = x1 + radius;
+    const int insideBegin = std::max(begin, 0);
+    const int insideEnd = std::min(end, width);
+    for (int x = begin; x < std::min(insideBegin, end); x++)
+    {
+        memcpy(out + (x - begin) * channels, row + WrapIndex(x, width, wrap) * channels, channels);
+    }
+    if (insideBegin < insideEnd)
+    {
+        memcpy(out + (insideBegin - begin) * channels, row + insideBegin * channels, (size_t)(insideEnd - insideBegin) * channels);
+    }
+    for (int x = std::max(insideEnd, begin); x < end; x++)
+    {
+        memcpy(out + (x - begin) * channels, row + WrapIndex(x, width, wrap) * channels, channels);
+    }
+}
+
+//
+// 16 bit integer rows, for kernels in sixteenths. A pass sums to at most 16 * 255 and two passes to 65280.
+//
+
+static void WidenRow16(uint16_t* out, const uint8_t* in, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpackhi_epi8(bytes, zero));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = in[i];
+    }
+}
+
+// out[i] += weight * in[i]
+static void MulAddRow16(uint16_t* out, const uint16_t* in, uint16_t weight, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    const __m256i w16 = _mm256_set1_epi16((short)weight);
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i product = _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(in + i)), w16);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)(out + i)), product));
+    }
+#elif defined(SIMD_SSE2)
+    const __m128i w8 = _mm_set1_epi16((short)weight);
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i product = _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(in + i)), w8);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(out + i)), product));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = (uint16_t)(out[i] + in[i] * weight);
+    }
+}
+
+// both passes together carry a factor of 256, rounded back out.
+static void NarrowRow16(uint8_t* out, const uint16_t* in, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    const __m128i half = _mm_set1_epi16(128);
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(in + i)), half), 8);
+        const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(in + i + 8)), half), 8);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = (uint8_t)((in[i] + 128) >> 8);
+    }
+}
+
+//
+// float rows, for every other kernel
+//
+
+static void WidenRowFloat(float* out, const uint8_t* in, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*)(in + i));
+        const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(out + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = in[i];
+    }
+}
+
+// out[i] += weight * in[i]
+static void MulAddRowFloat(float* out, const float* in, float weight, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    const __m256 w8 = _mm256_set1_ps(weight);
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), w8)));
+    }
+#elif defined(SIMD_SSE2)
+    const __m128 w4 = _mm_set1_ps(weight);
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), w4)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] += weight * in[i];
+    }
+}
+
+#if defined(SIMD_SSE2)
+// clamps to [0, 255] and rounds half up like the scalar tails. _mm_cvtps_epi32 would round half to even, so the
+// pixels the vector loop covers would disagree with the ones the tail does.
+static inline __m128i RoundClamp4(__m128 v)
+{
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+#endif
+
+// rounds and clamps to [0, 255]
+static void NarrowRowFloat(uint8_t* out, const float* in, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i a = RoundClamp4(_mm_loadu_ps(in + i));
+        const __m128i b = RoundClamp4(_mm_loadu_ps(in + i + 4));
+        const __m128i c = RoundClamp4(_mm_loadu_ps(in + i + 8));
+        const __m128i d = RoundClamp4(_mm_loadu_ps(in + i + 12));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const float v = std::min(std::max(in[i], 0.0f), 255.0f);
+        out[i] = (uint8_t)(v + 0.5f);
+    }
+}
+
+// weights as whole sixteenths summing to 16, false if the kernel has any other weight.
+static bool GetIntegerKernel(const std::vector<float>& kernel, std::vector<uint16_t>& out)
+{
+    out.resize(kernel.size());
+    int sum = 0;
+    for (size_t k = 0; k < kernel.size(); k++)
+    {
+        const float scaled = kernel[k] * 16.0f;
+        const float rounded = floorf(scaled + 0.5f);
+        if (rounded < 0.0f || fabsf(scaled - rounded) > 1e-4f)
+        {
+            return false;
+        }
+        out[k] = (uint16_t)rounded;
+        sum += out[k];
+    }
+    return sum == 16;
+}
+
+template <typename T>
+struct RowOps;
+
+template <>
+struct RowOps<uint16_t>
+{
+    typedef uint16_t Weight;
+    static void Widen(uint16_t* out, const uint8_t* in, size_t count) { WidenRow16(out, in, count); }
+    static void MulAdd(uint16_t* out, const uint16_t* in, uint16_t weight, size_t count) { MulAddRow16(out, in, weight, count); }
+    static void Narrow(uint8_t* out, const uint16_t* in, size_t count) { NarrowRow16(out, in, count); }
+};
+
+template <>
+struct RowOps<float>
+{
+    typedef float Weight;
+    static void Widen(float* out, const uint8_t* in, size_t count) { WidenRowFloat(out, in, count); }
+    static void MulAdd(float* out, const float* in, float weight, size_t count) { MulAddRowFloat(out, in, weight, count); }
+    static void Narrow(uint8_t* out, const float* in, size_t count) { NarrowRowFloat(out, in, count); }
+};
+
+// Both passes over every tile, T is the type of the intermediate rows. Rows are flat runs of channel values,
+// so tap k of a pass is the same row shifted by k pixels, whatever the pixel format.
+template <typename T>
+static void ConvolveTiles(const Image& src, Image& dst, const std::vector<typename RowOps<T>::Weight>& xWeights,
+                          const std::vector<typename RowOps<T>::Weight>& yWeights, WrapType wrap)
+{
+    const int channels = (int)src.GetPixelSize();
+    const int xRadius = (int)xWeights.size() / 2;
+    const int yRadius = (int)yWeights.size() / 2;
+    const size_t dstRowSize = (size_t)src.width * channels;
+
+    std::vector<FilterTile> tiles;
+    MakeTiles(src.width, src.height, TILE_WIDTH, TILE_HEIGHT, tiles);
+    ParallelFor(0, tiles.size(), 1, [&](size_t begin, size_t end)
+    {
+        const size_t paddedSize = (TILE_WIDTH + 2 * xRadius) * channels;
+        const size_t rowSize = TILE_WIDTH * channels;
+        std::vector<uint8_t> gathered(paddedSize);
+        std::vector<T> padded(paddedSize);
+        std::vector<T> rows((TILE_HEIGHT + 2 * yRadius) * rowSize);
+        std::vector<T> acc(rowSize);
+        for (size_t t = begin; t < end; t++)
+        {
+            const FilterTile& tile = tiles[t];
+            const size_t count = (size_t)(tile.x1 - tile.x0) * channels;
+            const int numRows = (int)(tile.y1 - tile.y0) + 2 * yRadius;
+
+            // horizontal pass over the tile and yRadius rows either side of it
+            for (int j = 0; j < numRows; j++)
+            {
+                const int y = WrapIndex((int)tile.y0 - yRadius + j, (int)src.height, wrap);
+                GatherRow(src, (uint32_t)y, (int)tile.x0, (int)tile.x1, xRadius, wrap, gathered.data());
+                RowOps<T>::Widen(padded.data(), gathered.data(), count + 2 * xRadius * channels);
+                T* row = rows.data() + j * rowSize;
+                std::fill(row, row + count, (T)0);
+                for (size_t k = 0; k < xWeights.size(); k++)
+                {
+                    if (xWeights[k] != 0)
+                    {
+                        RowOps<T>::MulAdd(row, padded.data() + k * channels, xWeights[k], count);
+                    }
+                }
+            }
+
+            // vertical pass, straight into the destination
+            for (uint32_t y = tile.y0; y < tile.y1; y++)
+            {
+                std::fill(acc.begin(), acc.begin() + count, (T)0);
+                const T* in = rows.data() + (y - tile.y0) * rowSize;
+                for (size_t k = 0; k < yWeights.size(); k++)
+                {
+                    if (yWeights[k] != 0)
+                    {
+                        RowOps<T>::MulAdd(acc.data(), in + k * rowSize, yWeights[k], count);
+                    }
+                }
+                RowOps<T>::Narrow(dst.data.data() + y * dstRowSize + (size_t)tile.x0 * channels, acc.data(), count);
+            }
+        }
+    });
+}
+
+std::vector<float> MakeGaussianKernel(float sigma)
+{
+    const int radius = std::max(1, (int)ceilf(3.0f * sigma));
+    std::vector<float> kernel(2 * radius + 1);
+    float sum = 0.0f;
+    for (int i = -radius; i <= radius; i++)
+    {
+        kernel[i + radius] = expf(-(float)(i * i) / (2.0f * sigma * sigma));
+        sum += kernel[i + radius];
+    }
+    for (float& w : kernel)
+    {
+        w /= sum;
+    }
+    return kernel;
+}
+
+std::vector<float> MakeBinomialKernel(int taps)
+{
+    if (taps == 5)
+    {
+        return {1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f};
+    }
+    return {1.0f / 4.0f, 2.0f / 4.0f, 1.0f / 4.0f};
+}
+
+bool Convolve(const Image& src, Image& dst, const std::vector<float>& xKernel, const std::vector<float>& yKernel, WrapType wrap)
+{
+    if (src.width == 0 || src.height == 0 || src.data.empty())
+    {
+        Log::printf("Error: Convolve() needs a non-empty image\n");
+        return false;
+    }
+    if (xKernel.size() % 2 == 0 || yKernel.size() % 2 == 0)
+    {
+        Log::printf("Error: Convolve() needs odd length kernels\n");
+        return false;
+    }
+
+    Image result;
+    result.width = src.width;
+    result.height = src.height;
+    result.pixelFormat = src.pixelFormat;
+    result.data.resize(src.data.size());
+
+    std::vector<uint16_t> xInteger, yInteger;
+    if (GetIntegerKernel(xKernel, xInteger) && GetIntegerKernel(yKernel, yInteger))
+    {
+        ConvolveTiles<uint16_t>(src, result, xInteger, yInteger, wrap);
+    }
+    else
+    {
+        ConvolveTiles<float>(src, result, xKernel, yKernel, wrap);
+    }
+
+    dst = std::move(result);
+    return true;
+}
+
+bool GaussianBlur(const Image& src, Image& dst, float sigma, WrapType wrap)
+{
+    if (sigma <= 0.0f)
+    {
+        Log::printf("Error: GaussianBlur() needs a positive sigma\n");
+        return false;
+    }
+    const std::vector<float> kernel = MakeGaussianKernel(sigma);
+    return Convolve(src, dst, kernel, kernel, wrap);
+}
+
+// columnSums += window sums of the added row - window sums of the removed row, for every pixel of two gathered rows.
+// the windows are 2 radius + 1 wide and slide one pixel at a time, both rows in the same pass.
+static void AddBoxSums(const uint8_t* added, const uint8_t* removed, uint32_t* columnSums, size_t numPixels, int radius, int channels)
+{
+    const int window = 2 * radius + 1;
+    int32_t sum[4] = {0, 0, 0, 0};
+    for (int k = 0; k < window; k++)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            sum[c] += added[k * channels + c] - removed[k * channels + c];
+        }
+    }
+    for (int c = 0; c < channels; c++)
+    {
+        columnSums[c] += sum[c];
+    }
+    for (size_t x = 1; x < numPixels; x++)
+    {
+        const uint8_t* enter = added + (x + window - 1) * channels;
+        const uint8_t* leave = added + (x - 1) * channels;
+        const uint8_t* enterRemoved = removed + (x + window - 1) * channels;
+        const uint8_t* leaveRemoved = removed + (x - 1) * channels;
+        for (int c = 0; c < channels; c++)
+        {
+            sum[c] += (enter[c] - leave[c]) - (enterRemoved[c] - leaveRemoved[c]);
+            columnSums[x * channels + c] += sum[c];
+        }
+    }
+}
+
+bool BoxBlur(const Image& src, Image& dst, int radius, WrapType wrap)
+{
+    if (src.width == 0 || src.height == 0 || src.data.empty() || radius < 1 || radius > MAX_BOX_RADIUS)
+    {
+        Log::printf("Error: BoxBlur() needs a non-empty image and a radius from 1 to %d\n", MAX_BOX_RADIUS);
+        return false;
+    }
+
+    const int channels = (int)src.GetPixelSize();
+    const size_t rowSize = (size_t)src.width * channels;
+    const int height = (int)src.height;
+    const uint64_t area = (uint64_t)(2 * radius + 1) * (2 * radius + 1);
+
+    // sum / area rounded, as a multiply and shift. exact while sum * area < 2^48, which the radius limit keeps.
+    const uint64_t reciprocal = ((1ull << 48) + area - 1) / area;
+
+    Image result;
+    result.width = src.width;
+    result.height = src.height;
+    result.pixelFormat = src.pixelFormat;
+    result.data.resize(src.data.size());
+
+    // full height column strips, each keeps running column sums and slides them down one row at a time.
+    // strips are wide next to the radius so gathering the edges of each row stays a small part of the work.
+    const uint32_t stripWidth = std::max(TILE_WIDTH, (uint32_t)(4 * radius));
+    std::vector<FilterTile> strips;
+    MakeTiles(src.width, src.height, stripWidth, src.height, strips);
+    ParallelFor(0, strips.size(), 1, [&](size_t begin, size_t end)
+    {
+        const size_t gatheredSize = (stripWidth + 2 * radius) * channels;
+        std::vector<uint8_t> added(gatheredSize);
+        std::vector<uint8_t> removed(gatheredSize);
+        const std::vector<uint8_t> zeros(gatheredSize, 0);
+        std::vector<uint32_t> columnSums(stripWidth * channels);
+        for (size_t s = begin; s < end; s++)
+        {
+            const FilterTile& strip = strips[s];
+            const size_t numPixels = strip.x1 - strip.x0;
+            const size_t count = numPixels * channels;
+            auto gather = [&](int y, uint8_t* out)
+            {
+                GatherRow(src, (uint32_t)WrapIndex(y, height, wrap), (int)strip.x0, (int)strip.x1, radius, wrap, out);
+            };
+
+            std::fill(columnSums.begin(), columnSums.begin() + count, 0);
+            for (int y = -radius; y <= radius; y++)
+            {
+                gather(y, added.data());
+                AddBoxSums(added.data(), zeros.data(), columnSums.data(), numPixels, radius, channels);
+            }
+
+            for (int y = 0; y < height; y++)
+            {
+                uint8_t* out = result.data.data() + (size_t)y * rowSize + (size_t)strip.x0 * channels;
+                for (size_t i = 0; i < count; i++)
+                {
+                    out[i] = (uint8_t)(((columnSums[i] + area / 2) * reciprocal) >> 48);
+                }
+                if (y + 1 < height)
+                {
+                    gather(y + radius + 1, added.data());
+                    gather(y - radius, removed.data());
+                    AddBoxSums(added.data(), removed.data(), columnSums.data(), numPixels, radius, channels);
+                }
+            }
+        }
+    });
+
+    dst = std::move(result);
+    return true;
+}
+
+bool Sharpen(const Image& src, Image& dst, float amount, float sigma, WrapType wrap)
+{
+    Image blurred;
+    if (!GaussianBlur(src, blurred, sigma, wrap))
+    {
+        return false;
+    }
+
+    Image result;
+    result.width = src.width;
+    result.height = src.height;
+    result.pixelFormat = src.pixelFormat;
+    result.data.resize(src.data.size());
+    const size_t rowSize = (size_t)src.width * src.GetPixelSize();
+    ParallelFor(0, src.height, 16, [&](size_t begin, size_t end)
+    {
+        std::vector<float> row(rowSize);
+        std::vector<float> blurRow(rowSize);
+        for (size_t y = begin; y < end; y++)
+        {
+            WidenRowFloat(row.data(), src.data.data() + y * rowSize, rowSize);
+            WidenRowFloat(blurRow.data(), blurred.data.data() + y * rowSize, rowSize);
+
+            // src + amount * (src - blur) = (1 + amount) * src - amount * blur
+            for (size_t i = 0; i < rowSize; i++)
+            {
+                row[i] *= 1.0f + amount;
+            }
+            MulAddRowFloat(row.data(), blurRow.data(), -amount, rowSize);
+            NarrowRowFloat(result.data.data() + y * rowSize, row.data(), rowSize);
+        }
+    });
+
+    dst = std::move(result);
+    return true;
+}
+
+bool ParseWrapType(const char* name, WrapType* wrapOut)
+{
+    static const char* s_wrapNames[] = {"repeat", "mirror", "clamp", "mirror-clamp"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (!strcmp(name, s_wrapNames[i]))
+        {
+            *wrapOut = (WrapType)i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,40 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "texture.h"
+
+struct Image;
+
+// CPU image filters for any PixelFormat. Pixels past the edges come from wrap, with the same meaning as the
+// texture WrapType: Repeat tiles the image, MirroredRepeat tiles it flipping every other copy, ClampToEdge repeats
+// the edge pixel and MirrorClampToEdge mirrors once and then clamps.
+// Image::Load pre-multiplies alpha, so blurring does not bleed color out of transparent pixels.
+// The work is split into tiles a few hundred pixels wide, each one filtered start to finish on one thread
+// while its rows are still in cache.
+
+// 1D kernels, odd length, centered, summing to 1.
+std::vector<float> MakeGaussianKernel(float sigma);  // radius ceil(3 sigma)
+std::vector<float> MakeBinomialKernel(int taps);     // 3 or 5 taps, 1 2 1 and 1 4 6 4 1
+
+// Separable convolution, xKernel along rows then yKernel down columns, both odd length.
+// Kernels whose weights are all non-negative sixteenths, binomials included, run in 16 bit integers and round
+// exactly. Anything else runs in float.
+bool Convolve(const Image& src, Image& dst, const std::vector<float>& xKernel, const std::vector<float>& yKernel, WrapType wrap);
+
+bool GaussianBlur(const Image& src, Image& dst, float sigma, WrapType wrap);
+
+// (2 radius + 1) squared box with running sums, the cost per pixel does not depend on radius.
+// Integer, rounded to nearest, radius up to MAX_BOX_RADIUS.
+static const int MAX_BOX_RADIUS = 511;
+bool BoxBlur(const Image& src, Image& dst, int radius, WrapType wrap);
+
+// unsharp mask, src + amount * (src - gaussian blur of src).
+bool Sharpen(const Image& src, Image& dst, float amount, float sigma, WrapType wrap);
+
+// returns false if name is not one of repeat, mirror, clamp or mirror-clamp
+bool ParseWrapType(const char* name, WrapType* wrapOut);
+
+#endif
@@ -0,0 +1,206 @@
+#include "framestream.h"
+
+#include <filesystem>
+#include <stdio.h>
+
+#include "log.h"
+#include "util.h"
+
+FrameStream::FrameStream() : yuvSource(false), fpsNum(30), fpsDen(1), nextFileIndex(0), nextFrameIndex(0),
+                             readerDone(false), quit(false), framesReleased(0)
+{
+    for (int i = 0; i < NUM_BUFFERS; i++)
+    {
+        frames[i].index = 0;
+        freeFrames.push_back(&frames[i]);
+    }
+}
+
+FrameStream::~FrameStream()
+{
+    Stop();
+}
+
+static std::string SequenceFilename(const std::string& pattern, int index)
+{
+    char filename[1024];
+    snprintf(filename, sizeof(filename), pattern.c_str(), index);
+    return filename;
+}
+
+bool FrameStream::OpenSequence(const std::string& patternIn, int firstIndex)
+{
+    if (!IsFramePattern(patternIn))
+    {
+        Log::printf("Error: sequence pattern \"%s\" needs exactly one %%d, write any other %% as %%%%\n", patternIn.c_str());
+        return false;
+    }
+    pattern = patternIn;
+    nextFileIndex = firstIndex;
+    yuvSource = false;
+
+    std::string first = SequenceFilename(pattern, firstIndex);
+    std::error_code ec;
+    if (!std::filesystem::exists(GetRootPath() + first, ec))
+    {
+        Log::printf("Error: first frame \"%s\" of sequence \"%s\" does not exist\n", first.c_str(), pattern.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool FrameStream::OpenY4M(const std::string& filename)
+{
+    if (!y4mReader.Open(filename))
+    {
+        return false;
+    }
+    yuvSource = true;
+    fpsNum = y4mReader.fpsNum;
+    fpsDen = y4mReader.fpsDen;
+    return true;
+}
+
+// decodes the next frame into image, false at the end of the stream.
+static bool ReadNextFrame(FrameStream& stream, Image& image)
+{
+    if (stream.yuvSource)
+    {
+        if (!stream.y4mReader.ReadFrame(stream.yuvFrame))
+        {
+            return false;
+        }
+        UnpackYUV(stream.yuvFrame, image);
+        return true;
+    }
+
+    // the sequence ends at the first missing file.
+    std::string filename = SequenceFilename(stream.pattern, stream.nextFileIndex);
+    std::error_code ec;
+    if (!std::filesystem::exists(GetRootPath() + filename, ec))
+    {
+        return false;
+    }
+    stream.nextFileIndex++;
+    // straight alpha, the process callback pre-multiplies after anything that needs straight color.
+    return image.Load(filename, false);
+}
+
+void FrameStream::Start(const std::function<void(Image& frame)>& process)
+{
+    processFunc = process;
+    startTime = std::chrono::steady_clock::now();
+    thread = std::thread([this]()
+    {
+        for (;;)
+        {
+            StreamFrame* frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this] { return quit || !freeFrames.empty(); });
+                if (quit)
+                {
+                    break;
+                }
+                frame = freeFrames.back();
+                freeFrames.pop_back();
+            }
+
+            frame->readStart = std::chrono::steady_clock::now();
+            bool ok = ReadNextFrame(*this, frame->image);
+            auto decodeEnd = std::chrono::steady_clock::now();
+            if (ok && processFunc)
+            {
+                processFunc(frame->image);
+            }
+            auto processEnd = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ok)
+            {
+                freeFrames.push_back(frame);
+                readerDone = true;
+                cond.notify_all();
+                break;
+            }
+            decodeHistogram.Add(std::chrono::duration<double, std::milli>(decodeEnd - frame->readStart).count());
+            processHistogram.Add(std::chrono::duration<double, std::milli>(processEnd - decodeEnd).count());
+            frame->index = nextFrameIndex++;
+            readyFrames.push_back(frame);
+            cond.notify_all();
+        }
+    });
+}
+
+StreamFrame* FrameStream::AcquireFrame()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return readerDone || !readyFrames.empty(); });
+    if (readyFrames.empty())
+    {
+        return nullptr;
+    }
+    StreamFrame* frame = readyFrames.front();
+    readyFrames.erase(readyFrames.begin());
+    return frame;
+}
+
+StreamFrame* FrameStream::TryAcquireFrame()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (readyFrames.empty())
+    {
+        return nullptr;
+    }
+    StreamFrame* frame = readyFrames.front();
+    readyFrames.erase(readyFrames.begin());
+    return frame;
+}
+
+void FrameStream::ReleaseFrame(StreamFrame* frame)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    latencyHistogram.Add(std::chrono::duration<double, std::milli>(now - frame->readStart).count());
+    framesReleased++;
+    freeFrames.push_back(frame);
+    cond.notify_all();
+}
+
+bool FrameStream::IsFinished()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return readerDone && readyFrames.empty();
+}
+
+void FrameStream::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        cond.notify_all();
+    }
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+void FrameStream::ReleaseBuffers()
+{
+    for (int i = 0; i < NUM_BUFFERS; i++)
+    {
+        frames[i].image.Release();
+    }
+    yuvFrame.Release();
+}
+
+void FrameStream::PrintSummary() const
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    Log::printf("stream: %llu frames in %.3f sec, %.1f fps\n", (unsigned long long)framesReleased, elapsed.count(),
+                elapsed.count() > 0.0 ? framesReleased / elapsed.count() : 0.0);
+    Log::printf("%s", decodeHistogram.Summary("decode").c_str());
+    Log::printf("%s", processHistogram.Summary("process").c_str());
+    Log::printf("%s", latencyHistogram.Summary("latency").c_str());
+}
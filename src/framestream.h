@@ -0,0 +1,92 @@
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frametimer.h"
+#include "image.h"
+#include "y4m.h"
+
+struct StreamFrame
+{
+    Image image;
+    uint64_t index;
+    std::chrono::steady_clock::time_point readStart;
+};
+
+// Decodes and processes frames on a reader thread, NUM_BUFFERS frames ahead of the consumer.
+// While the consumer uploads or writes one frame, the reader fills the others, so neither waits on the other
+// as long as both keep up with the frame rate on average.
+// Frames from y4m come out as interleaved YUV (see UnpackYUV), yuvSource tells the process callback.
+// Png frames keep straight alpha, pre-multiplying is up to the callback.
+struct FrameStream
+{
+    static const int NUM_BUFFERS = 3;
+
+    FrameStream();
+    ~FrameStream();
+
+    // printf style pattern relative to the root path, "frames/frame_%04d.png", read from firstIndex until a file is missing.
+    // false if the pattern isn't one IsFramePattern accepts.
+    bool OpenSequence(const std::string& pattern, int firstIndex);
+
+    // "-" for stdin
+    bool OpenY4M(const std::string& filename);
+
+    // starts the reader thread, process runs on it after each decode.
+    void Start(const std::function<void(Image& frame)>& process);
+
+    // next frame in order, nullptr once the stream has ended.
+    StreamFrame* AcquireFrame();
+
+    // nullptr if the next frame is not ready yet (or the stream has ended, see IsFinished).
+    StreamFrame* TryAcquireFrame();
+
+    // hands the buffer back to the reader, and records the frame latency from the start of its read until now.
+    void ReleaseFrame(StreamFrame* frame);
+
+    // true once every frame has been acquired.
+    bool IsFinished();
+    void Stop();
+
+    // after Stop, frees the frame buffers. the last frame stays on screen from its texture.
+    void ReleaseBuffers();
+
+    void PrintSummary() const;
+
+    bool yuvSource;
+    int fpsNum;  // from the y4m header, 30:1 for png sequences
+    int fpsDen;
+
+    TimingHistogram decodeHistogram;
+    TimingHistogram processHistogram;
+    TimingHistogram latencyHistogram;  // read start to release
+
+    std::string pattern;
+    int nextFileIndex;
+    uint64_t nextFrameIndex;
+    Y4MReader y4mReader;
+    YUVImage yuvFrame;
+
+    StreamFrame frames[NUM_BUFFERS];
+    std::vector<StreamFrame*> freeFrames;
+    std::vector<StreamFrame*> readyFrames;  // in order, oldest first
+    bool readerDone;
+    bool quit;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+    std::function<void(Image& frame)> processFunc;
+
+    std::chrono::steady_clock::time_point startTime;
+    uint64_t framesReleased;
+};
+
+#endif
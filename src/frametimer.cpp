@@ -0,0 +1,245 @@
+#include "frametimer.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "log.h"
+#include "util.h"
+
+static const char* s_zoneNames[FrameTimer::NUM_ZONES] = {
+    "events",
+    "draw",
+    "swap"
+};
+
+TimingHistogram::TimingHistogram(double bucketMsIn, int numBuckets) : bucketMs(bucketMsIn), buckets(numBuckets, 0)
+{
+    Clear();
+}
+
+void TimingHistogram::Add(double ms)
+{
+    size_t i = (size_t)std::max(0.0, ms / bucketMs);
+    buckets[std::min(i, buckets.size() - 1)]++;
+    count++;
+    sum += ms;
+    max = std::max(max, ms);
+}
+
+void TimingHistogram::Clear()
+{
+    std::fill(buckets.begin(), buckets.end(), 0);
+    count = 0;
+    sum = 0.0;
+    max = 0.0;
+}
+
+double TimingHistogram::Percentile(double p) const
+{
+    if (count == 0)
+    {
+        return 0.0;
+    }
+
+    uint64_t target = (uint64_t)(p * (count - 1));
+    uint64_t accum = 0;
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        accum += buckets[i];
+        if (accum > target)
+        {
+            // report the upper edge of the bucket, but never above the real max.
+            return std::min((i + 1) * bucketMs, max);
+        }
+    }
+    return max;
+}
+
+std::string TimingHistogram::Summary(const char* name) const
+{
+    char line[256];
+    snprintf(line, sizeof(line), "%-8s count %8llu, mean %7.3f ms, p50 %7.3f ms, p99 %7.3f ms, max %7.3f ms\n",
+             name, (unsigned long long)count, Mean(), Percentile(0.5), Percentile(0.99), max);
+    return line;
+}
+
+std::string TimingHistogram::Histogram(const char* name) const
+{
+    std::string result = std::string(name) + " histogram:\n";
+    uint64_t largest = *std::max_element(buckets.begin(), buckets.end());
+    if (largest == 0)
+    {
+        return result;
+    }
+
+    const int BAR_WIDTH = 50;
+    char line[256];
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        if (buckets[i] == 0)
+        {
+            continue;
+        }
+        int barLen = (int)((buckets[i] * BAR_WIDTH + largest - 1) / largest);
+        if (i == buckets.size() - 1)
+        {
+            snprintf(line, sizeof(line), "  >= %7.2f ms : %8llu ", i * bucketMs, (unsigned long long)buckets[i]);
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "  %7.2f ms   : %8llu ", i * bucketMs, (unsigned long long)buckets[i]);
+        }
+        result += line;
+        result += std::string(barLen, '#');
+        result += "\n";
+    }
+    return result;
+}
+
+FrameTimer::FrameTimer() : lastFrameMs(0.0), lastGpuMs(0.0), gpuTimerSupported(false), gpuQueryIndex(0), gpuSamplesDropped(0), frameStarted(false)
+{
+    for (int i = 0; i < NUM_ZONES; i++)
+    {
+        lastZoneMs[i] = 0.0;
+    }
+    for (int i = 0; i < NUM_GPU_QUERIES; i++)
+    {
+        gpuQueries[i] = 0;
+        gpuQueryPending[i] = false;
+    }
+}
+
+FrameTimer::~FrameTimer()
+{
+    if (gpuTimerSupported)
+    {
+        glDeleteQueries(NUM_GPU_QUERIES, gpuQueries);
+    }
+}
+
+bool FrameTimer::Init()
+{
+    gpuTimerSupported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (gpuTimerSupported)
+    {
+        glGenQueries(NUM_GPU_QUERIES, gpuQueries);
+    }
+    else
+    {
+        Log::printf("FrameTimer: GL_TIME_ELAPSED queries not supported, gpu time will not be reported\n");
+    }
+    return gpuTimerSupported;
+}
+
+static double MsSince(const std::chrono::steady_clock::time_point& start, const std::chrono::steady_clock::time_point& now)
+{
+    return std::chrono::duration<double, std::milli>(now - start).count();
+}
+
+void FrameTimer::BeginFrame()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (frameStarted)
+    {
+        // frame time is measured start to start, so it includes anything done outside of the zones.
+        lastFrameMs = MsSince(frameStart, now);
+        frameHistogram.Add(lastFrameMs);
+    }
+    frameStart = now;
+    frameStarted = true;
+}
+
+void FrameTimer::BeginZone(Zone zone)
+{
+    zoneStart[zone] = std::chrono::steady_clock::now();
+}
+
+void FrameTimer::EndZone(Zone zone)
+{
+    lastZoneMs[zone] = MsSince(zoneStart[zone], std::chrono::steady_clock::now());
+    zoneHistograms[zone].Add(lastZoneMs[zone]);
+}
+
+void FrameTimer::BeginGpu()
+{
+    if (!gpuTimerSupported)
+    {
+        return;
+    }
+
+    // this query was issued NUM_GPU_QUERIES frames ago, only read it if the gpu is done with it.
+    uint32_t query = gpuQueries[gpuQueryIndex];
+    if (gpuQueryPending[gpuQueryIndex])
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            lastGpuMs = ns / 1000000.0;
+            gpuHistogram.Add(lastGpuMs);
+        }
+        else
+        {
+            gpuSamplesDropped++;
+        }
+        gpuQueryPending[gpuQueryIndex] = false;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void FrameTimer::EndGpu()
+{
+    if (!gpuTimerSupported)
+    {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    gpuQueryPending[gpuQueryIndex] = true;
+    gpuQueryIndex = (gpuQueryIndex + 1) % NUM_GPU_QUERIES;
+}
+
+void FrameTimer::PrintSummary() const
+{
+    Log::printf("%s", frameHistogram.Summary("frame").c_str());
+    for (int i = 0; i < NUM_ZONES; i++)
+    {
+        Log::printf("%s", zoneHistograms[i].Summary(s_zoneNames[i]).c_str());
+    }
+    if (gpuTimerSupported)
+    {
+        Log::printf("%s", gpuHistogram.Summary("gpu").c_str());
+        if (gpuSamplesDropped)
+        {
+            Log::printf("gpu samples dropped (result not ready in time): %llu\n", (unsigned long long)gpuSamplesDropped);
+        }
+    }
+}
+
+bool FrameTimer::SaveReport(const std::string& filename) const
+{
+    std::string report = frameHistogram.Summary("frame");
+    for (int i = 0; i < NUM_ZONES; i++)
+    {
+        report += zoneHistograms[i].Summary(s_zoneNames[i]);
+    }
+    if (gpuTimerSupported)
+    {
+        report += gpuHistogram.Summary("gpu");
+    }
+
+    report += "\n";
+    report += frameHistogram.Histogram("frame");
+    if (gpuTimerSupported)
+    {
+        report += "\n";
+        report += gpuHistogram.Histogram("gpu");
+    }
+
+    return SaveFile(filename, report);
+}
@@ -0,0 +1,86 @@
+#ifndef FRAMETIMER_H
+#define FRAMETIMER_H
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Fixed size histogram of millisecond durations, memory use does not grow with the number of samples.
+// Percentiles are accurate to bucketMs, max is exact.
+struct TimingHistogram
+{
+    TimingHistogram(double bucketMs = 0.1, int numBuckets = 1000);
+    void Add(double ms);
+    void Clear();
+
+    // p in [0, 1]
+    double Percentile(double p) const;
+    double Mean() const { return count ? sum / count : 0.0; }
+
+    // one line: count, mean, p50, p99 and max
+    std::string Summary(const char* name) const;
+
+    // non-empty buckets, one per line with a bar
+    std::string Histogram(const char* name) const;
+
+    double bucketMs;
+    std::vector<uint64_t> buckets;  // last bucket holds everything >= bucketMs * (numBuckets - 1)
+    uint64_t count;
+    double sum;
+    double max;
+};
+
+// Per-frame CPU zone timing plus GPU time from GL_TIME_ELAPSED queries.
+// Queries rotate through NUM_GPU_QUERIES objects and are only read once the result is available,
+// so the timer never stalls the pipeline. The GPU time of a frame shows up a few frames later.
+struct FrameTimer
+{
+    enum Zone
+    {
+        EventsZone = 0,
+        DrawZone,
+        SwapZone,
+        NUM_ZONES
+    };
+
+    static const int NUM_GPU_QUERIES = 3;
+
+    FrameTimer();
+    ~FrameTimer();
+
+    // requires a current gl context, returns false if timer queries are not supported (cpu timing still works).
+    bool Init();
+
+    void BeginFrame();
+    void BeginZone(Zone zone);
+    void EndZone(Zone zone);
+
+    // brackets the gl commands of a frame.
+    void BeginGpu();
+    void EndGpu();
+
+    void PrintSummary() const;
+    bool SaveReport(const std::string& filename) const;
+
+    TimingHistogram frameHistogram;
+    TimingHistogram zoneHistograms[NUM_ZONES];
+    TimingHistogram gpuHistogram;
+
+    // most recent samples, in ms
+    double lastFrameMs;
+    double lastZoneMs[NUM_ZONES];
+    double lastGpuMs;
+
+    bool gpuTimerSupported;
+    uint32_t gpuQueries[NUM_GPU_QUERIES];
+    bool gpuQueryPending[NUM_GPU_QUERIES];
+    int gpuQueryIndex;
+    uint64_t gpuSamplesDropped;
+
+    bool frameStarted;
+    std::chrono::steady_clock::time_point frameStart;
+    std::chrono::steady_clock::time_point zoneStart[NUM_ZONES];
+};
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// xxHash64, a fast non-cryptographic hash, for content addressing.
+// matches the reference implementation, so hashes can be checked with the xxhsum tool.
+uint64_t XXHash64(const void* data, size_t size, uint64_t seed = 0);
+
+#endif
@@ -0,0 +1,227 @@
+#include "headless.h"
+
+#include <string.h>
+
+#include <GL/glew.h>
+
+#ifdef IMGTOY_OSMESA
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "image.h"
+#include "log.h"
+#include "memtrack.h"
+
+HeadlessContext::HeadlessContext() : width(0), height(0), fbo(0), colorRenderbuffer(0), display(nullptr), context(nullptr), osmesaBuffer(nullptr)
+{
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    if (fbo)
+    {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &colorRenderbuffer);
+        MemTrack::Free(MemCategory::Texture, (size_t)width * height * 4);
+    }
+
+#ifdef IMGTOY_OSMESA
+    if (context)
+    {
+        OSMesaDestroyContext((OSMesaContext)context);
+    }
+    delete [] (uint8_t*)osmesaBuffer;
+#else
+    if (display)
+    {
+        eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context)
+        {
+            eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+        }
+        eglTerminate((EGLDisplay)display);
+    }
+#endif
+}
+
+#ifdef IMGTOY_OSMESA
+static bool CreateContext(HeadlessContext* hc)
+{
+    OSMesaContext ctx = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+    if (!ctx)
+    {
+        Log::printf("Error: OSMesaCreateContextExt() failed\n");
+        return false;
+    }
+    hc->context = ctx;
+
+    // OSMesa needs a default framebuffer, but we always draw into the fbo.
+    uint8_t* buffer = new uint8_t[hc->width * hc->height * 4];
+    hc->osmesaBuffer = buffer;
+    if (!OSMesaMakeCurrent(ctx, buffer, GL_UNSIGNED_BYTE, hc->width, hc->height))
+    {
+        Log::printf("Error: OSMesaMakeCurrent() failed\n");
+        return false;
+    }
+    return true;
+}
+#else
+static bool HasExtension(const char* extensions, const char* name)
+{
+    if (!extensions)
+    {
+        return false;
+    }
+    size_t len = strlen(name);
+    const char* p = extensions;
+    while ((p = strstr(p, name)) != nullptr)
+    {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0))
+        {
+            return true;
+        }
+        p += len;
+    }
+    return false;
+}
+
+static bool CreateContext(HeadlessContext* hc)
+{
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+        {
+            dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+    }
+    if (dpy == EGL_NO_DISPLAY)
+    {
+        // non-mesa drivers usually give a usable device display here.
+        dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (dpy == EGL_NO_DISPLAY)
+    {
+        Log::printf("Error: no EGL display available\n");
+        return false;
+    }
+
+    EGLint major, minor;
+    if (!eglInitialize(dpy, &major, &minor))
+    {
+        Log::printf("Error: eglInitialize() failed 0x%x\n", eglGetError());
+        return false;
+    }
+    hc->display = dpy;
+
+    if (!HasExtension(eglQueryString(dpy, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context"))
+    {
+        Log::printf("Error: EGL %d.%d does not support EGL_KHR_surfaceless_context\n", major, minor);
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        Log::printf("Error: eglBindAPI(EGL_OPENGL_API) failed 0x%x\n", eglGetError());
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(dpy, configAttribs, &config, 1, &numConfigs) || numConfigs < 1)
+    {
+        Log::printf("Error: eglChooseConfig() found no OpenGL config\n");
+        return false;
+    }
+
+    // default attribs give a compatibility context, which the client-side vertex arrays in Program rely on.
+    EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL);
+    if (ctx == EGL_NO_CONTEXT)
+    {
+        Log::printf("Error: eglCreateContext() failed 0x%x\n", eglGetError());
+        return false;
+    }
+    hc->context = ctx;
+
+    if (!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx))
+    {
+        Log::printf("Error: eglMakeCurrent() failed 0x%x\n", eglGetError());
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool HeadlessContext::Init(int widthIn, int heightIn)
+{
+    width = widthIn;
+    height = heightIn;
+
+    if (!CreateContext(this))
+    {
+        return false;
+    }
+
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // gl entry points are already loaded by the time glew looks for a glx display.
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY)
+    {
+        err = GLEW_OK;
+    }
+#endif
+    if (GLEW_OK != err)
+    {
+        Log::printf("Error: %s\n", glewGetErrorString(err));
+        return false;
+    }
+
+    glGenRenderbuffers(1, &colorRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    MemTrack::Alloc(MemCategory::Texture, (size_t)width * height * 4);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        Log::printf("Error: headless framebuffer incomplete 0x%x\n", status);
+        return false;
+    }
+
+    Log::printf("headless GL: %s, %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+
+    Bind();
+    return true;
+}
+
+void HeadlessContext::Bind() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+}
+
+bool HeadlessContext::ReadPixels(Image& image) const
+{
+    image.width = width;
+    image.height = height;
+    image.pixelFormat = PixelFormat::RGBA;
+    image.data.resize((size_t)width * height * 4);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, image.data.data());
+    return glGetError() == GL_NO_ERROR;
+}
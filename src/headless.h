@@ -0,0 +1,34 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+
+struct Image;
+
+// GL context without a window or display server, for render servers and containers.
+// Uses EGL with EGL_MESA_platform_surfaceless, or OSMesa when built with IMGTOY_OSMESA.
+// All rendering goes into an RGBA8 framebuffer object of the requested size.
+struct HeadlessContext
+{
+    HeadlessContext();
+    ~HeadlessContext();
+
+    // creates the context, makes it current and initializes glew.
+    bool Init(int width, int height);
+    void Bind() const;
+
+    // blocks until rendering is complete, rows are bottom to top like Image::Load.
+    bool ReadPixels(Image& image) const;
+
+    int width;
+    int height;
+    uint32_t fbo;
+    uint32_t colorRenderbuffer;
+
+    // EGLDisplay/EGLContext or OSMesaContext
+    void* display;
+    void* context;
+    void* osmesaBuffer;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include "hud.h"
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "log.h"
+#include "util.h"
+
+// 8x8 glyphs, one byte per row from the top, bit 0 is the leftmost pixel.
+// printable ascii, from the public domain font8x8_basic.
+static const uint8_t s_asciiGlyphs[95][8] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // ' '
+    {0x18, 0x3c, 0x3c, 0x18, 0x18, 0x00, 0x18, 0x00},  // '!'
+    {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // '"'
+    {0x36, 0x36, 0x7f, 0x36, 0x7f, 0x36, 0x36, 0x00},  // '#'
+    {0x0c, 0x3e, 0x03, 0x1e, 0x30, 0x1f, 0x0c, 0x00},  // '$'
+    {0x00, 0x63, 0x33, 0x18, 0x0c, 0x66, 0x63, 0x00},  // '%'
+    {0x1c, 0x36, 0x1c, 0x6e, 0x3b, 0x33, 0x6e, 0x00},  // '&'
+    {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00},  // '''
+    {0x18, 0x0c, 0x06, 0x06, 0x06, 0x0c, 0x18, 0x00},  // '('
+    {0x06, 0x0c, 0x18, 0x18, 0x18, 0x0c, 0x06, 0x00},  // ')'
+    {0x00, 0x66, 0x3c, 0xff, 0x3c, 0x66, 0x00, 0x00},  // '*'
+    {0x00, 0x0c, 0x0c, 0x3f, 0x0c, 0x0c, 0x00, 0x00},  // '+'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x06},  // ','
+    {0x00, 0x00, 0x00, 0x3f, 0x00, 0x00, 0x00, 0x00},  // '-'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x00},  // '.'
+    {0x60, 0x30, 0x18, 0x0c, 0x06, 0x03, 0x01, 0x00},  // '/'
+    {0x3e, 0x63, 0x73, 0x7b, 0x6f, 0x67, 0x3e, 0x00},  // '0'
+    {0x0c, 0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x3f, 0x00},  // '1'
+    {0x1e, 0x33, 0x30, 0x1c, 0x06, 0x33, 0x3f, 0x00},  // '2'
+    {0x1e, 0x33, 0x30, 0x1c, 0x30, 0x33, 0x1e, 0x00},  // '3'
+    {0x38, 0x3c, 0x36, 0x33, 0x7f, 0x30, 0x78, 0x00},  // '4'
+    {0x3f, 0x03, 0x1f, 0x30, 0x30, 0x33, 0x1e, 0x00},  // '5'
+    {0x1c, 0x06, 0x03, 0x1f, 0x33, 0x33, 0x1e, 0x00},  // '6'
+    {0x3f, 0x33, 0x30, 0x18, 0x0c, 0x0c, 0x0c, 0x00},  // '7'
+    {0x1e, 0x33, 0x33, 0x1e, 0x33, 0x33, 0x1e, 0x00},  // '8'
+    {0x1e, 0x33, 0x33, 0x3e, 0x30, 0x18, 0x0e, 0x00},  // '9'
+    {0x00, 0x0c, 0x0c, 0x00, 0x00, 0x0c, 0x0c, 0x00},  // ':'
+    {0x00, 0x0c, 0x0c, 0x00, 0x00, 0x0c, 0x0c, 0x06},  // ';'
+    {0x18, 0x0c, 0x06, 0x03, 0x06, 0x0c, 0x18, 0x00},  // '<'
+    {0x00, 0x00, 0x3f, 0x00, 0x00, 0x3f, 0x00, 0x00},  // '='
+    {0x06, 0x0c, 0x18, 0x30, 0x18, 0x0c, 0x06, 0x00},  // '>'
+    {0x1e, 0x33, 0x30, 0x18, 0x0c, 0x00, 0x0c, 0x00},  // '?'
+    {0x3e, 0x63, 0x7b, 0x7b, 0x7b, 0x03, 0x1e, 0x00},  // '@'
+    {0x0c, 0x1e, 0x33, 0x33, 0x3f, 0x33, 0x33, 0x00},  // 'A'
+    {0x3f, 0x66, 0x66, 0x3e, 0x66, 0x66, 0x3f, 0x00},  // 'B'
+    {0x3c, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3c, 0x00},  // 'C'
+    {0x1f, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1f, 0x00},  // 'D'
+    {0x7f, 0x46, 0x16, 0x1e, 0x16, 0x46, 0x7f, 0x00},  // 'E'
+    {0x7f, 0x46, 0x16, 0x1e, 0x16, 0x06, 0x0f, 0x00},  // 'F'
+    {0x3c, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7c, 0x00},  // 'G'
+    {0x33, 0x33, 0x33, 0x3f, 0x33, 0x33, 0x33, 0x00},  // 'H'
+    {0x1e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00},  // 'I'
+    {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1e, 0x00},  // 'J'
+    {0x67, 0x66, 0x36, 0x1e, 0x36, 0x66, 0x67, 0x00},  // 'K'
+    {0x0f, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7f, 0x00},  // 'L'
+    {0x63, 0x77, 0x7f, 0x7f, 0x6b, 0x63, 0x63, 0x00},  // 'M'
+    {0x63, 0x67, 0x6f, 0x7b, 0x73, 0x63, 0x63, 0x00},  // 'N'
+    {0x1c, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1c, 0x00},  // 'O'
+    {0x3f, 0x66, 0x66, 0x3e, 0x06, 0x06, 0x0f, 0x00},  // 'P'
+    {0x1e, 0x33, 0x33, 0x33, 0x3b, 0x1e, 0x38, 0x00},  // 'Q'
+    {0x3f, 0x66, 0x66, 0x3e, 0x36, 0x66, 0x67, 0x00},  // 'R'
+    {0x1e, 0x33, 0x07, 0x0e, 0x38, 0x33, 0x1e, 0x00},  // 'S'
+    {0x3f, 0x2d, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00},  // 'T'
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3f, 0x00},  // 'U'
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x00},  // 'V'
+    {0x63, 0x63, 0x63, 0x6b, 0x7f, 0x77, 0x63, 0x00},  // 'W'
+    {0x63, 0x63, 0x36, 0x1c, 0x1c, 0x36, 0x63, 0x00},  // 'X'
+    {0x33, 0x33, 0x33, 0x1e, 0x0c, 0x0c, 0x1e, 0x00},  // 'Y'
+    {0x7f, 0x63, 0x31, 0x18, 0x4c, 0x66, 0x7f, 0x00},  // 'Z'
+    {0x1e, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1e, 0x00},  // '['
+    {0x03, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x40, 0x00},  // '\'
+    {0x1e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1e, 0x00},  // ']'
+    {0x08, 0x1c, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00},  // '^'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff},  // '_'
+    {0x0c, 0x0c, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00},  // '`'
+    {0x00, 0x00, 0x1e, 0x30, 0x3e, 0x33, 0x6e, 0x00},  // 'a'
+    {0x07, 0x06, 0x06, 0x3e, 0x66, 0x66, 0x3b, 0x00},  // 'b'
+    {0x00, 0x00, 0x1e, 0x33, 0x03, 0x33, 0x1e, 0x00},  // 'c'
+    {0x38, 0x30, 0x30, 0x3e, 0x33, 0x33, 0x6e, 0x00},  // 'd'
+    {0x00, 0x00, 0x1e, 0x33, 0x3f, 0x03, 0x1e, 0x00},  // 'e'
+    {0x1c, 0x36, 0x06, 0x0f, 0x06, 0x06, 0x0f, 0x00},  // 'f'
+    {0x00, 0x00, 0x6e, 0x33, 0x33, 0x3e, 0x30, 0x1f},  // 'g'
+    {0x07, 0x06, 0x36, 0x6e, 0x66, 0x66, 0x67, 0x00},  // 'h'
+    {0x0c, 0x00, 0x0e, 0x0c, 0x0c, 0x0c, 0x1e, 0x00},  // 'i'
+    {0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1e},  // 'j'
+    {0x07, 0x06, 0x66, 0x36, 0x1e, 0x36, 0x67, 0x00},  // 'k'
+    {0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x1e, 0x00},  // 'l'
+    {0x00, 0x00, 0x33, 0x7f, 0x7f, 0x6b, 0x63, 0x00},  // 'm'
+    {0x00, 0x00, 0x1f, 0x33, 0x33, 0x33, 0x33, 0x00},  // 'n'
+    {0x00, 0x00, 0x1e, 0x33, 0x33, 0x33, 0x1e, 0x00},  // 'o'
+    {0x00, 0x00, 0x3b, 0x66, 0x66, 0x3e, 0x06, 0x0f},  // 'p'
+    {0x00, 0x00, 0x6e, 0x33, 0x33, 0x3e, 0x30, 0x78},  // 'q'
+    {0x00, 0x00, 0x3b, 0x6e, 0x66, 0x06, 0x0f, 0x00},  // 'r'
+    {0x00, 0x00, 0x3e, 0x03, 0x1e, 0x30, 0x1f, 0x00},  // 's'
+    {0x08, 0x0c, 0x3e, 0x0c, 0x0c, 0x2c, 0x18, 0x00},  // 't'
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6e, 0x00},  // 'u'
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x1e, 0x0c, 0x00},  // 'v'
+    {0x00, 0x00, 0x63, 0x6b, 0x7f, 0x7f, 0x36, 0x00},  // 'w'
+    {0x00, 0x00, 0x63, 0x36, 0x1c, 0x36, 0x63, 0x00},  // 'x'
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x3e, 0x30, 0x1f},  // 'y'
+    {0x00, 0x00, 0x3f, 0x19, 0x0c, 0x26, 0x3f, 0x00},  // 'z'
+    {0x38, 0x0c, 0x0c, 0x07, 0x0c, 0x0c, 0x38, 0x00},  // '{'
+    {0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00},  // '|'
+    {0x07, 0x0c, 0x0c, 0x38, 0x0c, 0x0c, 0x07, 0x00},  // '}'
+    {0x6e, 0x3b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}   // '~'
+};
+
+// the few non-ascii symbols stats use, the last entry is the box drawn for everything else.
+struct ExtraGlyph
+{
+    uint32_t codePoint;
+    uint8_t rows[8];
+};
+
+static const int NUM_EXTRA_GLYPHS = 4;
+static const ExtraGlyph s_extraGlyphs[NUM_EXTRA_GLYPHS] = {
+    {0x00b0, {0x1c, 0x36, 0x36, 0x1c, 0x00, 0x00, 0x00, 0x00}},  // degree sign
+    {0x00b5, {0x00, 0x00, 0x66, 0x66, 0x66, 0x3e, 0x06, 0x03}},  // micro sign
+    {0x00d7, {0x00, 0x63, 0x36, 0x1c, 0x36, 0x63, 0x00, 0x00}},  // multiplication sign
+    {0xfffd, {0x7f, 0x41, 0x41, 0x41, 0x41, 0x41, 0x7f, 0x00}}   // replacement character
+};
+
+static const int NUM_GLYPHS = 95 + NUM_EXTRA_GLYPHS;
+static const int GLYPH_SIZE = 8;
+static const int ATLAS_COLUMNS = 16;
+static const int ATLAS_WIDTH = ATLAS_COLUMNS * GLYPH_SIZE;
+static const int ATLAS_HEIGHT = ((NUM_GLYPHS + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS) * GLYPH_SIZE;
+
+// horizontal advance and line spacing, in font pixels.
+static const int ADVANCE = 8;
+static const int LINE_SPACING = 10;
+
+// uint16_t indices, 4 vertices per quad.
+static const size_t MAX_QUADS = 65536 / 4;
+
+static int GetGlyphIndex(uint32_t codePoint)
+{
+    if (codePoint >= 0x20 && codePoint < 0x7f)
+    {
+        return (int)codePoint - 0x20;
+    }
+    for (int i = 0; i < NUM_EXTRA_GLYPHS - 1; i++)
+    {
+        if (s_extraGlyphs[i].codePoint == codePoint)
+        {
+            return 95 + i;
+        }
+    }
+    return NUM_GLYPHS - 1;
+}
+
+// single channel coverage, glyph rows go top down in the font and bottom up in Image.
+static void BuildAtlas(Image& image)
+{
+    image.width = ATLAS_WIDTH;
+    image.height = ATLAS_HEIGHT;
+    image.pixelFormat = PixelFormat::R;
+    image.data.assign((size_t)ATLAS_WIDTH * ATLAS_HEIGHT, 0);
+    for (int glyph = 0; glyph < NUM_GLYPHS; glyph++)
+    {
+        const uint8_t* rows = glyph < 95 ? s_asciiGlyphs[glyph] : s_extraGlyphs[glyph - 95].rows;
+        const int cellX = (glyph % ATLAS_COLUMNS) * GLYPH_SIZE;
+        const int cellY = (glyph / ATLAS_COLUMNS) * GLYPH_SIZE;
+        for (int row = 0; row < GLYPH_SIZE; row++)
+        {
+            uint8_t* dst = &image.data[(size_t)(ATLAS_HEIGHT - 1 - (cellY + row)) * ATLAS_WIDTH + cellX];
+            for (int bit = 0; bit < GLYPH_SIZE; bit++)
+            {
+                dst[bit] = (rows[row] >> bit) & 1 ? 255 : 0;
+            }
+        }
+    }
+}
+
+// bytes in the utf-8 sequence that starts with lead, 0 for a continuation byte or anything else that can't start one.
+static int GetSequenceLengthUTF8(uint8_t lead)
+{
+    if ((lead & 0x80) == 0)
+    {
+        return 1;
+    }
+    if ((lead & 0xe0) == 0xc0)
+    {
+        return 2;
+    }
+    if ((lead & 0xf0) == 0xe0)
+    {
+        return 3;
+    }
+    if ((lead & 0xf8) == 0xf0)
+    {
+        return 4;
+    }
+    return 0;
+}
+
+// decodes the string and lays out its glyphs, positions in screen pixels relative to the top left of the text.
+static void LayoutText(const std::string& text, int scale, Hud::CachedText& cached)
+{
+    cached.quads.clear();
+    cached.uvs.clear();
+    const float glyphSize = (float)(GLYPH_SIZE * scale);
+    float x = 0.0f;
+    float y = 0.0f;
+    const char* p = text.c_str();
+    const char* end = p + text.size();
+    while (p < end)
+    {
+        // the length comes from the lead byte, so a sequence cut short by the end of the string is never decoded,
+        // and neither is a byte that can't start one. both show as a box.
+        uint32_t codePoint = 0xfffd;
+        const int numBytes = GetSequenceLengthUTF8((uint8_t)*p);
+        if (numBytes == 0)
+        {
+            p++;
+        }
+        else if (numBytes > end - p)
+        {
+            p = end;
+        }
+        else
+        {
+            p += NextCodePointUTF8(p, &codePoint);
+        }
+
+        if (codePoint == '\n')
+        {
+            x = 0.0f;
+            y += (float)(LINE_SPACING * scale);
+            continue;
+        }
+        if (codePoint != ' ')
+        {
+            const int glyph = GetGlyphIndex(codePoint);
+            const float u0 = (float)((glyph % ATLAS_COLUMNS) * GLYPH_SIZE) / ATLAS_WIDTH;
+            const float v0 = 1.0f - (float)((glyph / ATLAS_COLUMNS) * GLYPH_SIZE) / ATLAS_HEIGHT;
+            cached.quads.push_back(glm::vec4(x, y, x + glyphSize, y + glyphSize));
+            cached.uvs.push_back(glm::vec4(u0, v0, u0 + (float)GLYPH_SIZE / ATLAS_WIDTH, v0 - (float)GLYPH_SIZE / ATLAS_HEIGHT));
+        }
+        x += (float)(ADVANCE * scale);
+    }
+}
+
+Hud::Hud() : atlas(nullptr), program(nullptr), scale(2), frame(0)
+{
+}
+
+Hud::~Hud()
+{
+    delete atlas;
+    delete program;
+}
+
+bool Hud::Init(int scaleIn)
+{
+    scale = scaleIn;
+
+    Image image;
+    BuildAtlas(image);
+    Texture::Params params = {FilterType::Nearest, FilterType::Nearest, WrapType::ClampToEdge, WrapType::ClampToEdge};
+    atlas = new Texture(image, params);
+
+    program = new Program();
+    if (!program->LoadAsync("shader/hud_text_vert.glsl", "shader/hud_text_frag.glsl"))
+    {
+        Log::printf("Error: failed to load hud shaders\n");
+        return false;
+    }
+    return true;
+}
+
+void Hud::Begin()
+{
+    frame++;
+    vertices.clear();
+
+    // stats strings change a few times a second, old ones drop out instead of piling up.
+    for (auto iter = cache.begin(); iter != cache.end();)
+    {
+        if (frame - iter->second.lastFrame > CACHE_FRAMES)
+        {
+            iter = cache.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+void Hud::Text(float x, float y, const std::string& text, const glm::vec4& color)
+{
+    auto iter = cache.find(text);
+    if (iter == cache.end())
+    {
+        iter = cache.emplace(text, CachedText()).first;
+        LayoutText(text, scale, iter->second);
+    }
+    CachedText& cached = iter->second;
+    cached.lastFrame = frame;
+
+    // shadow first, one font pixel down and right, then the text over it.
+    const glm::vec4 shadowColor(0.0f, 0.0f, 0.0f, 0.75f * color.w);
+    const glm::vec2 offsets[2] = {glm::vec2(x + scale, y + scale), glm::vec2(x, y)};
+    const glm::vec4 colors[2] = {shadowColor, color};
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const size_t numQuads = std::min(cached.quads.size(), MAX_QUADS - vertices.size() / 4);
+        for (size_t i = 0; i < numQuads; i++)
+        {
+            const glm::vec4& q = cached.quads[i];
+            const glm::vec4& uv = cached.uvs[i];
+            const glm::vec2& o = offsets[pass];
+            vertices.push_back({glm::vec2(o.x + q.x, o.y + q.y), glm::vec2(uv.x, uv.y), colors[pass]});
+            vertices.push_back({glm::vec2(o.x + q.z, o.y + q.y), glm::vec2(uv.z, uv.y), colors[pass]});
+            vertices.push_back({glm::vec2(o.x + q.z, o.y + q.w), glm::vec2(uv.z, uv.w), colors[pass]});
+            vertices.push_back({glm::vec2(o.x + q.x, o.y + q.w), glm::vec2(uv.x, uv.w), colors[pass]});
+        }
+    }
+}
+
+int Hud::Draw(int width, int height)
+{
+    const size_t numQuads = vertices.size() / 4;
+    if (!numQuads || !program || !program->IsReady())
+    {
+        return 0;
+    }
+
+    // the index pattern never changes, it only grows.
+    for (size_t quad = indices.size() / 6; quad < numQuads; quad++)
+    {
+        const uint16_t base = (uint16_t)(quad * 4);
+        const uint16_t pattern[6] = {base, (uint16_t)(base + 1), (uint16_t)(base + 2), base, (uint16_t)(base + 2), (uint16_t)(base + 3)};
+        indices.insert(indices.end(), pattern, pattern + 6);
+    }
+
+    // y down, so text lays out like it reads.
+    glm::mat4 projMat = glm::ortho(0.0f, (float)width, (float)height, 0.0f, -10.0f, 10.0f);
+
+    program->Apply();
+    program->SetUniform("modelViewProjMat", projMat);
+    atlas->Apply(0);
+    program->SetUniform("glyphTexture", 0);
+
+    const int positionLoc = program->GetAttribLoc("position");
+    const int uvLoc = program->GetAttribLoc("uv");
+    const int colorLoc = program->GetAttribLoc("color");
+    program->SetAttrib(positionLoc, &vertices[0].position, sizeof(Vertex));
+    program->SetAttrib(uvLoc, &vertices[0].uv, sizeof(Vertex));
+    program->SetAttrib(colorLoc, &vertices[0].color, sizeof(Vertex));
+
+    glDrawElements(GL_TRIANGLES, (GLsizei)(numQuads * 6), GL_UNSIGNED_SHORT, indices.data());
+
+    // the arrays point into vertices, other programs must not see them enabled.
+    glDisableVertexAttribArray(positionLoc);
+    glDisableVertexAttribArray(uvLoc);
+    glDisableVertexAttribArray(colorLoc);
+
+    return (int)numQuads / 2;
+}
@@ -0,0 +1,65 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "program.h"
+#include "texture.h"
+
+// On-screen text for stats, drawn over the frame with an embedded 8x8 bitmap font.
+// Glyphs live in one small atlas texture. The quads of each string are built once, from its utf-8 code points,
+// and cached by the string, so repeated text costs a copy into the vertex array. Everything added between
+// Begin and Draw goes out in a single draw call. Code points without a glyph show as a box.
+struct Hud
+{
+    // one corner of a glyph quad, in pixels from the top left of the window.
+    struct Vertex
+    {
+        glm::vec2 position;
+        glm::vec2 uv;
+        glm::vec4 color;
+    };
+
+    // quads of a string relative to where it is drawn, 4 corners per glyph.
+    struct CachedText
+    {
+        std::vector<glm::vec4> quads;  // x0, y0, x1, y1
+        std::vector<glm::vec4> uvs;    // u0, v0, u1, v1
+        uint64_t lastFrame;
+    };
+
+    // strings not drawn for this many frames are dropped from the cache.
+    static const uint64_t CACHE_FRAMES = 120;
+
+    Hud();
+    ~Hud();
+
+    // builds the atlas and submits the shaders, the hud draws nothing until they are ready.
+    // scale is the integer size of a font pixel on screen.
+    bool Init(int scale = 2);
+
+    void Begin();
+
+    // x, y is the top left of the first line in pixels from the top left of the window. '\n' starts a new line.
+    // a drop shadow keeps it readable over any image.
+    void Text(float x, float y, const std::string& text, const glm::vec4& color = glm::vec4(1.0f));
+
+    // returns the number of glyphs drawn.
+    int Draw(int width, int height);
+
+    int GetLineHeight() const { return 10 * scale; }
+
+    Texture* atlas;
+    Program* program;
+    int scale;
+    uint64_t frame;
+    std::unordered_map<std::string, CachedText> cache;
+    std::vector<Vertex> vertices;
+    std::vector<uint16_t> indices;  // 0 1 2 0 2 3 pattern, grown as needed
+};
+
+#endif
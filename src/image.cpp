@@ -1,44 +1,84 @@
 #include "image.h"
 
-
+#include <algorithm>
+#include <setjmp.h>
 #include <string.h>
 
 extern "C" {
 #include <png.h>
 }
 
+#include "archive.h"
+#include "jpeg.h"
 #include "log.h"
+#include "qoi.h"
 #include "util.h"
 
 Image::Image() : width(0), height(0), pixelFormat(PixelFormat::R)
 {
 }
 
-bool Image::Load(const std::string& filenameIn)
+// png_set_read_fn source, reads walk forward through a buffer that is already in memory.
+struct PNGMemoryReader
 {
-    std::string fullFilename = GetRootPath() + filenameIn;
-    const char* filename = fullFilename.c_str();
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+};
 
-#ifdef _WIN32
-    FILE *fp = NULL;
-    fopen_s(&fp, filename, "rb");
-#else
-    FILE *fp = fopen(filename, "rb");
-#endif
-    if (!fp)
+static void ReadPNGMemory(png_structp png_ptr, png_bytep out, png_size_t count)
+{
+    PNGMemoryReader* reader = (PNGMemoryReader*)png_get_io_ptr(png_ptr);
+    if (count > reader->size - reader->offset)
+    {
+        png_error(png_ptr, "unexpected end of data");
+    }
+    memcpy(out, reader->data + reader->offset, count);
+    reader->offset += count;
+}
+
+bool ConfigurePNGTransforms(png_structp png, png_infop info, PixelFormat* pixelFormatOut)
+{
+    int bitDepth = png_get_bit_depth(png, info);
+    int colorType = png_get_color_type(png, info);
+    if (colorType == PNG_COLOR_TYPE_PALETTE)
+    {
+        png_set_palette_to_rgb(png);
+        colorType = PNG_COLOR_TYPE_RGB;
+        if (png_get_valid(png, info, PNG_INFO_tRNS))
+        {
+            png_set_tRNS_to_alpha(png);
+            colorType = PNG_COLOR_TYPE_RGBA;
+        }
+        bitDepth = 8;
+    }
+    if (bitDepth != 8)
     {
-        Log::printf("Error: Failed to load texture \"%s\"\n", filename);
         return false;
     }
 
-    unsigned char header[8];
-    fread(header, 1, 8, fp);
-    if (png_sig_cmp(header, 0, 8))
+    switch (colorType)
     {
-        Log::printf("Error: Texture \"%s\" is not a valid PNG file\n", filename);
+    case PNG_COLOR_TYPE_GRAY:
+        *pixelFormatOut = PixelFormat::R;
+        return true;
+    case PNG_COLOR_TYPE_GA:
+        *pixelFormatOut = PixelFormat::RA;
+        return true;
+    case PNG_COLOR_TYPE_RGB:
+        *pixelFormatOut = PixelFormat::RGB;
+        return true;
+    case PNG_COLOR_TYPE_RGBA:
+        *pixelFormatOut = PixelFormat::RGBA;
+        return true;
+    default:
         return false;
     }
+}
 
+// name is only used for error messages.
+static bool DecodePNG(Image& image, const uint8_t* bytes, size_t size, const char* name)
+{
     png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr)
     {
@@ -54,73 +94,156 @@ bool Image::Load(const std::string& filenameIn)
         return false;
     }
 
-    png_init_io(png_ptr, fp);
-    png_set_sig_bytes(png_ptr, 8);
-    png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+    // declared before the setjmp, so a libpng error jumps back with it still in scope. a vector declared after it
+    // would be jumped out of without its destructor running. the other decoders and writers follow the same rule.
+    std::vector<png_bytep> rowPointers;
+    PNGMemoryReader reader = {bytes, size, 8};
+
+    // corrupt or truncated data ends up here instead of aborting.
+    if (setjmp(png_jmpbuf(png_ptr)))
+    {
+        Log::printf("Error: failed to decode texture \"%s\"\n", name);
+        png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+        return false;
+    }
 
-    png_byte** row_pointers = png_get_rows(png_ptr, info_ptr);
+    png_set_read_fn(png_ptr, &reader, ReadPNGMemory);
+    png_set_sig_bytes(png_ptr, 8);
+    png_read_info(png_ptr, info_ptr);
 
     png_uint_32 w, h;
-    int bit_depth, color_type;
-    png_get_IHDR(png_ptr, info_ptr, &w, &h, &bit_depth, &color_type, NULL, NULL, NULL);
+    png_get_IHDR(png_ptr, info_ptr, &w, &h, NULL, NULL, NULL, NULL, NULL);
+
+    if (!ConfigurePNGTransforms(png_ptr, info_ptr, &image.pixelFormat))
+    {
+        Log::printf("Error: unsupported bit depth or color type for texture \"%s\"\n", name);
+        png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+        return false;
+    }
 
-    bool loaded = false;
-    if (bit_depth != 8)
+    png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    image.width = w;
+    image.height = h;
+    size_t rowSize = (size_t)image.width * image.GetPixelSize();
+    image.data.resize(rowSize * image.height);
+
+    // decode straight into data, png rows are top to bottom, ours are bottom to top.
+    rowPointers.resize(image.height);
+    for (uint32_t i = 0; i < image.height; ++i)
+    {
+        rowPointers[image.height - 1 - i] = image.data.data() + i * rowSize;
+    }
+    png_read_image(png_ptr, rowPointers.data());
+    png_read_end(png_ptr, NULL);
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+    return true;
+}
+
+// picks the decoder by magic number, the file extension is not trusted.
+static bool DecodeImage(Image& image, const uint8_t* bytes, size_t size, const char* name, const LoadOptions& options)
+{
+    bool decoded = false;
+    if (size >= 8 && !png_sig_cmp(bytes, 0, 8))
+    {
+        decoded = DecodePNG(image, bytes, size, name);
+    }
+    else if (IsQOI(bytes, size))
     {
-        Log::printf("Error: bad bit depth for texture \"%s\n", filename);
+        decoded = DecodeQOI(bytes, size, image);
+    }
+    else if (IsJPEG(bytes, size))
+    {
+#ifdef IMGTOY_JPEG
+        decoded = DecodeJPEG(bytes, size, image, options.minWidth, options.minHeight);
+#else
+        Log::printf("Error: Texture \"%s\" is a jpeg, this build has no jpeg support (IMGTOY_JPEG)\n", name);
+#endif
     }
     else
     {
-        int pixelSize;
-        switch (color_type)
-        {
-        case PNG_COLOR_TYPE_GRAY:
-            pixelFormat = PixelFormat::R;
-            pixelSize = 1;
-            break;
-        case PNG_COLOR_TYPE_GA:
-            pixelFormat = PixelFormat::RA;
-            pixelSize = 2;
-            break;
-        case PNG_COLOR_TYPE_RGB:
-            pixelFormat = PixelFormat::RGB;
-            pixelSize = 3;
-            break;
-        case PNG_COLOR_TYPE_RGBA:
-            pixelFormat = PixelFormat::RGBA;
-            pixelSize = 4;
-            break;
-        default:
-            Log::printf("unsupported pixel format %d for image \"%s\n", color_type, filename);
-            return false;
-        }
+        Log::printf("Error: Texture \"%s\" is not a valid PNG, QOI or JPEG file\n", name);
+    }
 
-        width = w;
-        height = h;
-        data.resize(width * height * pixelSize);
+    // pre-multiply alpha
+    if (decoded && options.multiplyAlpha)
+    {
+        image.MultiplyAlpha();
+    }
+    return decoded;
+}
 
-        // copy row pointers into data vector
-        for (int i = 0; i < (int)height; ++i)
-        {
-            memcpy(&data[0] + i * width * pixelSize, row_pointers[height - 1 - i], width * pixelSize);
-        }
+// points file at the bytes of filename, from a mounted archive or mapped from disk.
+static bool OpenImageFile(const std::string& filename, ArchiveFile& archiveFile, MappedFile& mappedFile, const uint8_t** bytesOut, size_t* sizeOut)
+{
+    if (ReadFromArchives(filename, archiveFile))
+    {
+        *bytesOut = archiveFile.data;
+        *sizeOut = archiveFile.size;
+        return true;
+    }
+
+    // mapped rather than read through stdio, the decoders pull straight from the page cache.
+    if (!mappedFile.Open(filename))
+    {
+        Log::printf("Error: Failed to load texture \"%s\"\n", (GetRootPath() + filename).c_str());
+        return false;
+    }
+    *bytesOut = mappedFile.data;
+    *sizeOut = mappedFile.size;
+    return true;
+}
 
-        // pre-multiply alpha
-        MultiplyAlpha();
+LoadOptions::LoadOptions() : multiplyAlpha(true), minWidth(0), minHeight(0)
+{
+}
+
+bool Image::Load(const std::string& filename, bool multiplyAlpha)
+{
+    LoadOptions options;
+    options.multiplyAlpha = multiplyAlpha;
+    return Load(filename, options);
+}
 
-        loaded = true;
+bool Image::Load(const std::string& filename, const LoadOptions& options)
+{
+    ArchiveFile archiveFile;
+    MappedFile mappedFile;
+    const uint8_t* bytes;
+    size_t size;
+    if (!OpenImageFile(filename, archiveFile, mappedFile, &bytes, &size))
+    {
+        return false;
     }
+    return DecodeImage(*this, bytes, size, (GetRootPath() + filename).c_str(), options);
+}
 
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+bool Image::LoadFromMemory(const uint8_t* bytes, size_t size, bool multiplyAlpha)
+{
+    LoadOptions options;
+    options.multiplyAlpha = multiplyAlpha;
+    return LoadFromMemory(bytes, size, options);
+}
 
-    return loaded;
+bool Image::LoadFromMemory(const uint8_t* bytes, size_t size, const LoadOptions& options)
+{
+    return DecodeImage(*this, bytes, size, "<memory>", options);
 }
 
 bool Image::Save(const std::string& filenameIn) const
 {
     std::string fullFilename = GetRootPath() + filenameIn;
     const char* filename = fullFilename.c_str();
+
+    // encoded before the file is created, so a bad image doesn't leave an empty file behind.
+    std::vector<uint8_t> qoi;
+    const bool isQOI = HasExtension(filenameIn, ".qoi");
+    if (isQOI && !EncodeQOI(*this, qoi))
+    {
+        return false;
+    }
+
 #ifdef _WIN32
     FILE *fp = NULL;
     fopen_s(&fp, filename, "wb");
@@ -133,6 +256,17 @@ bool Image::Save(const std::string& filenameIn) const
         return false;
     }
 
+    if (isQOI)
+    {
+        bool written = fwrite(qoi.data(), 1, qoi.size(), fp) == qoi.size();
+        written = (fclose(fp) == 0) && written;
+        if (!written)
+        {
+            Log::printf("Error: failed to write \"%s\"\n", filename);
+        }
+        return written;
+    }
+
     png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr)
     {
@@ -151,7 +285,7 @@ bool Image::Save(const std::string& filenameIn) const
     png_init_io(png_ptr, fp);
 
     // convert from pixelFormat to png color type
-    static int s_pixelFormatToPNGColorType[PixelFormat::NUM_FORMATS] =
+    static int s_pixelFormatToPNGColorType[(int)PixelFormat::NUM_FORMATS] =
     {
         PNG_COLOR_TYPE_GRAY,       // R
         PNG_COLOR_TYPE_GRAY_ALPHA, // RA
@@ -164,13 +298,12 @@ bool Image::Save(const std::string& filenameIn) const
                  PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
     // initialize row ptrs
-    static int s_pixelFormatToPixelSize[PixelFormat::NUM_FORMATS] = {1, 2, 3, 4};
-    int pixelSize = s_pixelFormatToPixelSize[(int)pixelFormat];
+    size_t rowSize = (size_t)width * GetPixelSize();
     std::vector<const uint8_t*> row_ptrs(height, nullptr);
-    for (int i = 0; i < (int)height; i++)
+    for (uint32_t i = 0; i < height; i++)
     {
         // png expects rows from top to bottom.
-        row_ptrs[height - i - 1] = data.data() + i * width * pixelSize;
+        row_ptrs[height - i - 1] = data.data() + i * rowSize;
     }
 
     png_set_rows(png_ptr, info_ptr, (uint8_t**)row_ptrs.data());
@@ -184,6 +317,12 @@ bool Image::Save(const std::string& filenameIn) const
     return true;
 }
 
+uint32_t Image::GetPixelSize() const
+{
+    static uint32_t s_pixelFormatToPixelSize[(int)PixelFormat::NUM_FORMATS] = {1, 2, 3, 4};
+    return s_pixelFormatToPixelSize[(int)pixelFormat];
+}
+
 void Image::MultiplyAlpha()
 {
     if (pixelFormat == PixelFormat::R || pixelFormat == PixelFormat::RGB)
@@ -193,7 +332,8 @@ void Image::MultiplyAlpha()
     else if (pixelFormat == PixelFormat::RA)
     {
         size_t pixelSize = 2;
-        for (size_t i = 0; i < width * height; i++)
+        size_t numPixels = (size_t)width * height;
+        for (size_t i = 0; i < numPixels; i++)
         {
             float red = (float)data[i * pixelSize] / 255.0f;
             float alpha = (float)data[i * pixelSize + 1] / 255.0f;
@@ -203,7 +343,8 @@ void Image::MultiplyAlpha()
     else if (pixelFormat == PixelFormat::RGBA)
     {
         size_t pixelSize = 4;
-        for (size_t i = 0; i < width * height; i++)
+        size_t numPixels = (size_t)width * height;
+        for (size_t i = 0; i < numPixels; i++)
         {
             float red = (float)data[i * pixelSize] / 255.0f;
             float green = (float)data[i * pixelSize + 1] / 255.0f;
@@ -215,3 +356,173 @@ void Image::MultiplyAlpha()
         }
     }
 }
+
+void Image::Release()
+{
+    // clear() keeps the capacity, swapping with an empty buffer frees it.
+    ImageBuffer().swap(data);
+}
+
+static inline bool RectsTouch(const ImageRect& a, const ImageRect& b)
+{
+    return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+static ImageRect RectUnion(const ImageRect& a, const ImageRect& b)
+{
+    const uint32_t x0 = std::min(a.x, b.x);
+    const uint32_t y0 = std::min(a.y, b.y);
+    const uint32_t x1 = std::max(a.x + a.width, b.x + b.width);
+    const uint32_t y1 = std::max(a.y + a.height, b.y + b.height);
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+static inline uint64_t RectArea(const ImageRect& rect)
+{
+    return (uint64_t)rect.width * rect.height;
+}
+
+void Image::MarkDirty(const ImageRect& rectIn)
+{
+    if (rectIn.x >= width || rectIn.y >= height || rectIn.width == 0 || rectIn.height == 0)
+    {
+        return;
+    }
+    ImageRect rect = {rectIn.x, rectIn.y, std::min(rectIn.width, width - rectIn.x), std::min(rectIn.height, height - rectIn.y)};
+
+    for (;;)
+    {
+        // a union can reach rects that neither half touched, so keep absorbing until nothing changes.
+        for (bool merged = true; merged;)
+        {
+            merged = false;
+            for (size_t i = 0; i < dirtyRects.size(); i++)
+            {
+                if (RectsTouch(dirtyRects[i], rect))
+                {
+                    rect = RectUnion(dirtyRects[i], rect);
+                    dirtyRects.erase(dirtyRects.begin() + i);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+        if (dirtyRects.size() < (size_t)MAX_DIRTY_RECTS)
+        {
+            break;
+        }
+
+        // full, merge with the rect whose union adds the least area
+        size_t best = 0;
+        uint64_t bestGrowth = UINT64_MAX;
+        for (size_t i = 0; i < dirtyRects.size(); i++)
+        {
+            const uint64_t growth = RectArea(RectUnion(dirtyRects[i], rect)) - RectArea(dirtyRects[i]) - RectArea(rect);
+            if (growth < bestGrowth)
+            {
+                best = i;
+                bestGrowth = growth;
+            }
+        }
+        rect = RectUnion(dirtyRects[best], rect);
+        dirtyRects.erase(dirtyRects.begin() + best);
+    }
+    dirtyRects.push_back(rect);
+}
+
+bool Image::Blit(const Image& src, uint32_t x, uint32_t y)
+{
+    if (src.pixelFormat != pixelFormat)
+    {
+        Log::printf("Error: Blit() needs matching pixel formats\n");
+        return false;
+    }
+    if (x >= width || y >= height)
+    {
+        return true;
+    }
+
+    const size_t pixelSize = GetPixelSize();
+    const uint32_t copyWidth = std::min(src.width, width - x);
+    const uint32_t copyHeight = std::min(src.height, height - y);
+    for (uint32_t row = 0; row < copyHeight; row++)
+    {
+        memcpy(data.data() + ((size_t)(y + row) * width + x) * pixelSize, src.data.data() + (size_t)row * src.width * pixelSize,
+               copyWidth * pixelSize);
+    }
+    MarkDirty({x, y, copyWidth, copyHeight});
+    return true;
+}
+
+YUVImage::YUVImage() : width(0), height(0), chromaFormat(ChromaFormat::C420)
+{
+}
+
+bool YUVImage::Load(const std::string& filename, const LoadOptions& options)
+{
+    ArchiveFile archiveFile;
+    MappedFile mappedFile;
+    const uint8_t* bytes;
+    size_t size;
+    if (!OpenImageFile(filename, archiveFile, mappedFile, &bytes, &size))
+    {
+        return false;
+    }
+    if (!IsJPEG(bytes, size))
+    {
+        Log::printf("Error: \"%s\" is not a jpeg, only jpegs decode to yuv planes\n", filename.c_str());
+        return false;
+    }
+#ifdef IMGTOY_JPEG
+    return DecodeJPEGToYUV(bytes, size, *this, options.minWidth, options.minHeight);
+#else
+    Log::printf("Error: \"%s\" is a jpeg, this build has no jpeg support (IMGTOY_JPEG)\n", filename.c_str());
+    return false;
+#endif
+}
+
+void YUVImage::Resize(uint32_t widthIn, uint32_t heightIn, ChromaFormat chromaFormatIn)
+{
+    width = widthIn;
+    height = heightIn;
+    chromaFormat = chromaFormatIn;
+    y.resize((size_t)width * height);
+    size_t chromaSize = (size_t)GetChromaWidth() * GetChromaHeight();
+    u.resize(chromaSize);
+    v.resize(chromaSize);
+}
+
+uint32_t YUVImage::GetChromaWidth() const
+{
+    switch (chromaFormat)
+    {
+    case ChromaFormat::C420:
+    case ChromaFormat::C422:
+        return (width + 1) / 2;
+    case ChromaFormat::C444:
+        return width;
+    default:
+        return 0;
+    }
+}
+
+uint32_t YUVImage::GetChromaHeight() const
+{
+    switch (chromaFormat)
+    {
+    case ChromaFormat::C420:
+        return (height + 1) / 2;
+    case ChromaFormat::C422:
+    case ChromaFormat::C444:
+        return height;
+    default:
+        return 0;
+    }
+}
+
+void YUVImage::Release()
+{
+    YUVPlaneBuffer().swap(y);
+    YUVPlaneBuffer().swap(u);
+    YUVPlaneBuffer().swap(v);
+}
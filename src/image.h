@@ -5,6 +5,8 @@
 #include <string>
 #include <vector>
 
+#include "memtrack.h"
+
 enum class PixelFormat {
     R = 0,  // intensity
     RA,     // intensity alpha
@@ -13,16 +15,94 @@ enum class PixelFormat {
     NUM_FORMATS
 };
 
+struct LoadOptions {
+    LoadOptions();
+
+    // pass multiplyAlpha = false to fold the pre-multiply into a PixelPipeline with the rest of the processing.
+    bool multiplyAlpha;
+
+    // jpegs are scaled down by 1/2, 1/4 or 1/8 while decoding, to the smallest of those that still covers
+    // minWidth x minHeight, so thumbnails never decode pixels they throw away. other formats load at full size.
+    uint32_t minWidth;
+    uint32_t minHeight;
+};
+
+// pixel rectangle of an Image, y counts rows from the bottom like Image::data (and gl textures).
+struct ImageRect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
 struct Image {
+    // more dirty rects than this are merged into the closest one.
+    static const int MAX_DIRTY_RECTS = 8;
+
     Image();
-    bool Load(const std::string& filename);
+    // png, qoi or jpeg (IMGTOY_JPEG builds), told apart by their magic numbers.
+    // filename is relative to the root path, mounted archives are searched first.
+    bool Load(const std::string& filename, bool multiplyAlpha = true);
+    bool Load(const std::string& filename, const LoadOptions& options);
+    // decodes a file that is already in memory, bytes only need to live for the duration of the call.
+    bool LoadFromMemory(const uint8_t* bytes, size_t size, bool multiplyAlpha = true);
+    bool LoadFromMemory(const uint8_t* bytes, size_t size, const LoadOptions& options);
+    // qoi if filename ends in .qoi, png otherwise.
     bool Save(const std::string& filename) const;
     void MultiplyAlpha();
+    uint32_t GetPixelSize() const;
+    // frees the pixels, for images that are done once they are uploaded. size and format are kept.
+    void Release();
+
+    // records a changed area for Texture::UpdateDirty, clipped to the image.
+    // overlapping and touching rects are merged, so the list stays short and uploads don't overlap.
+    void MarkDirty(const ImageRect& rect);
+    void ClearDirty() { dirtyRects.clear(); }
+
+    // copies src (same pixel format) with its bottom left corner at x, y, clipped, and marks the area dirty.
+    bool Blit(const Image& src, uint32_t x, uint32_t y);
 
     uint32_t width;
     uint32_t height;
     PixelFormat pixelFormat;
-    std::vector<uint8_t> data;
+    ImageBuffer data;
+    std::vector<ImageRect> dirtyRects;
+};
+
+struct png_struct_def;
+struct png_info_def;
+
+// after png_read_info, sets up libpng to expand palette pngs of any bit depth to 8 bit RGB, or RGBA when tRNS gives
+// entries alpha, and returns the format the rows decode to. false for the bit depths and color types we don't read.
+// shared by Image::Load and the png stream readers, so they all decode the same files the same way.
+bool ConfigurePNGTransforms(png_struct_def* png, png_info_def* info, PixelFormat* pixelFormatOut);
+
+enum class ChromaFormat {
+    C420 = 0,  // chroma planes are half width and half height
+    C422,      // half width
+    C444,
+    Mono,      // no chroma planes
+    NUM_FORMATS
+};
+
+// Planar 8 bit YUV, as it comes out of video decoders and y4m files.
+// Unlike Image, rows are stored top to bottom.
+struct YUVImage {
+    YUVImage();
+    // jpeg only (IMGTOY_JPEG builds), the planes come out without color conversion, see DecodeJPEGToYUV.
+    bool Load(const std::string& filename, const LoadOptions& options = LoadOptions());
+    void Resize(uint32_t width, uint32_t height, ChromaFormat chromaFormat);
+    uint32_t GetChromaWidth() const;
+    uint32_t GetChromaHeight() const;
+    // frees the planes, size and format are kept.
+    void Release();
+
+    uint32_t width;
+    uint32_t height;
+    ChromaFormat chromaFormat;
+    YUVPlaneBuffer y;
+    YUVPlaneBuffer u;
+    YUVPlaneBuffer v;
 };
 
 #endif
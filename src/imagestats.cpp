@@ -0,0 +1,273 @@
+#include "imagestats.h"
+
+#include <algorithm>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+
+#include "image.h"
+#include "parallel.h"
+
+//
+// ChannelStats
+//
+
+ChannelStats::ChannelStats() : lowLimit(0), highLimit(255)
+{
+    Clear();
+}
+
+void ChannelStats::Clear()
+{
+    memset(histogram, 0, sizeof(histogram));
+}
+
+uint8_t ChannelStats::Min() const
+{
+    for (int i = 0; i < 256; i++)
+    {
+        if (histogram[i])
+        {
+            return (uint8_t)i;
+        }
+    }
+    return 0;
+}
+
+uint8_t ChannelStats::Max() const
+{
+    for (int i = 255; i >= 0; i--)
+    {
+        if (histogram[i])
+        {
+            return (uint8_t)i;
+        }
+    }
+    return 0;
+}
+
+double ChannelStats::Mean() const
+{
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        count += histogram[i];
+        sum += histogram[i] * i;
+    }
+    return count ? (double)sum / count : 0.0;
+}
+
+uint64_t ChannelStats::Count() const
+{
+    uint64_t count = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        count += histogram[i];
+    }
+    return count;
+}
+
+uint64_t ChannelStats::ClippedLow() const
+{
+    uint64_t count = 0;
+    for (int i = 0; i < lowLimit; i++)
+    {
+        count += histogram[i];
+    }
+    return count;
+}
+
+uint64_t ChannelStats::ClippedHigh() const
+{
+    uint64_t count = 0;
+    for (int i = highLimit + 1; i < 256; i++)
+    {
+        count += histogram[i];
+    }
+    return count;
+}
+
+//
+// ImageStats
+//
+
+ImageStats::ImageStats() : numChannels(0), numPixels(0)
+{
+}
+
+void ImageStats::Clear()
+{
+    numChannels = 0;
+    numPixels = 0;
+    for (int c = 0; c < 4; c++)
+    {
+        channels[c].Clear();
+    }
+}
+
+void ImageStats::SetLimits(int channel, uint8_t lowLimit, uint8_t highLimit)
+{
+    channels[channel].lowLimit = lowLimit;
+    channels[channel].highLimit = highLimit;
+}
+
+void ImageStats::Accumulate(const uint8_t* pixels, size_t numPixelsIn, int pixelSize)
+{
+    StatsAccumulator accumulator;
+    accumulator.Add(pixels, numPixelsIn, pixelSize);
+    accumulator.Flush(*this);
+}
+
+void ImageStats::Merge(const ImageStats& other)
+{
+    if (other.numChannels > numChannels)
+    {
+        numChannels = other.numChannels;
+    }
+    numPixels += other.numPixels;
+    for (int c = 0; c < 4; c++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            channels[c].histogram[i] += other.channels[c].histogram[i];
+        }
+    }
+}
+
+std::string ImageStats::Summary(const char* name) const
+{
+    std::string result;
+    char line[256];
+    for (int c = 0; c < numChannels; c++)
+    {
+        const ChannelStats& ch = channels[c];
+        snprintf(line, sizeof(line), "%s[%d] min %3d, max %3d, mean %7.3f, clipped low %llu (< %d), high %llu (> %d)\n",
+                 name, c, ch.Min(), ch.Max(), ch.Mean(),
+                 (unsigned long long)ch.ClippedLow(), ch.lowLimit, (unsigned long long)ch.ClippedHigh(), ch.highLimit);
+        result += line;
+    }
+    return result;
+}
+
+//
+// StatsAccumulator
+//
+
+// uint32 bins, flushed into the uint64 histograms before they could overflow.
+static const uint64_t FLUSH_PIXELS = (uint64_t)1 << 30;
+
+// Counting into one table serializes on the load-add-store of whatever bin was hit last,
+// so neighbouring pixels count into separate copies that are summed on Flush.
+// (there is no byte scatter in SSE or AVX2 that would do better.)
+static void CountPixels(const uint8_t* p, size_t numPixels, int pixelSize, uint32_t (*counts)[4][256])
+{
+    const int NUM_COPIES = StatsAccumulator::NUM_COPIES;
+    size_t i = 0;
+    if (pixelSize == 4)
+    {
+        for (; i + NUM_COPIES <= numPixels; i += NUM_COPIES, p += 4 * NUM_COPIES)
+        {
+            for (int k = 0; k < NUM_COPIES; k++)
+            {
+                counts[k][0][p[k * 4 + 0]]++;
+                counts[k][1][p[k * 4 + 1]]++;
+                counts[k][2][p[k * 4 + 2]]++;
+                counts[k][3][p[k * 4 + 3]]++;
+            }
+        }
+    }
+    else
+    {
+        for (; i + NUM_COPIES <= numPixels; i += NUM_COPIES)
+        {
+            for (int k = 0; k < NUM_COPIES; k++, p += pixelSize)
+            {
+                for (int c = 0; c < pixelSize; c++)
+                {
+                    counts[k][c][p[c]]++;
+                }
+            }
+        }
+    }
+    for (; i < numPixels; i++, p += pixelSize)
+    {
+        for (int c = 0; c < pixelSize; c++)
+        {
+            counts[0][c][p[c]]++;
+        }
+    }
+}
+
+StatsAccumulator::StatsAccumulator() : pendingPixels(0), totalPixels(0), numChannels(0)
+{
+    memset(counts, 0, sizeof(counts));
+    memset(totals, 0, sizeof(totals));
+}
+
+static void FoldCounts(StatsAccumulator& acc)
+{
+    for (int c = 0; c < acc.numChannels; c++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            uint64_t sum = 0;
+            for (int k = 0; k < StatsAccumulator::NUM_COPIES; k++)
+            {
+                sum += acc.counts[k][c][i];
+            }
+            acc.totals[c][i] += sum;
+        }
+    }
+    memset(acc.counts, 0, sizeof(acc.counts));
+    acc.totalPixels += acc.pendingPixels;
+    acc.pendingPixels = 0;
+}
+
+void StatsAccumulator::Add(const uint8_t* pixels, size_t numPixels, int pixelSize)
+{
+    numChannels = pixelSize;
+    while (numPixels > 0)
+    {
+        size_t n = (size_t)std::min<uint64_t>(numPixels, FLUSH_PIXELS - pendingPixels);
+        CountPixels(pixels, n, pixelSize, counts);
+        pendingPixels += n;
+        pixels += n * pixelSize;
+        numPixels -= n;
+        if (pendingPixels == FLUSH_PIXELS)
+        {
+            FoldCounts(*this);
+        }
+    }
+}
+
+void StatsAccumulator::Flush(ImageStats& stats)
+{
+    FoldCounts(*this);
+    stats.numChannels = numChannels > stats.numChannels ? numChannels : stats.numChannels;
+    stats.numPixels += totalPixels;
+    for (int c = 0; c < numChannels; c++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            stats.channels[c].histogram[i] += totals[c][i];
+        }
+    }
+    memset(totals, 0, sizeof(totals));
+    totalPixels = 0;
+}
+
+void ComputeImageStats(const Image& img, ImageStats& stats)
+{
+    const int pixelSize = (int)img.GetPixelSize();
+    const uint8_t* pixels = img.data.data();
+    std::mutex mutex;
+    ParallelFor(0, (size_t)img.width * img.height, 1 << 16, [&](size_t begin, size_t end)
+    {
+        StatsAccumulator partial;
+        partial.Add(pixels + begin * pixelSize, end - begin, pixelSize);
+        std::lock_guard<std::mutex> lock(mutex);
+        partial.Flush(stats);
+    });
+    stats.numChannels = pixelSize;
+}
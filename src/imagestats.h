@@ -0,0 +1,73 @@
+#ifndef IMAGESTATS_H
+#define IMAGESTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+struct Image;
+
+// 256 bin histogram of one channel, min, max, mean and clip counts all come from it exactly.
+struct ChannelStats
+{
+    ChannelStats();
+    void Clear();
+
+    uint8_t Min() const;
+    uint8_t Max() const;
+    double Mean() const;
+    uint64_t Count() const;
+
+    // values strictly outside the limits. limited range black and white sit exactly on them and are legal.
+    uint64_t ClippedLow() const;
+    uint64_t ClippedHigh() const;
+
+    uint64_t histogram[256];
+    uint8_t lowLimit;   // default 0
+    uint8_t highLimit;  // default 255
+};
+
+// Per-channel statistics, channels in pixel order (for RA, channel 1 is alpha).
+// Accumulates until Clear, so stripes or frames can be added one at a time.
+struct ImageStats
+{
+    ImageStats();
+    void Clear();
+
+    // sets the legal range of every channel, for example 16 and 235 for limited range luma.
+    void SetLimits(int channel, uint8_t lowLimit, uint8_t highLimit);
+
+    // histograms of a span of pixels, not thread safe, use Merge to combine per-thread partials.
+    void Accumulate(const uint8_t* pixels, size_t numPixels, int pixelSize);
+    void Merge(const ImageStats& other);
+
+    // one line per channel: min, max, mean and clip counts
+    std::string Summary(const char* name) const;
+
+    int numChannels;
+    uint64_t numPixels;
+    ChannelStats channels[4];
+};
+
+// Counts pixels into uint32 bins kept across calls, so small spans (tiles of a PixelPipeline)
+// don't pay for clearing and folding the bins every time. One per thread, Flush adds them to stats.
+struct StatsAccumulator
+{
+    // neighbouring pixels count into separate copies, see CountPixels.
+    static const int NUM_COPIES = 4;
+
+    StatsAccumulator();
+    void Add(const uint8_t* pixels, size_t numPixels, int pixelSize);
+    void Flush(ImageStats& stats);
+
+    uint32_t counts[NUM_COPIES][4][256];
+    uint64_t totals[4][256];  // counts are folded in here before a uint32 bin could overflow
+    uint64_t pendingPixels;
+    uint64_t totalPixels;
+    int numChannels;
+};
+
+// multi-threaded, adds to stats (call stats.Clear() first for a single image).
+void ComputeImageStats(const Image& img, ImageStats& stats);
+
+#endif
@@ -0,0 +1,533 @@
+#include "imagestream.h"
+
+#include <algorithm>
+#include <setjmp.h>
+#include <string.h>
+
+extern "C" {
+#include <png.h>
+}
+
+#include "log.h"
+#include "util.h"
+
+static FILE* OpenFile(const std::string& filename, const char* mode)
+{
+#ifdef _WIN32
+    FILE *fp = NULL;
+    fopen_s(&fp, filename.c_str(), mode);
+#else
+    FILE *fp = fopen(filename.c_str(), mode);
+#endif
+    return fp;
+}
+
+//
+// PNGRowReader
+//
+
+PNGRowReader::PNGRowReader() : width(0), height(0), rowsRead(0), pixelFormat(PixelFormat::R), multiplyAlpha(true), failed(false), fp(nullptr), png(nullptr), info(nullptr)
+{
+}
+
+PNGRowReader::~PNGRowReader()
+{
+    Close();
+}
+
+bool PNGRowReader::Open(const std::string& filenameIn, bool multiplyAlphaIn)
+{
+    Close();
+    failed = true;
+    multiplyAlpha = multiplyAlphaIn;
+
+    std::string filename = GetRootPath() + filenameIn;
+    fp = OpenFile(filename, "rb");
+    if (!fp)
+    {
+        Log::printf("Error: Failed to open \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    unsigned char header[8];
+    if (fread(header, 1, 8, fp) != 8 || png_sig_cmp(header, 0, 8))
+    {
+        Log::printf("Error: \"%s\" is not a valid PNG file\n", filename.c_str());
+        return false;
+    }
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+    {
+        Log::printf("Error: png_create_read_struct() failed\n");
+        return false;
+    }
+
+    info = png_create_info_struct(png);
+    if (!info)
+    {
+        Log::printf("Error: png_create_info_struct() failed\n");
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        Log::printf("Error: failed to read png header of \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    png_init_io(png, fp);
+    png_set_sig_bytes(png, 8);
+    png_read_info(png, info);
+
+    png_uint_32 w, h;
+    int interlace_type;
+    png_get_IHDR(png, info, &w, &h, NULL, NULL, &interlace_type, NULL, NULL);
+
+    // adam7 needs every pass before a single row is complete, which defeats streaming.
+    if (interlace_type != PNG_INTERLACE_NONE)
+    {
+        Log::printf("Error: \"%s\" is interlaced, streaming needs a non-interlaced png\n", filename.c_str());
+        return false;
+    }
+
+    if (!ConfigurePNGTransforms(png, info, &pixelFormat))
+    {
+        Log::printf("Error: unsupported bit depth or color type for texture \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    width = w;
+    height = h;
+    rowsRead = 0;
+    failed = false;
+    return true;
+}
+
+uint32_t PNGRowReader::ReadStripe(Image& stripe, uint32_t maxRows)
+{
+    if (failed || !png || rowsRead >= height)
+    {
+        return 0;
+    }
+
+    uint32_t numRows = height - rowsRead < maxRows ? height - rowsRead : maxRows;
+    stripe.width = width;
+    stripe.height = numRows;
+    stripe.pixelFormat = pixelFormat;
+    size_t rowSize = (size_t)width * stripe.GetPixelSize();
+    stripe.data.resize(rowSize * numRows);
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        Log::printf("Error: png read failed at row %u\n", rowsRead);
+        failed = true;
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < numRows; i++)
+    {
+        png_read_row(png, stripe.data.data() + i * rowSize, NULL);
+    }
+    rowsRead += numRows;
+
+    if (multiplyAlpha)
+    {
+        stripe.MultiplyAlpha();
+    }
+    return numRows;
+}
+
+void PNGRowReader::Close()
+{
+    if (png)
+    {
+        png_destroy_read_struct(&png, info ? &info : (png_infopp)NULL, (png_infopp)NULL);
+        png = nullptr;
+        info = nullptr;
+    }
+    if (fp)
+    {
+        fclose(fp);
+        fp = nullptr;
+    }
+}
+
+//
+// PNGPushDecoder
+//
+
+// where the pixels of each adam7 pass start in a row, their spacing, and the width of the block each one stands for.
+static const uint32_t s_adam7XStart[7] = {0, 4, 0, 2, 0, 1, 0};
+static const uint32_t s_adam7XStep[7] = {8, 8, 4, 4, 2, 2, 1};
+static const uint32_t s_adam7BlockWidth[7] = {8, 4, 4, 2, 2, 1, 1};
+
+// same arithmetic as Image::MultiplyAlpha, so pushed and loaded images match exactly.
+static inline void MultiplyAlphaPixel(uint8_t* p, uint32_t channels)
+{
+    if (channels == 2)
+    {
+        float alpha = (float)p[1] / 255.0f;
+        p[0] = (uint8_t)(((float)p[0] / 255.0f * alpha) * 255.0f);
+    }
+    else if (channels == 4)
+    {
+        float alpha = (float)p[3] / 255.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            p[c] = (uint8_t)(((float)p[c] / 255.0f * alpha) * 255.0f);
+        }
+    }
+}
+
+static void OnPushInfo(png_structp png, png_infop info)
+{
+    PNGPushDecoder* decoder = (PNGPushDecoder*)png_get_progressive_ptr(png);
+
+    png_uint_32 w, h;
+    png_get_IHDR(png, info, &w, &h, NULL, NULL, NULL, NULL, NULL);
+    if (!ConfigurePNGTransforms(png, info, &decoder->image.pixelFormat))
+    {
+        png_error(png, "unsupported bit depth or color type");
+    }
+
+    // rows of every pass come out expanded to the full width, a pass pixel at each of its positions.
+    decoder->numPasses = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    decoder->image.width = w;
+    decoder->image.height = h;
+    decoder->image.data.assign((size_t)w * h * decoder->image.GetPixelSize(), 0);
+    decoder->hasHeader = true;
+}
+
+static void OnPushRow(png_structp png, png_bytep newRow, png_uint_32 rowNum, int pass)
+{
+    // called with no row for the rows a pass skips
+    if (!newRow)
+    {
+        return;
+    }
+
+    PNGPushDecoder* decoder = (PNGPushDecoder*)png_get_progressive_ptr(png);
+    Image& image = decoder->image;
+    const uint32_t channels = image.GetPixelSize();
+    const size_t rowSize = (size_t)image.width * channels;
+    const bool multiplyAlpha = decoder->multiplyAlpha && (channels == 2 || channels == 4);
+
+    // png rows are top to bottom, ours are bottom to top.
+    const uint32_t y = image.height - 1 - rowNum;
+    uint8_t* dst = image.data.data() + (size_t)y * rowSize;
+    if (decoder->numPasses == 1)
+    {
+        memcpy(dst, newRow, rowSize);
+        if (multiplyAlpha)
+        {
+            for (size_t x = 0; x < rowSize; x += channels)
+            {
+                MultiplyAlphaPixel(dst + x, channels);
+            }
+        }
+    }
+    else
+    {
+        // libpng repeats each pass row over the rows of its blocks, and expands it to the full width with every pass
+        // pixel repeated over its spacing. each pass pixel fills its block to the right, only later passes own pixels
+        // there, so nothing final is overwritten.
+        const uint32_t blockWidth = s_adam7BlockWidth[pass];
+        for (uint32_t x = s_adam7XStart[pass]; x < image.width; x += s_adam7XStep[pass])
+        {
+            uint8_t pixel[4];
+            memcpy(pixel, newRow + (size_t)x * channels, channels);
+            if (multiplyAlpha)
+            {
+                MultiplyAlphaPixel(pixel, channels);
+            }
+            const uint32_t end = std::min(x + blockWidth, image.width);
+            for (uint32_t bx = x; bx < end; bx++)
+            {
+                memcpy(dst + (size_t)bx * channels, pixel, channels);
+            }
+        }
+    }
+
+    if (decoder->changedBegin >= decoder->changedEnd)
+    {
+        decoder->changedBegin = y;
+        decoder->changedEnd = y + 1;
+    }
+    else
+    {
+        decoder->changedBegin = std::min(decoder->changedBegin, y);
+        decoder->changedEnd = std::max(decoder->changedEnd, y + 1);
+    }
+}
+
+static void OnPushEnd(png_structp png, png_infop info)
+{
+    PNGPushDecoder* decoder = (PNGPushDecoder*)png_get_progressive_ptr(png);
+    decoder->complete = true;
+}
+
+PNGPushDecoder::PNGPushDecoder() : multiplyAlpha(true), hasHeader(false), complete(false), failed(false), numPasses(1),
+    changedBegin(0), changedEnd(0), png(nullptr), info(nullptr)
+{
+}
+
+PNGPushDecoder::~PNGPushDecoder()
+{
+    Close();
+}
+
+bool PNGPushDecoder::Start(bool multiplyAlphaIn)
+{
+    Close();
+    multiplyAlpha = multiplyAlphaIn;
+    hasHeader = false;
+    complete = false;
+    failed = true;
+    numPasses = 1;
+    changedBegin = 0;
+    changedEnd = 0;
+    image = Image();
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+    {
+        Log::printf("Error: png_create_read_struct() failed\n");
+        return false;
+    }
+
+    info = png_create_info_struct(png);
+    if (!info)
+    {
+        Log::printf("Error: png_create_info_struct() failed\n");
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        return false;
+    }
+    png_set_progressive_read_fn(png, this, OnPushInfo, OnPushRow, OnPushEnd);
+
+    failed = false;
+    return true;
+}
+
+bool PNGPushDecoder::Push(const uint8_t* bytes, size_t size)
+{
+    if (failed || !png)
+    {
+        return false;
+    }
+    if (complete || size == 0)
+    {
+        return true;
+    }
+
+    // errors in the data and in the callbacks end up here.
+    if (setjmp(png_jmpbuf(png)))
+    {
+        Log::printf("Error: png push decode failed\n");
+        failed = true;
+        return false;
+    }
+    png_process_data(png, info, (png_bytep)bytes, size);
+    return true;
+}
+
+bool PNGPushDecoder::TakeChangedRows(uint32_t* firstRowOut, uint32_t* numRowsOut)
+{
+    if (changedBegin >= changedEnd)
+    {
+        return false;
+    }
+    *firstRowOut = changedBegin;
+    *numRowsOut = changedEnd - changedBegin;
+    changedBegin = 0;
+    changedEnd = 0;
+    return true;
+}
+
+void PNGPushDecoder::Close()
+{
+    if (png)
+    {
+        png_destroy_read_struct(&png, info ? &info : (png_infopp)NULL, (png_infopp)NULL);
+        png = nullptr;
+        info = nullptr;
+    }
+}
+
+//
+// PNGRowWriter
+//
+
+PNGRowWriter::PNGRowWriter() : width(0), height(0), rowsWritten(0), pixelFormat(PixelFormat::R), failed(false), fp(nullptr), png(nullptr), info(nullptr)
+{
+}
+
+PNGRowWriter::~PNGRowWriter()
+{
+    if (png)
+    {
+        png_destroy_write_struct(&png, info ? &info : (png_infopp)NULL);
+    }
+    if (fp)
+    {
+        fclose(fp);
+    }
+}
+
+bool PNGRowWriter::Open(const std::string& filenameIn, uint32_t widthIn, uint32_t heightIn, PixelFormat pixelFormatIn)
+{
+    failed = true;
+    width = widthIn;
+    height = heightIn;
+    pixelFormat = pixelFormatIn;
+    rowsWritten = 0;
+
+    std::string filename = GetRootPath() + filenameIn;
+    fp = OpenFile(filename, "wb");
+    if (!fp)
+    {
+        Log::printf("Error: Failed to fopen \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png)
+    {
+        Log::printf("Error: png_create_write_struct() failed\n");
+        return false;
+    }
+
+    info = png_create_info_struct(png);
+    if (!info)
+    {
+        Log::printf("Error: png_create_info_struct() failed\n");
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        Log::printf("Error: failed to write png header of \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    png_init_io(png, fp);
+
+    static int s_pixelFormatToPNGColorType[(int)PixelFormat::NUM_FORMATS] =
+    {
+        PNG_COLOR_TYPE_GRAY,       // R
+        PNG_COLOR_TYPE_GRAY_ALPHA, // RA
+        PNG_COLOR_TYPE_RGB,        // RGB
+        PNG_COLOR_TYPE_RGB_ALPHA   // RGBA
+    };
+
+    png_set_IHDR(png, info, width, height, 8,
+                 s_pixelFormatToPNGColorType[(int)pixelFormat], PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    failed = false;
+    return true;
+}
+
+bool PNGRowWriter::WriteStripe(const Image& stripe)
+{
+    if (failed || !png)
+    {
+        return false;
+    }
+
+    if (stripe.width != width || stripe.pixelFormat != pixelFormat || rowsWritten + stripe.height > height)
+    {
+        Log::printf("Error: stripe does not match png being written\n");
+        failed = true;
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        Log::printf("Error: png write failed at row %u\n", rowsWritten);
+        failed = true;
+        return false;
+    }
+
+    size_t rowSize = (size_t)width * stripe.GetPixelSize();
+    for (uint32_t i = 0; i < stripe.height; i++)
+    {
+        png_write_row(png, stripe.data.data() + i * rowSize);
+    }
+    rowsWritten += stripe.height;
+    return true;
+}
+
+bool PNGRowWriter::Close()
+{
+    if (!png)
+    {
+        return false;
+    }
+
+    bool result = !failed && rowsWritten == height;
+    if (result)
+    {
+        if (setjmp(png_jmpbuf(png)))
+        {
+            result = false;
+        }
+        else
+        {
+            png_write_end(png, NULL);
+        }
+    }
+
+    png_destroy_write_struct(&png, &info);
+    png = nullptr;
+    info = nullptr;
+    if (fp)
+    {
+        result = (fclose(fp) == 0) && result;
+        fp = nullptr;
+    }
+    return result;
+}
+
+bool ConvertPNGStreaming(const std::string& inFilename, const std::string& outFilename,
+                         const std::function<void(Image& stripe)>& process, uint32_t stripeRows, bool multiplyAlpha)
+{
+    PNGRowReader reader;
+    if (!reader.Open(inFilename, multiplyAlpha))
+    {
+        return false;
+    }
+
+    PNGRowWriter writer;
+    if (!writer.Open(outFilename, reader.width, reader.height, reader.pixelFormat))
+    {
+        return false;
+    }
+
+    // the same stripe is reused, so its buffer is only allocated once.
+    Image stripe;
+    while (reader.ReadStripe(stripe, stripeRows) > 0)
+    {
+        if (process)
+        {
+            process(stripe);
+        }
+        if (!writer.WriteStripe(stripe))
+        {
+            return false;
+        }
+    }
+
+    if (reader.failed || reader.rowsRead != reader.height)
+    {
+        return false;
+    }
+    return writer.Close();
+}
@@ -0,0 +1,102 @@
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "image.h"
+
+struct png_struct_def;
+struct png_info_def;
+
+// Reads a non-interlaced 8 bit png a stripe of rows at a time, through libpng's row api.
+// Stripes hold rows in file order (top to bottom), unlike Image::Load which flips them.
+// Alpha is pre-multiplied unless Open is told otherwise, same as Image::Load.
+struct PNGRowReader
+{
+    PNGRowReader();
+    ~PNGRowReader();
+
+    // filename is relative to the root path. read from disk, mounted archives aren't searched.
+    bool Open(const std::string& filename, bool multiplyAlpha = true);
+
+    // reads up to maxRows rows into stripe, returns the number of rows read, 0 at the end or on error.
+    uint32_t ReadStripe(Image& stripe, uint32_t maxRows);
+    void Close();
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowsRead;
+    PixelFormat pixelFormat;
+    bool multiplyAlpha;
+    bool failed;
+
+    FILE* fp;
+    png_struct_def* png;
+    png_info_def* info;
+};
+
+// Decodes a png from bytes pushed as they arrive, from a socket or slow storage, with libpng's progressive reader.
+// Rows land in image (bottom to top, alpha pre-multiplied, like Image::Load) as soon as they are decoded.
+// Interlaced pngs fill in over the 7 Adam7 passes, every pass pixel covers its block until a later pass refines it,
+// so the whole image shows up coarse after the first 1/64 of its pixels.
+struct PNGPushDecoder
+{
+    PNGPushDecoder();
+    ~PNGPushDecoder();
+
+    bool Start(bool multiplyAlpha = true);
+
+    // feeds the next bytes of the file, any amount. returns false once the data turns out broken.
+    bool Push(const uint8_t* bytes, size_t size);
+
+    // image rows changed since the last call, false if none.
+    bool TakeChangedRows(uint32_t* firstRowOut, uint32_t* numRowsOut);
+    void Close();
+
+    Image image;  // allocated, cleared to transparent black, once hasHeader is set
+    bool multiplyAlpha;
+    bool hasHeader;
+    bool complete;
+    bool failed;
+    int numPasses;  // 1, or 7 for interlaced
+    uint32_t changedBegin;
+    uint32_t changedEnd;
+
+    png_struct_def* png;
+    png_info_def* info;
+};
+
+// Writes a png a stripe of rows at a time with png_write_row, rows top to bottom.
+struct PNGRowWriter
+{
+    PNGRowWriter();
+    ~PNGRowWriter();
+
+    // filename is relative to the root path.
+    bool Open(const std::string& filename, uint32_t width, uint32_t height, PixelFormat pixelFormat);
+    bool WriteStripe(const Image& stripe);
+
+    // fails if fewer than height rows were written.
+    bool Close();
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowsWritten;
+    PixelFormat pixelFormat;
+    bool failed;
+
+    FILE* fp;
+    png_struct_def* png;
+    png_info_def* info;
+};
+
+// Load -> process -> Save without ever holding the whole image,
+// memory use is proportional to width * stripeRows no matter how tall the image is.
+// with multiplyAlpha false, process gets straight color and pre-multiplies itself if it needs to.
+bool ConvertPNGStreaming(const std::string& inFilename, const std::string& outFilename,
+                         const std::function<void(Image& stripe)>& process, uint32_t stripeRows = 64, bool multiplyAlpha = true);
+
+#endif
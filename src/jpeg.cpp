@@ -0,0 +1,290 @@
+#include "jpeg.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+#include "image.h"
+#include "log.h"
+
+#if JPEG_LIB_VERSION >= 70
+#define MIN_DCT_V_SCALED_SIZE(cinfo) ((cinfo).min_DCT_v_scaled_size)
+#define DCT_V_SCALED_SIZE(comp) ((comp).DCT_v_scaled_size)
+#define DCT_H_SCALED_SIZE(comp) ((comp).DCT_h_scaled_size)
+#else
+#define MIN_DCT_V_SCALED_SIZE(cinfo) ((cinfo).min_DCT_scaled_size)
+#define DCT_V_SCALED_SIZE(comp) ((comp).DCT_scaled_size)
+#define DCT_H_SCALED_SIZE(comp) ((comp).DCT_scaled_size)
+#endif
+
+// the default error_exit calls exit(), this one longjmps back to the decode call instead.
+struct JPEGErrorManager
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static void OnJPEGError(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    Log::printf("Error: jpeg: %s\n", message);
+    longjmp(((JPEGErrorManager*)cinfo->err)->jump, 1);
+}
+
+static void OnJPEGMessage(j_common_ptr cinfo)
+{
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    Log::printf("jpeg: %s\n", message);
+}
+
+int ChooseJPEGScale(uint32_t width, uint32_t height, uint32_t minWidth, uint32_t minHeight)
+{
+    if (minWidth == 0 && minHeight == 0)
+    {
+        return 1;
+    }
+    for (int denom = 8; denom > 1; denom /= 2)
+    {
+        // libjpeg rounds scaled sizes up
+        if ((width + denom - 1) / denom >= minWidth && (height + denom - 1) / denom >= minHeight)
+        {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+// reads the header and sets the scale, returns false if it is not something we decode.
+static bool StartJPEG(jpeg_decompress_struct& cinfo, const uint8_t* bytes, size_t size, uint32_t minWidth, uint32_t minHeight)
+{
+    jpeg_mem_src(&cinfo, (unsigned char*)bytes, (unsigned long)size);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.num_components != 1 && cinfo.num_components != 3)
+    {
+        Log::printf("Error: unsupported jpeg with %d components\n", cinfo.num_components);
+        return false;
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = (unsigned int)ChooseJPEGScale(cinfo.image_width, cinfo.image_height, minWidth, minHeight);
+    return true;
+}
+
+bool ReadJPEGSize(const uint8_t* bytes, size_t size, uint32_t* widthOut, uint32_t* heightOut)
+{
+    jpeg_decompress_struct cinfo;
+    JPEGErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = OnJPEGError;
+    err.pub.output_message = OnJPEGMessage;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char*)bytes, (unsigned long)size);
+    jpeg_read_header(&cinfo, TRUE);
+    *widthOut = cinfo.image_width;
+    *heightOut = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+bool DecodeJPEG(const uint8_t* bytes, size_t size, Image& image, uint32_t minWidth, uint32_t minHeight)
+{
+    jpeg_decompress_struct cinfo;
+    JPEGErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = OnJPEGError;
+    err.pub.output_message = OnJPEGMessage;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+
+    if (!StartJPEG(cinfo, bytes, size, minWidth, minHeight))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    cinfo.out_color_space = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    image.width = cinfo.output_width;
+    image.height = cinfo.output_height;
+    image.pixelFormat = cinfo.output_components == 1 ? PixelFormat::R : PixelFormat::RGB;
+    const size_t rowSize = (size_t)image.width * cinfo.output_components;
+    image.data.resize(rowSize * image.height);
+
+    // decoded straight into data, jpeg rows are top to bottom, ours are bottom to top.
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = image.data.data() + (size_t)(image.height - 1 - cinfo.output_scanline) * rowSize;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+// true if the planes jpeg_read_raw_data produces have a layout YUVImage holds as is.
+// needs jpeg_calc_output_dimensions: when scaling, libjpeg-turbo upsamples chroma in the IDCT where it can,
+// so a 4:2:0 file decoded at 1/2 gives 4:4:4 planes.
+static bool GetRawChromaFormat(const jpeg_decompress_struct& cinfo, ChromaFormat* chromaOut)
+{
+    if (cinfo.num_components == 1)
+    {
+        *chromaOut = ChromaFormat::Mono;
+        return true;
+    }
+    if (cinfo.jpeg_color_space != JCS_YCbCr)
+    {
+        return false;
+    }
+
+    // samples per iMCU of each component
+    const jpeg_component_info* comp = cinfo.comp_info;
+    int xSamples[3];
+    int ySamples[3];
+    for (int c = 0; c < 3; c++)
+    {
+        xSamples[c] = comp[c].h_samp_factor * DCT_H_SCALED_SIZE(comp[c]);
+        ySamples[c] = comp[c].v_samp_factor * DCT_V_SCALED_SIZE(comp[c]);
+    }
+    if (xSamples[1] != xSamples[2] || ySamples[1] != ySamples[2])
+    {
+        return false;
+    }
+    if (xSamples[0] == xSamples[1] * 2 && ySamples[0] == ySamples[1] * 2)
+    {
+        *chromaOut = ChromaFormat::C420;
+    }
+    else if (xSamples[0] == xSamples[1] * 2 && ySamples[0] == ySamples[1])
+    {
+        *chromaOut = ChromaFormat::C422;
+    }
+    else if (xSamples[0] == xSamples[1] && ySamples[0] == ySamples[1])
+    {
+        *chromaOut = ChromaFormat::C444;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool DecodeJPEGToYUV(const uint8_t* bytes, size_t size, YUVImage& image, uint32_t minWidth, uint32_t minHeight)
+{
+    // the planes and row pointers of all three components, freed the same way whether decoding finishes or fails.
+    std::vector<uint8_t> planes[3];
+    std::vector<JSAMPROW> rows[3];
+
+    jpeg_decompress_struct cinfo;
+    JPEGErrorManager err;
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = OnJPEGError;
+    err.pub.output_message = OnJPEGMessage;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+
+    if (!StartJPEG(cinfo, bytes, size, minWidth, minHeight))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    ChromaFormat chromaFormat;
+    jpeg_calc_output_dimensions(&cinfo);
+    if (!GetRawChromaFormat(cinfo, &chromaFormat))
+    {
+        // unusual subsampling, let libjpeg upsample and split the interleaved YCbCr into planes.
+        cinfo.out_color_space = JCS_YCbCr;
+        jpeg_start_decompress(&cinfo);
+        image.Resize(cinfo.output_width, cinfo.output_height, ChromaFormat::C444);
+        planes[0].resize((size_t)image.width * 3);
+        JSAMPROW row = planes[0].data();
+        while (cinfo.output_scanline < cinfo.output_height)
+        {
+            const size_t offset = (size_t)cinfo.output_scanline * image.width;
+            jpeg_read_scanlines(&cinfo, &row, 1);
+            for (uint32_t x = 0; x < image.width; x++)
+            {
+                image.y[offset + x] = row[x * 3 + 0];
+                image.u[offset + x] = row[x * 3 + 1];
+                image.v[offset + x] = row[x * 3 + 2];
+            }
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return true;
+    }
+
+    cinfo.raw_data_out = TRUE;
+    if (cinfo.num_components == 1)
+    {
+        cinfo.out_color_space = JCS_GRAYSCALE;
+    }
+    jpeg_start_decompress(&cinfo);
+    image.Resize(cinfo.output_width, cinfo.output_height, chromaFormat);
+
+    // jpeg_read_raw_data writes whole iMCU rows of whole blocks, wider and taller than the image,
+    // so it decodes into padded planes that are cropped into the YUVImage afterwards.
+    const int numComponents = cinfo.num_components;
+    const uint32_t rowsPerIMCU = (uint32_t)(cinfo.max_v_samp_factor * MIN_DCT_V_SCALED_SIZE(cinfo));
+    const uint32_t numIMCUs = (cinfo.output_height + rowsPerIMCU - 1) / rowsPerIMCU;
+    size_t strides[3];
+    uint32_t compRowsPerIMCU[3];
+    for (int c = 0; c < numComponents; c++)
+    {
+        const jpeg_component_info& comp = cinfo.comp_info[c];
+        const size_t blocksPerRow = ((size_t)comp.width_in_blocks + comp.h_samp_factor - 1) / comp.h_samp_factor * comp.h_samp_factor;
+        strides[c] = blocksPerRow * DCT_H_SCALED_SIZE(comp);
+        compRowsPerIMCU[c] = (uint32_t)(comp.v_samp_factor * DCT_V_SCALED_SIZE(comp));
+        planes[c].resize(strides[c] * compRowsPerIMCU[c] * numIMCUs);
+        rows[c].resize((size_t)compRowsPerIMCU[c] * numIMCUs);
+        for (size_t r = 0; r < rows[c].size(); r++)
+        {
+            rows[c][r] = planes[c].data() + r * strides[c];
+        }
+    }
+
+    for (uint32_t i = 0; i < numIMCUs && cinfo.output_scanline < cinfo.output_height; i++)
+    {
+        JSAMPARRAY componentRows[3];
+        for (int c = 0; c < numComponents; c++)
+        {
+            componentRows[c] = rows[c].data() + (size_t)i * compRowsPerIMCU[c];
+        }
+        jpeg_read_raw_data(&cinfo, componentRows, rowsPerIMCU);
+    }
+
+    YUVPlaneBuffer* outPlanes[3] = {&image.y, &image.u, &image.v};
+    for (int c = 0; c < numComponents; c++)
+    {
+        const uint32_t width = c == 0 ? image.width : image.GetChromaWidth();
+        const uint32_t height = c == 0 ? image.height : image.GetChromaHeight();
+        for (uint32_t y = 0; y < height; y++)
+        {
+            memcpy(outPlanes[c]->data() + (size_t)y * width, rows[c][y], width);
+        }
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef JPEG_H
+#define JPEG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Image;
+struct YUVImage;
+
+// JPEG decode through libjpeg(-turbo), only built with IMGTOY_JPEG.
+
+// inline so builds without jpeg support can still recognize jpegs and say why they fail.
+inline bool IsJPEG(const uint8_t* bytes, size_t size)
+{
+    return size >= 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff;
+}
+
+// returns 1, 2, 4 or 8, the largest DCT scale down that still covers minWidth x minHeight.
+// 0 x 0 means full size.
+int ChooseJPEGScale(uint32_t width, uint32_t height, uint32_t minWidth, uint32_t minHeight);
+
+// header only, full size before any scaling.
+bool ReadJPEGSize(const uint8_t* bytes, size_t size, uint32_t* widthOut, uint32_t* heightOut);
+
+// gray jpegs come out as R, everything else as RGB.
+bool DecodeJPEG(const uint8_t* bytes, size_t size, Image& image, uint32_t minWidth, uint32_t minHeight);
+
+// skips the color conversion and chroma upsampling, the planes come out as stored in the file:
+// 4:2:0, 4:2:2 and 4:4:4 as they are, other subsamplings upsampled to 4:4:4, gray as Mono.
+// scaled decodes can come out with less chroma subsampling than the file has, check chromaFormat.
+// jpeg YCbCr is full range BT.601.
+bool DecodeJPEGToYUV(const uint8_t* bytes, size_t size, YUVImage& image, uint32_t minWidth, uint32_t minHeight);
+
+#endif
@@ -9,6 +9,7 @@ public:
 };
 
 Console* Log::console = nullptr;
+FILE* Log::output = nullptr;
 
 int Log::printf(const char *fmt, ...)
 {
@@ -35,7 +36,7 @@ int Log::printf(const char *fmt, ...)
         console->Write(newBuffer, c - newBuffer);
     }
 
-    fwrite(buffer, rc, 1, stdout);
+    fwrite(buffer, rc, 1, output ? output : stdout);
 
     return rc;
 }
@@ -81,7 +82,7 @@ int Log::printf_ansi(AnsiColor color, const char *fmt, ...)
         console->Write(resetSeq, 4);
     }
 
-    fwrite(buffer, rc, 1, stdout);
+    fwrite(buffer, rc, 1, output ? output : stdout);
 
     return rc;
 }
@@ -1,6 +1,8 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdio.h>
+
 class Console;
 
 struct Log
@@ -20,6 +22,9 @@ struct Log
     static int printf(const char *fmt, ...);
     static int printf_ansi(AnsiColor color, const char *fmt, ...);
     static Console* console;
+
+    // where messages go, stdout by default. set to stderr when stdout carries data (y4m frames for example).
+    static FILE* output;
 };
 
 #endif
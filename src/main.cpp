@@ -12,117 +12,1414 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#include "archive.h"
+#include "batch.h"
+#include "compare.h"
+#include "convert.h"
+#include "cubelut.h"
+#include "filter.h"
+#include "frametimer.h"
+#include "framestream.h"
+#include "hud.h"
 #include "image.h"
+#include "imagestats.h"
+#include "imagestream.h"
 #include "log.h"
+#include "memtrack.h"
+#include "pixelops.h"
+#include "resample.h"
 #include "texture.h"
 #include "program.h"
+#include "quantize.h"
+#include "recorder.h"
+#include "util.h"
+#include "y4m.h"
+#ifdef IMGTOY_HEADLESS
+#include "headless.h"
+#endif
 
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <filesystem>
+#include <stdio.h>
 #include <stdlib.h> //rand()
+#include <string.h>
+#include <vector>
 
 static bool quitting = false;
 static float r = 0.0f;
 static SDL_Window *window = NULL;
 static SDL_GLContext gl_context;
 static SDL_Renderer *renderer = NULL;
+static ColorStandard colorStandard = ColorStandard::BT709;
+static ColorRange colorRange = ColorRange::Limited;
+static bool printStats = false;
+// --lut, graded on the cpu in the same pass as the conversion, or in the shader when drawing with --lut-gpu.
+static CubeLut* gradeLut = nullptr;
+static bool gradeOnGpu = false;
 
-// [0, 255]
-float GrayToLuma(float g)
+void dumpTable()
+{
+    uint8_t table[256];
+    MakeSRGBTable(table);
+
+    Log::printf("static uint8_t table[256] =\n{\n");
+    for (int i = 0; i < 32; i++)
+    {
+        Log::printf("    ");
+        for (int j = 0; j < 8; j++)
+        {
+            int ii = i * 8 + j;
+            Log::printf("%d, ", table[ii]);
+        }
+        Log::printf("\n");
+    }
+    Log::printf("};\n");
+}
+
+// draws a quad covering the window, centered vertically.
+void drawQuad(Program* program, int width, int height)
+{
+    glm::vec2 xyLowerLeft(0.0f, (height - width) / 2.0f);
+    glm::vec2 xyUpperRight((float)width, (height + width) / 2.0f);
+    glm::vec2 uvLowerLeft(0.0f, 0.0f);
+    glm::vec2 uvUpperRight(1.0f, 1.0f);
+
+    glm::vec3 positions[] = {glm::vec3(xyLowerLeft, 0.0f), glm::vec3(xyUpperRight.x, xyLowerLeft.y, 0.0f),
+                             glm::vec3(xyUpperRight, 0.0f), glm::vec3(xyLowerLeft.x, xyUpperRight.y, 0.0f)};
+    program->SetAttrib("position", positions);
+
+    glm::vec2 uvs[] = {uvLowerLeft, glm::vec2(uvUpperRight.x, uvLowerLeft.y),
+                       uvUpperRight, glm::vec2(uvLowerLeft.x, uvUpperRight.y)};
+    if (program->attribs.find("uv") != program->attribs.end())
+    {
+        program->SetAttrib("uv", uvs);
+    }
+
+    const size_t NUM_INDICES = 6;
+    uint16_t indices[NUM_INDICES] = {0, 1, 2, 0, 2, 3};
+    glDrawElements(GL_TRIANGLES, NUM_INDICES, GL_UNSIGNED_SHORT, indices);
+}
+
+// convert is the matrix the shader applies after the lut, nullptr for none.
+void drawImage(Program* program, Texture* texture, int width, int height, const LutTexture* lut = nullptr,
+               const ColorMatrix* convert = nullptr)
+{
+    glm::mat4 projMat = glm::ortho(0.0f, (float)width, 0.0f, (float)height, -10.0f, 10.0f);
+
+    program->Apply();
+    program->SetUniform("modelViewProjMat", projMat);
+    program->SetUniform("color", glm::vec4(1.0f));
+
+    // use texture unit 0 for colorTexture
+    texture->Apply(0);
+    program->SetUniform("colorTexture", 0);
+
+    // and unit 1 for the grade of shader/grade_texture_frag.glsl
+    if (lut)
+    {
+        lut->Apply(1);
+        program->SetUniform("gradeTexture", 1);
+        program->SetUniform("gradeSize", (float)lut->size);
+        glm::vec3 domainMin(lut->domainMin[0], lut->domainMin[1], lut->domainMin[2]);
+        glm::vec3 domainMax(lut->domainMax[0], lut->domainMax[1], lut->domainMax[2]);
+        program->SetUniform("gradeDomainMin", domainMin);
+        program->SetUniform("gradeDomainScale", 1.0f / (domainMax - domainMin));
+
+        const ColorMatrix matrix = convert ? *convert : MakeIdentityColorMatrix();
+        const char* rowNames[3] = {"convertR", "convertG", "convertB"};
+        for (int i = 0; i < 3; i++)
+        {
+            const double* row = matrix.coeffs[i];
+            program->SetUniform(rowNames[i], glm::vec4((float)row[0], (float)row[1], (float)row[2], (float)(row[3] / 255.0)));
+        }
+    }
+
+    drawQuad(program, width, height);
+}
+
+// legal output range of processImage, so the stats report how much of the output falls outside it.
+void setProcessLimits(ImageStats& stats, PixelFormat pixelFormat)
+{
+    if (colorRange == ColorRange::Limited)
+    {
+        stats.SetLimits(0, 16, 235);
+        if (pixelFormat == PixelFormat::RGB || pixelFormat == PixelFormat::RGBA)
+        {
+            stats.SetLimits(1, 16, 240);
+            stats.SetLimits(2, 16, 240);
+        }
+    }
+}
+
+// the 3D lut goes first, on straight color before the conversion. with --lut-gpu the shader grades and then
+// converts, so the textures it draws stay unconverted RGB.
+void addGradeStage(PixelPipeline& pipeline)
+{
+    if (gradeLut && !gradeOnGpu)
+    {
+        pipeline.Lut3D(*gradeLut);
+    }
+}
+
+Texture* createImageTexture()
+{
+    Image img;
+    if (!img.Load("texture/T_VideoCallThumbnailYellow.png", false))
+    {
+        Log::printf("failed to load img\n");
+    }
+
+    // pre-multiply and convert in one pass over the pixels.
+    PixelPipeline pipeline;
+    addGradeStage(pipeline);
+    pipeline.Premultiply();
+    if (gradeOnGpu)
+    {
+        pipeline.Execute(img);
+    }
+    else
+    {
+        AddProcessStages(pipeline, img.pixelFormat, colorStandard, colorRange);
+        ImageStats stats;
+        if (printStats)
+        {
+            setProcessLimits(stats, img.pixelFormat);
+            pipeline.Stats(&stats);
+        }
+        pipeline.Execute(img);
+        if (printStats)
+        {
+            Log::printf("%s", stats.Summary("yuv").c_str());
+        }
+
+        img.Save("texture/T_VideoCallThumbnailYellow_YUV.png");
+    }
+
+    Texture::Params texParams = {FilterType::LinearMipmapLinear, FilterType::Linear, WrapType::ClampToEdge, WrapType::ClampToEdge};
+    return new Texture(img, texParams);
+}
+
+#ifdef IMGTOY_HEADLESS
+// renders the image quad into an offscreen framebuffer, no window or display server needed.
+// reports frames per second, and saves the last frame to outFilename (relative to the root path).
+int runHeadless(const char* outFilename, int numFrames, int width, int height)
+{
+    HeadlessContext headless;
+    if (!headless.Init(width, height))
+    {
+        Log::printf("Failed to create headless GL context\n");
+        return 1;
+    }
+
+    Texture* imgTexture = createImageTexture();
+
+    // pre-multiplied alpha blending
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    Program* imgProgram = new Program();
+    if (!imgProgram->Load("shader/fullbright_texture_vert.glsl", "shader/fullbright_texture_frag.glsl"))
+    {
+        return 1;
+    }
+
+    // warm up, so shader and texture residency costs are not counted.
+    headless.Bind();
+    glClearColor(0.0f, 0.4f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    drawImage(imgProgram, imgTexture, width, height);
+    glFinish();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numFrames; i++)
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+        drawImage(imgProgram, imgTexture, width, height);
+    }
+    glFinish();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (numFrames > 0)
+    {
+        Log::printf("headless: %d frames at %dx%d in %.3f sec, %.1f fps, %.3f ms/frame\n", numFrames, width, height,
+                    elapsed.count(), numFrames / elapsed.count(), 1000.0 * elapsed.count() / numFrames);
+    }
+
+    int result = 0;
+    Image frame;
+    if (!headless.ReadPixels(frame) || !frame.Save(outFilename))
+    {
+        Log::printf("Failed to save headless frame to \"%s\"\n", outFilename);
+        result = 1;
+    }
+
+    delete imgProgram;
+    delete imgTexture;
+    return result;
+}
+#endif
+
+int runResample(const char* inFilename, const char* outFilename, int width, int height, ResampleFilter filter)
+{
+    // jpegs decode at the smallest DCT scale that still covers the output, the filter does the rest.
+    LoadOptions options;
+    options.minWidth = (uint32_t)width;
+    options.minHeight = (uint32_t)height;
+
+    Image src;
+    auto loadStart = std::chrono::steady_clock::now();
+    if (!src.Load(inFilename, options))
+    {
+        return 1;
+    }
+    std::chrono::duration<double, std::milli> loadElapsed = std::chrono::steady_clock::now() - loadStart;
+    Log::printf("decoded %ux%u in %.2f ms\n", src.width, src.height, loadElapsed.count());
+
+    Image dst;
+    auto start = std::chrono::steady_clock::now();
+    if (!Resample(src, dst, width, height, filter))
+    {
+        return 1;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    Log::printf("resampled %ux%u to %dx%d in %.2f ms\n", src.width, src.height, width, height, elapsed.count());
+
+    return dst.Save(outFilename) ? 0 : 1;
+}
+
+// writes IN as a palette png, reports how many colors it had, the file sizes and what the palette cost in quality.
+int runQuantize(const char* inFilename, const char* outFilename, const QuantizeOptions& optionsIn)
 {
-    return 0.859f * g + 16.0f;
+    // straight alpha keeps the full precision of translucent colors, the quantizer pre-multiplies with rounding.
+    Image src;
+    if (!src.Load(inFilename, false))
+    {
+        return 1;
+    }
+    QuantizeOptions options = optionsIn;
+    options.premultiplied = false;
+
+    IndexedImage indexed;
+    auto start = std::chrono::steady_clock::now();
+    if (!Quantize(src, options, indexed))
+    {
+        return 1;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (!indexed.Save(outFilename))
+    {
+        return 1;
+    }
+
+    std::error_code ec;
+    const uintmax_t inSize = std::filesystem::file_size(GetRootPath() + inFilename, ec);
+    const uintmax_t outSize = std::filesystem::file_size(GetRootPath() + outFilename, ec);
+    Log::printf("quantized %ux%u to %d colors (%s) in %.2f ms\n", src.width, src.height, (int)(indexed.palette.size() / 4),
+                indexed.exact ? "exact" : "k-means", elapsed.count());
+    Log::printf("%llu bytes -> %llu bytes (%.1f%%)\n", (unsigned long long)inSize, (unsigned long long)outSize,
+                inSize ? 100.0 * outSize / inSize : 0.0);
+
+    // quality as it will be seen, pre-multiplied.
+    src.MultiplyAlpha();
+    Image expanded;
+    indexed.Expand(expanded, src.pixelFormat, true);
+    CompareResult result;
+    if (!CompareImages(src, expanded, result))
+    {
+        return 1;
+    }
+    Log::printf("%s\n", FormatCompareResult(result).c_str());
+    return 0;
 }
 
-// [0, 255]
-float LumaToGray(float y)
+// spec is gaussian:SIGMA, binomial:3 or binomial:5, box:RADIUS or sharpen:AMOUNT[:SIGMA].
+int runFilter(const char* inFilename, const char* outFilename, const char* spec, WrapType wrap)
 {
-    return (y - 16.0f) / 0.859f;
+    Image src;
+    if (!src.Load(inFilename))
+    {
+        return 1;
+    }
+
+    char name[32] = {};
+    float a = 0.0f;
+    float b = 1.0f;
+    const int numValues = sscanf(spec, "%31[a-z]:%f:%f", name, &a, &b);
+    Image dst;
+    bool result = false;
+    auto start = std::chrono::steady_clock::now();
+    if (numValues >= 2 && !strcmp(name, "gaussian"))
+    {
+        result = GaussianBlur(src, dst, a, wrap);
+    }
+    else if (numValues >= 2 && !strcmp(name, "binomial"))
+    {
+        const std::vector<float> kernel = MakeBinomialKernel((int)a);
+        result = Convolve(src, dst, kernel, kernel, wrap);
+    }
+    else if (numValues >= 2 && !strcmp(name, "box"))
+    {
+        result = BoxBlur(src, dst, (int)a, wrap);
+    }
+    else if (numValues >= 2 && !strcmp(name, "sharpen"))
+    {
+        result = Sharpen(src, dst, a, b, wrap);
+    }
+    else
+    {
+        Log::printf("Error: unknown filter \"%s\"\n", spec);
+        return 1;
+    }
+    if (!result)
+    {
+        return 1;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    Log::printf("filtered %ux%u with %s in %.2f ms\n", src.width, src.height, spec, elapsed.count());
+
+    return dst.Save(outFilename) ? 0 : 1;
 }
 
-// [0, 255]
-float linearToSRGB(float i)
-{
-    float l = i / 255.0f;
-    float s;
-    if (l <= 0.0031308f)
+// grades IN through the --lut on its own, no yuv conversion.
+int runGrade(const char* inFilename, const char* outFilename)
+{
+    Image img;
+    if (!img.Load(inFilename, false))
+    {
+        return 1;
+    }
+
+    PixelPipeline pipeline;
+    pipeline.Lut3D(*gradeLut);
+    auto start = std::chrono::steady_clock::now();
+    if (!pipeline.Execute(img))
+    {
+        return 1;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    Log::printf("graded %ux%u through a %d^3 lut in %.2f ms, %.1f Mpixel/s\n", img.width, img.height, gradeLut->size,
+                elapsed.count(), img.width * (double)img.height / (elapsed.count() * 1000.0));
+
+    return img.Save(outFilename) ? 0 : 1;
+}
+
+int runBatch(const char* inDir, const char* outDir, const char* cacheDir)
+{
+    BatchOptions options;
+    options.standard = colorStandard;
+    options.range = colorRange;
+    options.lut = gradeLut;
+    if (cacheDir)
+    {
+        options.cacheDir = cacheDir;
+    }
+
+    BatchStats stats;
+    auto start = std::chrono::steady_clock::now();
+    bool result = RunBatch(inDir, outDir, options, stats);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    Log::printf("batch: %d files, %d up to date, %d from cache, %d converted, %d failed in %.1f ms\n",
+                stats.numFiles, stats.numUpToDate, stats.numFromCache, stats.numConverted, stats.numFailed, elapsed.count());
+    return result ? 0 : 1;
+}
+
+// y4m frames arrive as YUV, they go back to RGB before the conversion (the two matrices fuse into one pass).
+// png frames arrive with straight alpha and are pre-multiplied after the grade, like createImageTexture.
+void processStreamFrame(Image& frame, bool yuvSource)
+{
+    PixelPipeline pipeline;
+    if (yuvSource)
+    {
+        pipeline.Matrix(MakeYUVToRGB(colorStandard, colorRange));
+    }
+    addGradeStage(pipeline);
+    if (!yuvSource)
+    {
+        pipeline.Premultiply();
+    }
+    if (!gradeOnGpu)
+    {
+        AddProcessStages(pipeline, frame.pixelFormat, colorStandard, colorRange);
+    }
+    pipeline.Execute(frame);
+}
+
+// opens the output on the first frame, since png sequences only know their size once decoded.
+bool writeStreamFrame(Y4MWriter& writer, const char* filename, const FrameStream& stream, const Image& frame, YUVImage& packed)
+{
+    ChromaFormat chroma = stream.yuvSource ? stream.y4mReader.chromaFormat : ChromaFormat::C420;
+    if (!writer.fp && !writer.Open(filename, frame.width, frame.height, stream.fpsNum, stream.fpsDen, chroma))
+    {
+        return false;
+    }
+    PackYUV(frame, packed, chroma);
+    return writer.WriteFrame(packed);
+}
+
+bool openFrameStream(FrameStream& stream, const char* sequencePattern, int sequenceFirst, const char* y4mInput)
+{
+    bool opened = sequencePattern ? stream.OpenSequence(sequencePattern, sequenceFirst) : stream.OpenY4M(y4mInput);
+    if (opened)
+    {
+        bool yuvSource = stream.yuvSource;
+        stream.Start([yuvSource](Image& frame) { processStreamFrame(frame, yuvSource); });
+    }
+    return opened;
+}
+
+// streams without a window, as fast as the input and output allow.
+int runStream(const char* sequencePattern, int sequenceFirst, const char* y4mInput, const char* y4mOutput)
+{
+    FrameStream stream;
+    if (!openFrameStream(stream, sequencePattern, sequenceFirst, y4mInput))
+    {
+        return 1;
+    }
+
+    int result = 0;
+    Y4MWriter writer;
+    YUVImage packed;
+    while (StreamFrame* frame = stream.AcquireFrame())
+    {
+        if (y4mOutput && result == 0 && !writeStreamFrame(writer, y4mOutput, stream, frame->image, packed))
+        {
+            Log::printf("Failed to write frame %llu to \"%s\"\n", (unsigned long long)frame->index, y4mOutput);
+            result = 1;
+        }
+        stream.ReleaseFrame(frame);
+    }
+    stream.Stop();
+    if (writer.fp && !writer.Close())
+    {
+        result = 1;
+    }
+
+    stream.PrintSummary();
+    return result;
+}
+
+// compares two pngs, or every png of two directory trees, returns non-zero if anything differs by more than tolerance.
+int runCompare(const char* a, const char* b, int tolerance)
+{
+    std::error_code ec;
+    if (std::filesystem::is_directory(GetRootPath() + a, ec) && std::filesystem::is_directory(GetRootPath() + b, ec))
+    {
+        return CompareDirectories(a, b, tolerance) ? 1 : 0;
+    }
+
+    CompareResult result;
+    if (!CompareFiles(a, b, result))
+    {
+        return 1;
+    }
+    Log::printf("%s\n", FormatCompareResult(result).c_str());
+    return result.maxAbsDiff > tolerance ? 1 : 0;
+}
+
+// round trips every 24 bit rgb color through RGB -> YUV -> RGB for each standard and range,
+// reports the worst and average per channel error and the throughput of each direction.
+int runColorBench()
+{
+    static const char* s_standardNames[(int)ColorStandard::NUM_STANDARDS] = {"BT.601", "BT.709", "BT.2020"};
+    static const char* s_rangeNames[] = {"limited", "full"};
+    const size_t NUM_COLORS = 1 << 24;
+
+    Image original;
+    original.width = 4096;
+    original.height = 4096;
+    original.pixelFormat = PixelFormat::RGBA;
+    original.data.resize(NUM_COLORS * 4);
+    for (size_t i = 0; i < NUM_COLORS; i++)
+    {
+        original.data[i * 4 + 0] = (uint8_t)(i >> 16);
+        original.data[i * 4 + 1] = (uint8_t)(i >> 8);
+        original.data[i * 4 + 2] = (uint8_t)i;
+        original.data[i * 4 + 3] = 255;
+    }
+
+    Image img;
+    for (int s = 0; s < (int)ColorStandard::NUM_STANDARDS; s++)
+    {
+        for (int r = 0; r < 2; r++)
+        {
+            ColorStandard standard = (ColorStandard)s;
+            ColorRange range = (ColorRange)r;
+            img = original;
+
+            auto start = std::chrono::steady_clock::now();
+            ApplyColorMatrix(img, MakeRGBToYUV(standard, range));
+            auto mid = std::chrono::steady_clock::now();
+            ApplyColorMatrix(img, MakeYUVToRGB(standard, range));
+            auto end = std::chrono::steady_clock::now();
+
+            int maxError = 0;
+            uint64_t totalError = 0;
+            for (size_t i = 0; i < NUM_COLORS * 4; i++)
+            {
+                int error = abs((int)img.data[i] - (int)original.data[i]);
+                maxError = error > maxError ? error : maxError;
+                totalError += error;
+            }
+
+            std::chrono::duration<double> forward = mid - start;
+            std::chrono::duration<double> inverse = end - mid;
+            Log::printf("%-7s %-7s max error %d, mean error %.4f, forward %.1f MPix/s, inverse %.1f MPix/s\n",
+                        s_standardNames[s], s_rangeNames[r], maxError, (double)totalError / (NUM_COLORS * 3),
+                        NUM_COLORS / forward.count() / 1e6, NUM_COLORS / inverse.count() / 1e6);
+        }
+    }
+    return 0;
+}
+
+static float randomFloat(float low, float high)
+{
+    return low + (high - low) * ((float)rand() / (float)RAND_MAX);
+}
+
+static void printMathBench(const char* name, size_t count, int repeats, double scalarSeconds, double batchSeconds, float maxDiff)
+{
+    const double scalarNs = scalarSeconds * 1e9 / ((double)count * repeats);
+    const double batchNs = batchSeconds * 1e9 / ((double)count * repeats);
+    Log::printf("%-13s scalar %6.2f ns, batch %6.2f ns per element, %.1fx, max diff %g\n",
+                name, scalarNs, batchNs, scalarNs / batchNs, maxDiff);
+}
+
+// times the batch math in util.h against the one at a time helpers on the same sprites, and checks they agree.
+int runMathBench()
+{
+    const size_t COUNT = 10000;
+    const int REPEATS = 200;
+
+    Vec3Array points;
+    Vec3Array scales;
+    Vec3Array translations;
+    QuatArray rotationsA;
+    QuatArray rotationsB;
+    std::vector<float> alphas(COUNT);
+    points.Resize(COUNT);
+    scales.Resize(COUNT);
+    translations.Resize(COUNT);
+    rotationsA.Resize(COUNT);
+    rotationsB.Resize(COUNT);
+    for (size_t i = 0; i < COUNT; i++)
+    {
+        points.Set(i, glm::vec3(randomFloat(-100.0f, 100.0f), randomFloat(-100.0f, 100.0f), randomFloat(-100.0f, 100.0f)));
+        scales.Set(i, glm::vec3(randomFloat(0.5f, 2.0f), randomFloat(0.5f, 2.0f), randomFloat(0.5f, 2.0f)));
+        translations.Set(i, glm::vec3(randomFloat(-100.0f, 100.0f), randomFloat(-100.0f, 100.0f), randomFloat(-100.0f, 100.0f)));
+        rotationsA.Set(i, glm::normalize(glm::quat(randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f))));
+        rotationsB.Set(i, glm::normalize(glm::quat(randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f), randomFloat(-1.0f, 1.0f))));
+        alphas[i] = randomFloat(0.0f, 1.0f);
+    }
+
+    const glm::mat4 affine = MakeMat4(glm::vec3(2.0f), glm::normalize(glm::quat(0.9f, 0.1f, 0.2f, 0.3f)), glm::vec3(1.0f, 2.0f, 3.0f));
+    const glm::mat4 projective = glm::perspective(1.0f, 1.5f, 0.1f, 1000.0f) * affine;
+    const glm::mat4* matrices[2] = {&affine, &projective};
+    const char* matrixNames[2] = {"xform affine", "xform proj"};
+    for (int m = 0; m < 2; m++)
+    {
+        std::vector<glm::vec3> scalarOut(COUNT);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < REPEATS; r++)
+        {
+            for (size_t i = 0; i < COUNT; i++)
+            {
+                scalarOut[i] = XformPoint(*matrices[m], points.Get(i));
+            }
+        }
+        auto mid = std::chrono::steady_clock::now();
+        Vec3Array batchOut;
+        for (int r = 0; r < REPEATS; r++)
+        {
+            XformPoints(*matrices[m], points, batchOut);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        float maxDiff = 0.0f;
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            // relative, points near the camera plane land far out after the divide.
+            const glm::vec3 p = batchOut.Get(i);
+            for (int c = 0; c < 3; c++)
+            {
+                maxDiff = std::max(maxDiff, fabsf(p[c] - scalarOut[i][c]) / std::max(fabsf(scalarOut[i][c]), 1.0f));
+            }
+        }
+        printMathBench(matrixNames[m], COUNT, REPEATS, std::chrono::duration<double>(mid - start).count(),
+                       std::chrono::duration<double>(end - mid).count(), maxDiff);
+    }
+
+    {
+        std::vector<glm::quat> scalarOut(COUNT);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < REPEATS; r++)
+        {
+            for (size_t i = 0; i < COUNT; i++)
+            {
+                scalarOut[i] = SafeMix(rotationsA.Get(i), rotationsB.Get(i), alphas[i]);
+            }
+        }
+        auto mid = std::chrono::steady_clock::now();
+        QuatArray batchOut;
+        for (int r = 0; r < REPEATS; r++)
+        {
+            SafeMix(rotationsA, rotationsB, alphas, batchOut);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        float maxDiff = 0.0f;
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            const glm::quat q = batchOut.Get(i);
+            maxDiff = std::max(maxDiff, std::max(std::max(fabsf(q.x - scalarOut[i].x), fabsf(q.y - scalarOut[i].y)),
+                                                 std::max(fabsf(q.z - scalarOut[i].z), fabsf(q.w - scalarOut[i].w))));
+        }
+        printMathBench("safe mix", COUNT, REPEATS, std::chrono::duration<double>(mid - start).count(),
+                       std::chrono::duration<double>(end - mid).count(), maxDiff);
+    }
+
+    {
+        std::vector<glm::mat4> scalarOut(COUNT);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < REPEATS; r++)
+        {
+            for (size_t i = 0; i < COUNT; i++)
+            {
+                scalarOut[i] = MakeMat4(scales.Get(i), rotationsA.Get(i), translations.Get(i));
+            }
+        }
+        auto mid = std::chrono::steady_clock::now();
+        std::vector<glm::mat4> batchOut;
+        for (int r = 0; r < REPEATS; r++)
+        {
+            MakeMat4(scales, rotationsA, translations, batchOut);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        float maxDiff = 0.0f;
+        for (size_t i = 0; i < COUNT; i++)
+        {
+            for (int col = 0; col < 4; col++)
+            {
+                for (int row = 0; row < 4; row++)
+                {
+                    maxDiff = std::max(maxDiff, fabsf(batchOut[i][col][row] - scalarOut[i][col][row]));
+                }
+            }
+        }
+        printMathBench("make mat4", COUNT, REPEATS, std::chrono::duration<double>(mid - start).count(),
+                       std::chrono::duration<double>(end - mid).count(), maxDiff);
+    }
+    return 0;
+}
+
+// saves and reloads filename as png and as qoi, reports throughput, size and that both are lossless.
+int runCodecBench(const char* filename)
+{
+    Image original;
+    if (!original.Load(filename, false))
+    {
+        return 1;
+    }
+
+    static const char* s_extensions[] = {".png", ".qoi"};
+    const double numPixels = (double)original.width * original.height;
+    const size_t rawSize = original.data.size();
+    int result = 0;
+    for (auto ext : s_extensions)
+    {
+        const std::string benchFilename = std::string(filename) + ".bench" + ext;
+        const int NUM_ITERATIONS = 5;
+        double encodeTime = 0.0;
+        double decodeTime = 0.0;
+        Image decoded;
+        for (int i = 0; i < NUM_ITERATIONS; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (!original.Save(benchFilename))
+            {
+                return 1;
+            }
+            auto mid = std::chrono::steady_clock::now();
+            if (!decoded.Load(benchFilename, false))
+            {
+                return 1;
+            }
+            auto end = std::chrono::steady_clock::now();
+            encodeTime += std::chrono::duration<double>(mid - start).count();
+            decodeTime += std::chrono::duration<double>(end - mid).count();
+        }
+
+        std::error_code ec;
+        const uintmax_t fileSize = std::filesystem::file_size(GetRootPath() + benchFilename, ec);
+        std::filesystem::remove(GetRootPath() + benchFilename, ec);
+
+        const bool lossless = decoded.width == original.width && decoded.height == original.height &&
+                              decoded.pixelFormat == original.pixelFormat && decoded.data == original.data;
+        Log::printf("%s  encode %7.1f MPix/s, decode %7.1f MPix/s, %10llu bytes (%5.1f%% of raw)%s\n", ext,
+                    numPixels * NUM_ITERATIONS / encodeTime / 1e6, numPixels * NUM_ITERATIONS / decodeTime / 1e6,
+                    (unsigned long long)fileSize, 100.0 * fileSize / rawSize, lossless ? "" : "  MISMATCH");
+        if (!lossless)
+        {
+            result = 1;
+        }
+    }
+    return result;
+}
+
+enum class SwapMode
+{
+    VSync = 0,
+    Adaptive,
+    Uncapped
+};
+
+void setSwapMode(SwapMode mode)
+{
+    int interval = 1;
+    if (mode == SwapMode::Uncapped)
+    {
+        interval = 0;
+    }
+    else if (mode == SwapMode::Adaptive)
+    {
+        interval = -1;
+    }
+
+    if (SDL_GL_SetSwapInterval(interval) != 0)
+    {
+        Log::printf("Failed to set swap interval %d: %s\n", interval, SDL_GetError());
+        if (mode == SwapMode::Adaptive)
+        {
+            // adaptive sync is not available everywhere, regular vsync is the closest match.
+            SDL_GL_SetSwapInterval(1);
+        }
+    }
+}
+
+// the whole of str as a decimal integer in [minValue, maxValue], false for anything else.
+bool parseInt(const char* str, int minValue, int maxValue, int* valueOut)
+{
+    char* end;
+    errno = 0;
+    const long value = strtol(str, &end, 10);
+    if (end == str || *end != 0 || errno == ERANGE || value < minValue || value > maxValue)
+    {
+        return false;
+    }
+    *valueOut = (int)value;
+    return true;
+}
+
+// the whole of str as a positive number of megabytes, fractions allowed, in bytes.
+bool parseMegabytes(const char* str, size_t* bytesOut)
+{
+    char* end;
+    errno = 0;
+    const double value = strtod(str, &end);
+    // written so nan fails too
+    if (end == str || *end != 0 || errno == ERANGE || !(value > 0.0 && value <= 1024.0 * 1024.0))
+    {
+        return false;
+    }
+    *bytesOut = (size_t)(value * 1024.0 * 1024.0);
+    return *bytesOut > 0;
+}
+
+void printUsage()
+{
+    Log::printf("usage: imgtoy [options]\n");
+    Log::printf("    --size WxH            window or framebuffer size (default 512x512)\n");
+    Log::printf("    --vsync MODE          on, adaptive or off (default on)\n");
+    Log::printf("    --timing-report FILE  frame time histogram written on exit (default frame_times.txt)\n");
+    Log::printf("    --stream IN OUT       convert png IN to OUT a stripe of rows at a time, with constant memory\n");
+    Log::printf("    --stripe-rows N       rows per stripe for --stream (default 64)\n");
+    Log::printf("    --standard STD        rgb to yuv matrix, 601, 709 (default) or 2020\n");
+    Log::printf("    --range RANGE         yuv range, limited (default) or full\n");
+    Log::printf("    --stats               report per channel min, max, mean and clipping of the converted image\n");
+    Log::printf("    --color-bench         round trip every rgb color through each yuv matrix, report error and speed\n");
+    Log::printf("    --bench-codec FILE    save and load FILE as png and as qoi, report speed and size\n");
+    Log::printf("    --bench-math          time the batch transform math against the one at a time helpers\n");
+    Log::printf("    --sequence PATTERN [FIRST]\n");
+    Log::printf("                          stream numbered pngs, PATTERN is printf style (frames/f_%%04d.png), from FIRST (default 0)\n");
+    Log::printf("    --y4m-in FILE         stream frames from a y4m file, - for stdin\n");
+    Log::printf("    --y4m-out FILE        write the converted frames as y4m, - for stdout (messages then go to stderr)\n");
+    Log::printf("    --no-display          stream without a window, as fast as possible\n");
+    Log::printf("    --batch IN OUT        convert every png under IN to the same path under OUT, skipping unchanged files\n");
+    Log::printf("    --cache DIR           cache of converted pngs and the batch index (default OUT/.imgtoy_cache)\n");
+    Log::printf("    --archive FILE        load textures and shaders from a pack built with --pack before the disk, repeatable\n");
+    Log::printf("    --pack OUT IN...      pack the files and directories IN into the archive OUT\n");
+    Log::printf("    --pack-compression C  none, lz4 or zstd, whichever this build has (default lz4, then zstd)\n");
+    Log::printf("    --compare A B         max diff, psnr and ssim of two pngs, or of every png in two directories\n");
+    Log::printf("    --tolerance N         largest difference --compare accepts (default 0)\n");
+    Log::printf("    --progressive FILE    show FILE as soon as its smallest mip level is ready, finer levels follow\n");
+    Log::printf("    --upload-budget KB    texture upload budget per frame for --progressive, 0 for none (default 4096)\n");
+    Log::printf("    --push-png FILE       decode FILE as if it arrived over a slow link, showing rows as they decode\n");
+    Log::printf("    --push-rate KB        bytes of --push-png fed to the decoder per frame (default 64)\n");
+    Log::printf("    --mem-budget MB       warn with a memory report when images and textures together go over MB\n");
+    Log::printf("    --gpu-budget MB       warn with a memory report when textures go over MB\n");
+    Log::printf("    --mem-report          print current and peak memory of images and textures on exit\n");
+    Log::printf("    --hud                 draw frame time, throughput and memory in the window, h toggles it\n");
+    Log::printf("    --record OUT          record the window to OUT, a y4m file (- for stdout) or a png / qoi pattern (cap/f_%%05d.png)\n");
+    Log::printf("    --record-fps N        frame rate in the header of a --record y4m (default 60)\n");
+    Log::printf("    --quantize IN OUT     write IN as a palette png OUT, reporting sizes and psnr/ssim\n");
+    Log::printf("    --colors N            palette size for --quantize, 2 to 256 (default 256)\n");
+    Log::printf("    --dither D            none, ordered or fs (floyd-steinberg) for --quantize (default none)\n");
+    Log::printf("    --filter IN OUT SPEC  gaussian:SIGMA, binomial:3|5, box:RADIUS or sharpen:AMOUNT[:SIGMA]\n");
+    Log::printf("    --wrap MODE           edges for --filter, repeat, mirror, clamp or mirror-clamp (default clamp)\n");
+    Log::printf("    --lut FILE            grade with a .cube 3D lut before the yuv conversion\n");
+    Log::printf("    --lut-gpu             grade the window in the fragment shader instead of on the cpu\n");
+    Log::printf("    --grade IN OUT        grade IN through the --lut into OUT, reporting the time\n");
+    Log::printf("    --resample IN OUT WxH [FILTER]\n");
+    Log::printf("                          resize IN to OUT, FILTER is bilinear, bicubic or lanczos3 (default), jpegs decode pre-scaled\n");
+#ifdef IMGTOY_HEADLESS
+    Log::printf("    --headless out.png    render offscreen without a window, save the last frame\n");
+    Log::printf("    --frames N            number of frames to render and time in headless mode (default 100)\n");
+#endif
+}
+
+// stats for the hud, averaged over the time since the last refresh. fps 0 shows as unknown.
+std::string formatHudStats(const FrameTimer& timer, double fps, double frameMs, double hudMs)
+{
+    const double mb = 1.0 / (1024.0 * 1024.0);
+    char fpsText[32];
+    if (fps > 0.0)
+    {
+        snprintf(fpsText, sizeof(fpsText), "%.1f", fps);
+    }
+    else
+    {
+        snprintf(fpsText, sizeof(fpsText), "--");
+    }
+    char text[512];
+    snprintf(text, sizeof(text),
+             "%s fps  %.2f ms\n"
+             "cpu draw %.2f ms  gpu %.2f ms\n"
+             "mem %.1f MB  peak %.1f MB\n"
+             "gpu mem %.1f MB  peak %.1f MB\n"
+             "hud %.1f \xc2\xb5s",
+             fpsText, frameMs, timer.lastZoneMs[FrameTimer::DrawZone], timer.lastGpuMs,
+             MemTrack::GetTotalCurrent() * mb, MemTrack::GetTotalPeak() * mb,
+             MemTrack::GetCurrent(MemCategory::Texture) * mb, MemTrack::GetPeak(MemCategory::Texture) * mb, hudMs * 1000.0);
+    return text;
+}
+
+void printMemReport()
+{
+    Log::printf("memory:\n%s", MemTrack::Report().c_str());
+}
+
+int SDLCALL watch(void *userdata, SDL_Event* event)
+{
+    if (event->type == SDL_APP_WILLENTERBACKGROUND) {
+        quitting = true;
+    }
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int width = 512;
+    int height = 512;
+    SwapMode swapMode = SwapMode::VSync;
+    const char* timingReport = "frame_times.txt";
+    bool showHud = false;
+    const char* recordOutput = nullptr;
+    int recordFps = 60;
+    const char* streamInput = nullptr;
+    const char* streamOutput = nullptr;
+    int stripeRows = 64;
+    const char* filterInput = nullptr;
+    const char* filterOutput = nullptr;
+    const char* filterSpec = nullptr;
+    WrapType filterWrap = WrapType::ClampToEdge;
+    const char* lutFilename = nullptr;
+    bool lutGpu = false;
+    const char* gradeInput = nullptr;
+    const char* gradeOutput = nullptr;
+    const char* resampleInput = nullptr;
+    const char* resampleOutput = nullptr;
+    int resampleWidth = 0;
+    int resampleHeight = 0;
+    ResampleFilter resampleFilter = ResampleFilter::Lanczos3;
+    bool colorBench = false;
+    bool mathBench = false;
+    const char* codecBench = nullptr;
+    const char* compareA = nullptr;
+    const char* compareB = nullptr;
+    int compareTolerance = 0;
+    const char* batchInput = nullptr;
+    const char* batchOutput = nullptr;
+    const char* batchCache = nullptr;
+    const char* sequencePattern = nullptr;
+    int sequenceFirst = 0;
+    const char* y4mInput = nullptr;
+    const char* y4mOutput = nullptr;
+    bool display = true;
+    const char* progressiveInput = nullptr;
+    size_t uploadBudget = 4096 * 1024;
+    const char* pushInput = nullptr;
+    size_t pushRate = 64 * 1024;
+    const char* quantizeInput = nullptr;
+    const char* quantizeOutput = nullptr;
+    QuantizeOptions quantizeOptions;
+    std::vector<const char*> archives;
+    const char* packOutput = nullptr;
+    std::vector<std::string> packInputs;
+    ArchiveCompression packCompression = GetDefaultCompression();
+#ifdef IMGTOY_HEADLESS
+    const char* headlessOutput = nullptr;
+    int headlessFrames = 100;
+#endif
+
+    // a kiosk that runs out of memory says where it went.
+    MemTrack::InstallOutOfMemoryHandler();
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--vsync") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "on"))
+            {
+                swapMode = SwapMode::VSync;
+            }
+            else if (!strcmp(argv[i], "adaptive"))
+            {
+                swapMode = SwapMode::Adaptive;
+            }
+            else if (!strcmp(argv[i], "off"))
+            {
+                swapMode = SwapMode::Uncapped;
+            }
+            else
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--hud"))
+        {
+            showHud = true;
+        }
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+        {
+            recordOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--record-fps") && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], 1, 1000, &recordFps))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--timing-report") && i + 1 < argc)
+        {
+            timingReport = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--stream") && i + 2 < argc)
+        {
+            streamInput = argv[++i];
+            streamOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--filter") && i + 3 < argc)
+        {
+            filterInput = argv[++i];
+            filterOutput = argv[++i];
+            filterSpec = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--wrap") && i + 1 < argc)
+        {
+            if (!ParseWrapType(argv[++i], &filterWrap))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--lut") && i + 1 < argc)
+        {
+            lutFilename = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--lut-gpu"))
+        {
+            lutGpu = true;
+        }
+        else if (!strcmp(argv[i], "--grade") && i + 2 < argc)
+        {
+            gradeInput = argv[++i];
+            gradeOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--resample") && i + 3 < argc)
+        {
+            resampleInput = argv[++i];
+            resampleOutput = argv[++i];
+            if (sscanf(argv[++i], "%dx%d", &resampleWidth, &resampleHeight) != 2 || resampleWidth <= 0 || resampleHeight <= 0)
+            {
+                printUsage();
+                return 1;
+            }
+            if (i + 1 < argc && ParseResampleFilter(argv[i + 1], &resampleFilter))
+            {
+                i++;
+            }
+        }
+        else if (!strcmp(argv[i], "--standard") && i + 1 < argc)
+        {
+            if (!ParseColorStandard(argv[++i], &colorStandard))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--range") && i + 1 < argc)
+        {
+            if (!ParseColorRange(argv[++i], &colorRange))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--compare") && i + 2 < argc)
+        {
+            compareA = argv[++i];
+            compareB = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--batch") && i + 2 < argc)
+        {
+            batchInput = argv[++i];
+            batchOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--sequence") && i + 1 < argc)
+        {
+            sequencePattern = argv[++i];
+            if (i + 1 < argc && parseInt(argv[i + 1], 0, 1000000000, &sequenceFirst))
+            {
+                i++;
+            }
+        }
+        else if (!strcmp(argv[i], "--y4m-in") && i + 1 < argc)
+        {
+            y4mInput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--y4m-out") && i + 1 < argc)
+        {
+            y4mOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--no-display"))
+        {
+            display = false;
+        }
+        else if (!strcmp(argv[i], "--archive") && i + 1 < argc)
+        {
+            archives.push_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--pack") && i + 2 < argc)
+        {
+            packOutput = argv[++i];
+            while (i + 1 < argc && strncmp(argv[i + 1], "--", 2))
+            {
+                packInputs.push_back(argv[++i]);
+            }
+            if (packInputs.empty())
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--pack-compression") && i + 1 < argc)
+        {
+            if (!ParseArchiveCompression(argv[++i], &packCompression))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--cache") && i + 1 < argc)
+        {
+            batchCache = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], 0, 255, &compareTolerance))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--progressive") && i + 1 < argc)
+        {
+            progressiveInput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--upload-budget") && i + 1 < argc)
+        {
+            int kilobytes;
+            if (!parseInt(argv[++i], 0, 1024 * 1024, &kilobytes))
+            {
+                printUsage();
+                return 1;
+            }
+            uploadBudget = (size_t)kilobytes * 1024;
+        }
+        else if (!strcmp(argv[i], "--push-png") && i + 1 < argc)
+        {
+            pushInput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--push-rate") && i + 1 < argc)
+        {
+            // at least 1 KB, nothing pushed a frame would never finish the decode.
+            int kilobytes;
+            if (!parseInt(argv[++i], 1, 1024 * 1024, &kilobytes))
+            {
+                printUsage();
+                return 1;
+            }
+            pushRate = (size_t)kilobytes * 1024;
+        }
+        else if (!strcmp(argv[i], "--mem-budget") && i + 1 < argc)
+        {
+            size_t budget;
+            if (!parseMegabytes(argv[++i], &budget))
+            {
+                printUsage();
+                return 1;
+            }
+            MemTrack::SetTotalBudget(budget);
+        }
+        else if (!strcmp(argv[i], "--gpu-budget") && i + 1 < argc)
+        {
+            size_t budget;
+            if (!parseMegabytes(argv[++i], &budget))
+            {
+                printUsage();
+                return 1;
+            }
+            MemTrack::SetBudget(MemCategory::Texture, budget);
+        }
+        else if (!strcmp(argv[i], "--quantize") && i + 2 < argc)
+        {
+            quantizeInput = argv[++i];
+            quantizeOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--colors") && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], 2, 256, &quantizeOptions.maxColors))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--dither") && i + 1 < argc)
+        {
+            if (!ParseDitherType(argv[++i], &quantizeOptions.dither))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--mem-report"))
+        {
+            // atexit covers every mode, most of them return straight from their run function.
+            atexit(printMemReport);
+        }
+        else if (!strcmp(argv[i], "--stats"))
+        {
+            printStats = true;
+        }
+        else if (!strcmp(argv[i], "--bench-codec") && i + 1 < argc)
+        {
+            codecBench = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--bench-math"))
+        {
+            mathBench = true;
+        }
+        else if (!strcmp(argv[i], "--color-bench"))
+        {
+            colorBench = true;
+        }
+        else if (!strcmp(argv[i], "--stripe-rows") && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], 1, 1 << 20, &stripeRows))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+#ifdef IMGTOY_HEADLESS
+        else if (!strcmp(argv[i], "--headless") && i + 1 < argc)
+        {
+            headlessOutput = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], 1, 1000000, &headlessFrames))
+            {
+                printUsage();
+                return 1;
+            }
+        }
+#endif
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    // frames go to stdout, so everything else goes to stderr.
+    if ((y4mOutput && !strcmp(y4mOutput, "-")) || (recordOutput && !strcmp(recordOutput, "-")))
     {
-        s = l * 12.92f;
+        Log::output = stderr;
     }
-    else
+
+    if (packOutput)
     {
-        s = 1.055f * glm::pow(l, 1.0f/2.4f) - 0.055f;
+        return BuildArchive(packOutput, packInputs, packCompression) ? 0 : 1;
     }
-    return s * 255.0f;
-}
 
-void processImage(Image& img)
-{
-    // convert from RGB to YUV
+    // mounted before anything loads, later archives take precedence.
+    for (auto archive : archives)
+    {
+        if (!MountArchive(archive))
+        {
+            return 1;
+        }
+    }
 
-    // BT.709
-    for (uint32_t y = 0; y < img.height; y++)
+    // after the archives, a lut can come from a pack like any other file.
+    if (lutFilename)
     {
-        for (uint32_t x = 0; x < img.width; x++)
+        gradeLut = new CubeLut();
+        if (!gradeLut->Load(lutFilename))
         {
-            uint8_t* p = img.data.data() + y * img.width * 3 + x * 3;
+            return 1;
+        }
+    }
+
+    const bool streaming = sequencePattern || y4mInput;
+    if (streaming && !display)
+    {
+        return runStream(sequencePattern, sequenceFirst, y4mInput, y4mOutput);
+    }
+
+    if (batchInput)
+    {
+        return runBatch(batchInput, batchOutput, batchCache);
+    }
+
+    if (compareA)
+    {
+        return runCompare(compareA, compareB, compareTolerance);
+    }
+
+    if (colorBench)
+    {
+        return runColorBench();
+    }
 
-            float R = *p;
-            float G = *(p + 1);
-            float B = *(p + 2);
+    if (mathBench)
+    {
+        return runMathBench();
+    }
 
-            float Y = 16.0f + 0.0620071f * B + 0.614231f * G + 0.182586f * R;
-            float U = 128.0f + 0.439216f * B - 0.338572f * G - 0.100644f * R;
-            float V = 128.0f - 0.0402735f * B - 0.398942f * G + 0.439216f * R;
+    if (codecBench)
+    {
+        return runCodecBench(codecBench);
+    }
 
-            *p = (uint8_t)glm::clamp(Y, 0.0f, 255.0f);
-            *(p + 1) = (uint8_t)glm::clamp(U, 0.0f, 255.0f);
-            *(p + 2) = (uint8_t)glm::clamp(V, 0.0f, 255.0f);
+    if (streamInput)
+    {
+        // stats are gathered inside the conversion pass, one stripe at a time. stripes are read straight so the
+        // grade sees the same color as the other paths, and pre-multiplied after it.
+        ImageStats stats;
+        bool limitsSet = false;
+        auto process = [&](Image& stripe)
+        {
+            PixelPipeline pipeline;
+            addGradeStage(pipeline);
+            pipeline.Premultiply();
+            AddProcessStages(pipeline, stripe.pixelFormat, colorStandard, colorRange);
+            if (printStats)
+            {
+                if (!limitsSet)
+                {
+                    setProcessLimits(stats, stripe.pixelFormat);
+                    limitsSet = true;
+                }
+                pipeline.Stats(&stats);
+            }
+            pipeline.Execute(stripe);
+        };
+        if (!ConvertPNGStreaming(streamInput, streamOutput, process, (uint32_t)stripeRows, false))
+        {
+            Log::printf("Failed to convert \"%s\" to \"%s\"\n", streamInput, streamOutput);
+            return 1;
+        }
+        if (printStats)
+        {
+            Log::printf("%s", stats.Summary("yuv").c_str());
         }
+        return 0;
     }
 
-    /*
-    // apply 2.2 gamma to each pixel.
-    for (auto& i : img.data)
+    if (quantizeInput)
     {
-        i = (uint8_t)glm::clamp(linearToSRGB(i), 0.0f, 255.0f);
+        return runQuantize(quantizeInput, quantizeOutput, quantizeOptions);
     }
-    */
-}
 
-void dumpTable()
-{
-    Log::printf("static uint8_t table[256] =\n{\n");
-    for (int i = 0; i < 32; i++)
+    if (filterInput)
     {
-        Log::printf("    ");
-        for (int j = 0; j < 8; j++)
+        return runFilter(filterInput, filterOutput, filterSpec, filterWrap);
+    }
+
+    if (gradeInput)
+    {
+        if (!gradeLut)
         {
-            int ii = i * 8 + j;
-            uint8_t v = (uint8_t)glm::clamp(linearToSRGB((float)ii), 0.0f, 255.0f);
-            Log::printf("%d, ", v);
+            Log::printf("Error: --grade needs a --lut\n");
+            return 1;
         }
-        Log::printf("\n");
+        return runGrade(gradeInput, gradeOutput);
     }
-    Log::printf("};\n");
-}
 
-int SDLCALL watch(void *userdata, SDL_Event* event)
-{
-    if (event->type == SDL_APP_WILLENTERBACKGROUND) {
-        quitting = true;
+    if (resampleInput)
+    {
+        return runResample(resampleInput, resampleOutput, resampleWidth, resampleHeight, resampleFilter);
     }
 
-    return 1;
-}
+#ifdef IMGTOY_HEADLESS
+    if (headlessOutput)
+    {
+        return runHeadless(headlessOutput, headlessFrames, width, height);
+    }
+#endif
+
+    // only the window has a shader to grade in, everything above graded on the cpu.
+    gradeOnGpu = lutGpu && gradeLut;
+    if (gradeOnGpu && y4mOutput)
+    {
+        Log::printf("Error: --lut-gpu only grades the window, use --lut to grade --y4m-out frames\n");
+        return 1;
+    }
 
-int main(int argc, char *argv[])
-{
     if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_EVENTS) != 0)
     {
         SDL_Log("Failed to initialize SDL: %s", SDL_GetError());
         return 1;
     }
 
-    int width = 512;
-    int height = 512;
     window = SDL_CreateWindow("sdl2stub", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height, SDL_WINDOW_OPENGL);
 
     gl_context = SDL_GL_CreateContext(window);
@@ -143,29 +1440,124 @@ int main(int argc, char *argv[])
         SDL_Log("Error: %s\n", glewGetErrorString(err));
     }
 
-    Image img;
-    if (!img.Load("texture/T_VideoCallThumbnailYellow.png"))
-    {
-        Log::printf("failed to load img\n");
-    }
+    setSwapMode(swapMode);
 
-    processImage(img);
+    FrameTimer* frameTimer = new FrameTimer();
+    frameTimer->Init();
 
-    img.Save("texture/T_VideoCallThumbnailYellow_YUV.png");
+    // streamed frames replace the still image, the texture is created from the first one.
+    FrameStream* frameStream = nullptr;
+    Y4MWriter streamWriter;
+    YUVImage streamPacked;
+    bool streamReleased = false;
+    Texture* imgTexture = nullptr;
+    StreamingTexture* progressiveTexture = nullptr;
+    MappedFile pushFile;
+    size_t pushOffset = 0;
+    PNGPushDecoder pushDecoder;
+    std::chrono::steady_clock::time_point pushStart = std::chrono::steady_clock::now();
+    if (streaming)
+    {
+        frameStream = new FrameStream();
+        if (!openFrameStream(*frameStream, sequencePattern, sequenceFirst, y4mInput))
+        {
+            delete frameStream;
+            frameStream = nullptr;
+        }
+    }
+    else if (pushInput)
+    {
+        if (!pushFile.Open(pushInput) || !pushDecoder.Start())
+        {
+            Log::printf("Failed to open \"%s\"\n", pushInput);
+            pushInput = nullptr;
+        }
+    }
+    else if (progressiveInput)
+    {
+        Texture::Params texParams = {FilterType::LinearMipmapLinear, FilterType::Linear, WrapType::ClampToEdge, WrapType::ClampToEdge};
+        progressiveTexture = new StreamingTexture(progressiveInput, texParams);
+        imgTexture = &progressiveTexture->texture;
+    }
+    else
+    {
+        imgTexture = createImageTexture();
+    }
 
-    Texture::Params texParams = {FilterType::LinearMipmapLinear, FilterType::Linear, WrapType::ClampToEdge, WrapType::ClampToEdge};
-    static Texture* imgTexture = new Texture(img, texParams);
+    // with --lut-gpu the shader converts whatever the cpu would have, the still image and streamed frames.
+    const ColorMatrix rgbToYUV = MakeRGBToYUV(colorStandard, colorRange);
+    const ColorMatrix* shaderConvert = (streaming || (!pushInput && !progressiveInput)) ? &rgbToYUV : nullptr;
 
     // pre-multiplied alpha blending
     glEnable(GL_BLEND);
     glBlendEquation(GL_FUNC_ADD);
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
+    // tiny program, compiled synchronously, drawn until the real programs are ready.
+    Program* fallbackProgram = new Program();
+    fallbackProgram->Load("shader/flat_color_vert.glsl", "shader/flat_color_frag.glsl");
+
+    // if the driver can't compile in the background, do it on our own thread with a shared context.
+    bool driverParallelCompile = false;
+#ifdef GL_KHR_parallel_shader_compile
+    driverParallelCompile = GLEW_KHR_parallel_shader_compile;
+#endif
+    SDL_GLContext compileContext = nullptr;
+    if (!driverParallelCompile)
+    {
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        compileContext = SDL_GL_CreateContext(window);
+        SDL_GL_MakeCurrent(window, gl_context);
+        if (compileContext)
+        {
+            Program::InitAsyncCompile(window, compileContext);
+        }
+        else
+        {
+            Log::printf("Failed to create shader compile context: %s\n", SDL_GetError());
+        }
+    }
+
+    // submit every program up front, so startup waits on the slowest one instead of the sum.
     Program* imgProgram = new Program();
-    imgProgram->Load("shader/fullbright_texture_vert.glsl", "shader/fullbright_texture_frag.glsl");
+    LutTexture* lutTexture = nullptr;
+    if (gradeOnGpu)
+    {
+        lutTexture = new LutTexture(*gradeLut);
+        imgProgram->LoadAsync("shader/fullbright_texture_vert.glsl", "shader/grade_texture_frag.glsl");
+    }
+    else
+    {
+        imgProgram->LoadAsync("shader/fullbright_texture_vert.glsl", "shader/fullbright_texture_frag.glsl");
+    }
+    Hud* hud = new Hud();
+    hud->Init();
+
+    // the numbers only change a few times a second, so they stay readable and their glyphs stay cached.
+    const double HUD_REFRESH_MS = 250.0;
+    std::string hudStats;
+    std::chrono::steady_clock::time_point hudRefresh = std::chrono::steady_clock::now();
+    int hudFrames = 0;
+    double hudFrameMs = 0.0;
+    double hudDrawMs = 0.0;
+
+    FrameRecorder* recorder = nullptr;
+    if (recordOutput)
+    {
+        recorder = new FrameRecorder();
+        if (!recorder->Start(recordOutput, width, height, recordFps, 1, colorStandard, colorRange))
+        {
+            Log::printf("Failed to start recording to \"%s\"\n", recordOutput);
+            delete recorder;
+            recorder = nullptr;
+        }
+    }
 
     while (!quitting)
     {
+        frameTimer->BeginFrame();
+
+        frameTimer->BeginZone(FrameTimer::EventsZone);
         SDL_Event event;
         while (SDL_PollEvent(&event))
         {
@@ -182,10 +1574,17 @@ int main(int argc, char *argv[])
                 {
                     quitting = true;
                 }
+                else if (sym == SDLK_h)
+                {
+                    showHud = !showHud;
+                }
             }
         }
+        frameTimer->EndZone(FrameTimer::EventsZone);
 
+        frameTimer->BeginZone(FrameTimer::DrawZone);
         SDL_GL_MakeCurrent(window, gl_context);
+        frameTimer->BeginGpu();
         r = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
 
         glClearColor(r, 0.4f, 0.1f, 1.0f);
@@ -193,32 +1592,163 @@ int main(int argc, char *argv[])
 
         glm::mat4 projMat = glm::ortho(0.0f, (float)width, 0.0f, (float)height, -10.0f, 10.0f);
 
-        imgProgram->Apply();
-        imgProgram->SetUniform("modelViewProjMat", projMat);
-        imgProgram->SetUniform("color", glm::vec4(1.0f));
+        // at most one new frame per draw, the reader stays up to NUM_BUFFERS frames ahead.
+        StreamFrame* streamFrame = frameStream ? frameStream->TryAcquireFrame() : nullptr;
+        if (streamFrame)
+        {
+            if (y4mOutput && !writeStreamFrame(streamWriter, y4mOutput, *frameStream, streamFrame->image, streamPacked))
+            {
+                Log::printf("Failed to write frame %llu to \"%s\"\n", (unsigned long long)streamFrame->index, y4mOutput);
+                y4mOutput = nullptr;
+            }
+            if (!imgTexture)
+            {
+                Texture::Params texParams = {FilterType::Linear, FilterType::Linear, WrapType::ClampToEdge, WrapType::ClampToEdge};
+                imgTexture = new Texture(streamFrame->image, texParams);
+            }
+            else
+            {
+                imgTexture->Update(streamFrame->image);
+            }
+            frameStream->ReleaseFrame(streamFrame);
+        }
+        else if (frameStream && !streamReleased && frameStream->IsFinished())
+        {
+            // the last frame is on the gpu now, nothing reads the cpu copies again.
+            frameStream->Stop();
+            frameStream->ReleaseBuffers();
+            streamPacked.Release();
+            streamReleased = true;
+        }
 
-        // use texture unit 0 for colorTexture
-        imgTexture->Apply(0);
-        imgProgram->SetUniform("colorTexture", 0);
+        if (progressiveTexture)
+        {
+            progressiveTexture->Update(uploadBudget);
+        }
 
-        glm::vec2 xyLowerLeft(0.0f, (height - width) / 2.0f);
-        glm::vec2 xyUpperRight((float)width, (height + width) / 2.0f);
-        glm::vec2 uvLowerLeft(0.0f, 0.0f);
-        glm::vec2 uvUpperRight(1.0f, 1.0f);
+        // the file is mapped whole, pushing pushRate bytes a frame stands in for a slow source.
+        if (pushInput && pushOffset < pushFile.size && !pushDecoder.failed)
+        {
+            const size_t chunk = std::min(pushRate, pushFile.size - pushOffset);
+            pushDecoder.Push(pushFile.data + pushOffset, chunk);
+            pushOffset += chunk;
+            uint32_t firstRow, numRows;
+            if (pushDecoder.hasHeader && pushDecoder.TakeChangedRows(&firstRow, &numRows))
+            {
+                if (!imgTexture)
+                {
+                    Texture::Params texParams = {FilterType::Linear, FilterType::Linear, WrapType::ClampToEdge, WrapType::ClampToEdge};
+                    imgTexture = new Texture(pushDecoder.image, texParams);
+                }
+                else
+                {
+                    imgTexture->UpdateRows(pushDecoder.image, firstRow, numRows);
+                }
+            }
+            if (pushDecoder.complete)
+            {
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - pushStart;
+                Log::printf("\"%s\": decoded %u x %u from %zu bytes in %.1f ms\n", pushInput, pushDecoder.image.width,
+                            pushDecoder.image.height, pushOffset, elapsed.count());
+                pushDecoder.Close();
+                pushDecoder.image.Release();
+                pushFile.Close();
+                pushInput = nullptr;
+            }
+        }
 
-        glm::vec3 positions[] = {glm::vec3(xyLowerLeft, 0.0f), glm::vec3(xyUpperRight.x, xyLowerLeft.y, 0.0f),
-                                 glm::vec3(xyUpperRight, 0.0f), glm::vec3(xyLowerLeft.x, xyUpperRight.y, 0.0f)};
-        imgProgram->SetAttrib("position", positions);
+        if (imgProgram->IsReady() && imgTexture)
+        {
+            drawImage(imgProgram, imgTexture, width, height, lutTexture, shaderConvert);
+        }
+        else
+        {
+            fallbackProgram->Apply();
+            fallbackProgram->SetUniform("modelViewProjMat", projMat);
+            fallbackProgram->SetUniform("color", glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
+            drawQuad(fallbackProgram, width, height);
+        }
 
-        glm::vec2 uvs[] = {uvLowerLeft, glm::vec2(uvUpperRight.x, uvLowerLeft.y),
-                           uvUpperRight, glm::vec2(uvLowerLeft.x, uvUpperRight.y)};
-        imgProgram->SetAttrib("uv", uvs);
+        if (showHud)
+        {
+            auto hudStart = std::chrono::steady_clock::now();
+            hudFrames++;
+            hudFrameMs += frameTimer->lastFrameMs;
+            std::chrono::duration<double, std::milli> sinceRefresh = hudStart - hudRefresh;
+            if (sinceRefresh.count() >= HUD_REFRESH_MS || hudStats.empty())
+            {
+                // the first refresh comes right away, too soon after the start to count frames over.
+                const double fps = sinceRefresh.count() >= HUD_REFRESH_MS ? hudFrames * 1000.0 / sinceRefresh.count() : 0.0;
+                hudStats = formatHudStats(*frameTimer, fps, hudFrameMs / hudFrames, hudDrawMs / hudFrames);
+                hudRefresh = hudStart;
+                hudFrames = 0;
+                hudFrameMs = 0.0;
+                hudDrawMs = 0.0;
+            }
+            hud->Begin();
+            hud->Text(8.0f, 8.0f, hudStats);
+            hud->Draw(width, height);
+            std::chrono::duration<double, std::milli> hudElapsed = std::chrono::steady_clock::now() - hudStart;
+            hudDrawMs += hudElapsed.count();
+        }
 
-        const size_t NUM_INDICES = 6;
-        uint16_t indices[NUM_INDICES] = {0, 1, 2, 0, 2, 3};
-        glDrawElements(GL_TRIANGLES, NUM_INDICES, GL_UNSIGNED_SHORT, indices);
+        // everything is drawn, the hud included, so the recording matches the window.
+        if (recorder)
+        {
+            recorder->Capture();
+        }
+        frameTimer->EndGpu();
+        frameTimer->EndZone(FrameTimer::DrawZone);
 
+        frameTimer->BeginZone(FrameTimer::SwapZone);
         SDL_GL_SwapWindow(window);
+        frameTimer->EndZone(FrameTimer::SwapZone);
+    }
+
+    if (frameStream)
+    {
+        frameStream->Stop();
+        frameStream->PrintSummary();
+        delete frameStream;
+        if (streamWriter.fp)
+        {
+            streamWriter.Close();
+        }
+    }
+    if (progressiveTexture)
+    {
+        delete progressiveTexture;
+    }
+    else
+    {
+        delete imgTexture;
+    }
+
+    delete hud;
+    delete lutTexture;
+    delete gradeLut;
+
+    if (recorder)
+    {
+        if (!recorder->Stop())
+        {
+            Log::printf("Failed to write some recorded frames to \"%s\"\n", recordOutput);
+        }
+        recorder->PrintSummary();
+        delete recorder;
+    }
+
+    frameTimer->PrintSummary();
+    if (!frameTimer->SaveReport(timingReport))
+    {
+        Log::printf("Failed to write timing report \"%s\"\n", timingReport);
+    }
+    delete frameTimer;
+
+    Program::ShutdownAsyncCompile();
+    if (compileContext)
+    {
+        SDL_GL_DeleteContext(compileContext);
     }
 
     SDL_DelEventWatch(watch, NULL);
@@ -226,5 +1756,7 @@ int main(int argc, char *argv[])
     SDL_DestroyWindow(window);
     SDL_Quit();
 
+    UnmountArchives();
+
     return 0;
 }
@@ -0,0 +1,143 @@
+#include "memtrack.h"
+
+#include <atomic>
+#include <new>
+#include <stdio.h>
+
+#include "log.h"
+
+static const int NUM_CATEGORIES = (int)MemCategory::NUM_CATEGORIES;
+
+static const char* s_categoryNames[NUM_CATEGORIES] = {
+    "image",
+    "yuvimage",
+    "texture"
+};
+
+struct MemCounter
+{
+    std::atomic<size_t> current;
+    std::atomic<size_t> peak;
+    std::atomic<size_t> budget;
+};
+
+// zero initialized before any constructor runs, so allocations from static constructors are counted too.
+static MemCounter s_counters[NUM_CATEGORIES];
+static MemCounter s_total;
+static std::new_handler s_prevNewHandler = nullptr;
+
+static void RaisePeak(std::atomic<size_t>& peak, size_t value)
+{
+    size_t prev = peak.load(std::memory_order_relaxed);
+    while (prev < value && !peak.compare_exchange_weak(prev, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+// true when this allocation is the one that went over the budget.
+static bool Add(MemCounter& counter, size_t bytes)
+{
+    const size_t now = counter.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    RaisePeak(counter.peak, now);
+    const size_t budget = counter.budget.load(std::memory_order_relaxed);
+    return budget && now > budget && now - bytes <= budget;
+}
+
+static std::string FormatMB(size_t bytes)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%9.1f MB", bytes / (1024.0 * 1024.0));
+    return text;
+}
+
+static std::string FormatLine(const char* name, const MemCounter& counter)
+{
+    std::string line = name;
+    line.resize(10, ' ');
+    line += "current " + FormatMB(counter.current.load(std::memory_order_relaxed));
+    line += ", peak " + FormatMB(counter.peak.load(std::memory_order_relaxed));
+    const size_t budget = counter.budget.load(std::memory_order_relaxed);
+    if (budget)
+    {
+        line += ", budget " + FormatMB(budget);
+    }
+    return line + "\n";
+}
+
+void MemTrack::Alloc(MemCategory category, size_t bytes)
+{
+    const bool overCategory = Add(s_counters[(int)category], bytes);
+    const bool overTotal = Add(s_total, bytes);
+    if (overCategory || overTotal)
+    {
+        Log::printf("Warning: %s memory over budget\n%s", overCategory ? s_categoryNames[(int)category] : "total", Report().c_str());
+    }
+}
+
+void MemTrack::Free(MemCategory category, size_t bytes)
+{
+    s_counters[(int)category].current.fetch_sub(bytes, std::memory_order_relaxed);
+    s_total.current.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+size_t MemTrack::GetCurrent(MemCategory category)
+{
+    return s_counters[(int)category].current.load(std::memory_order_relaxed);
+}
+
+size_t MemTrack::GetPeak(MemCategory category)
+{
+    return s_counters[(int)category].peak.load(std::memory_order_relaxed);
+}
+
+size_t MemTrack::GetTotalCurrent()
+{
+    return s_total.current.load(std::memory_order_relaxed);
+}
+
+size_t MemTrack::GetTotalPeak()
+{
+    return s_total.peak.load(std::memory_order_relaxed);
+}
+
+void MemTrack::SetBudget(MemCategory category, size_t bytes)
+{
+    s_counters[(int)category].budget.store(bytes, std::memory_order_relaxed);
+}
+
+void MemTrack::SetTotalBudget(size_t bytes)
+{
+    s_total.budget.store(bytes, std::memory_order_relaxed);
+}
+
+std::string MemTrack::Report()
+{
+    std::string report;
+    for (int i = 0; i < NUM_CATEGORIES; i++)
+    {
+        report += FormatLine(s_categoryNames[i], s_counters[i]);
+    }
+    report += FormatLine("total", s_total);
+    return report;
+}
+
+static void OnOutOfMemory()
+{
+    // runs once, the report itself allocates, a second failure goes straight to the previous handler.
+    std::set_new_handler(s_prevNewHandler);
+    fprintf(Log::output, "Error: out of memory\n%s", MemTrack::Report().c_str());
+    if (!s_prevNewHandler)
+    {
+        throw std::bad_alloc();
+    }
+    s_prevNewHandler();
+}
+
+void MemTrack::InstallOutOfMemoryHandler()
+{
+    std::new_handler prev = std::set_new_handler(OnOutOfMemory);
+    if (prev != OnOutOfMemory)
+    {
+        s_prevNewHandler = prev;
+    }
+}
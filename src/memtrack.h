@@ -0,0 +1,79 @@
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class MemCategory {
+    Image = 0,  // Image pixels
+    YUVImage,   // YUVImage planes
+    Texture,    // gl textures and renderbuffers, estimated from size, format and mip chain
+    NUM_CATEGORIES
+};
+
+// Process wide byte counts of the big allocations, current and peak per category.
+// Counters are atomic, allocations can come from any thread.
+struct MemTrack
+{
+    static void Alloc(MemCategory category, size_t bytes);
+    static void Free(MemCategory category, size_t bytes);
+
+    static size_t GetCurrent(MemCategory category);
+    static size_t GetPeak(MemCategory category);
+    static size_t GetTotalCurrent();
+    static size_t GetTotalPeak();
+
+    // 0 means no budget. crossing a budget logs a warning with the Report, once per crossing.
+    static void SetBudget(MemCategory category, size_t bytes);
+    static void SetTotalBudget(size_t bytes);
+
+    // one line per category with current, peak and budget, then the totals.
+    static std::string Report();
+
+    // logs the Report when operator new runs out of memory, then lets the allocation throw as usual.
+    static void InstallOutOfMemoryHandler();
+};
+
+// std::allocator that counts its bytes in MemTrack.
+template <typename T, MemCategory CATEGORY>
+struct TrackingAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef TrackingAllocator<U, CATEGORY> other;
+    };
+
+    TrackingAllocator() {}
+    template <typename U>
+    TrackingAllocator(const TrackingAllocator<U, CATEGORY>&) {}
+
+    T* allocate(size_t n)
+    {
+        T* p = std::allocator<T>().allocate(n);
+        MemTrack::Alloc(CATEGORY, n * sizeof(T));
+        return p;
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        MemTrack::Free(CATEGORY, n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const TrackingAllocator<U, CATEGORY>&) const { return true; }
+    template <typename U>
+    bool operator!=(const TrackingAllocator<U, CATEGORY>&) const { return false; }
+};
+
+// byte vectors for pixel storage, they behave exactly like std::vector<uint8_t>.
+typedef std::vector<uint8_t, TrackingAllocator<uint8_t, MemCategory::Image>> ImageBuffer;
+typedef std::vector<uint8_t, TrackingAllocator<uint8_t, MemCategory::YUVImage>> YUVPlaneBuffer;
+
+#endif
@@ -0,0 +1,165 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ParallelJob
+{
+    const std::function<void(size_t, size_t)>* func;
+    size_t begin;
+    size_t end;
+    size_t chunkSize;
+    size_t numChunks;
+    std::atomic<size_t> nextChunk;
+    std::atomic<size_t> chunksDone;
+    int activeWorkers;  // guarded by ThreadPool::mutex
+};
+
+static thread_local bool t_insideParallelFor = false;
+
+static void RunChunks(ParallelJob& job)
+{
+    while (true)
+    {
+        size_t chunk = job.nextChunk.fetch_add(1);
+        if (chunk >= job.numChunks)
+        {
+            return;
+        }
+        size_t chunkBegin = job.begin + chunk * job.chunkSize;
+        size_t chunkEnd = std::min(job.end, chunkBegin + job.chunkSize);
+        (*job.func)(chunkBegin, chunkEnd);
+        job.chunksDone.fetch_add(1);
+    }
+}
+
+struct ThreadPool
+{
+    ThreadPool() : job(nullptr), generation(0), quit(false)
+    {
+        int numWorkers = (int)std::thread::hardware_concurrency() - 1;
+        for (int i = 0; i < numWorkers; i++)
+        {
+            workers.emplace_back([this] { WorkerMain(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wakeCond.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void WorkerMain()
+    {
+        t_insideParallelFor = true;
+        uint64_t seenGeneration = 0;
+        while (true)
+        {
+            ParallelJob* current = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeCond.wait(lock, [&] { return quit || (job && generation != seenGeneration); });
+                if (quit)
+                {
+                    return;
+                }
+                seenGeneration = generation;
+                current = job;
+                current->activeWorkers++;
+            }
+
+            RunChunks(*current);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                current->activeWorkers--;
+            }
+            doneCond.notify_all();
+        }
+    }
+
+    void Run(ParallelJob& newJob)
+    {
+        // one job at a time, other callers wait their turn.
+        std::lock_guard<std::mutex> callerLock(callerMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &newJob;
+            generation++;
+        }
+        wakeCond.notify_all();
+
+        t_insideParallelFor = true;
+        RunChunks(newJob);
+        t_insideParallelFor = false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCond.wait(lock, [&] { return newJob.chunksDone.load() == newJob.numChunks && newJob.activeWorkers == 0; });
+        job = nullptr;
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex callerMutex;
+    std::mutex mutex;
+    std::condition_variable wakeCond;
+    std::condition_variable doneCond;
+    ParallelJob* job;
+    uint64_t generation;
+    bool quit;
+};
+
+static ThreadPool& GetThreadPool()
+{
+    static ThreadPool s_pool;
+    return s_pool;
+}
+
+int GetNumThreads()
+{
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+void ParallelFor(size_t begin, size_t end, size_t grainSize, const std::function<void(size_t begin, size_t end)>& func)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    size_t count = end - begin;
+    grainSize = std::max<size_t>(grainSize, 1);
+
+    // a few chunks per thread evens out uneven work without much scheduling overhead.
+    size_t maxChunks = (size_t)GetNumThreads() * 4;
+    size_t chunkSize = std::max(grainSize, (count + maxChunks - 1) / maxChunks);
+    size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+    if (numChunks == 1 || GetNumThreads() == 1 || t_insideParallelFor)
+    {
+        func(begin, end);
+        return;
+    }
+
+    ParallelJob job;
+    job.func = &func;
+    job.begin = begin;
+    job.end = end;
+    job.chunkSize = chunkSize;
+    job.numChunks = numChunks;
+    job.nextChunk = 0;
+    job.chunksDone = 0;
+    job.activeWorkers = 0;
+    GetThreadPool().Run(job);
+}
@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+#include <stddef.h>
+
+// Splits [begin, end) into chunks of at least grainSize and runs them on a shared pool of worker threads.
+// The calling thread works on chunks too, and the call returns once every chunk is done.
+// Calls made from inside a chunk run serially on the calling thread.
+void ParallelFor(size_t begin, size_t end, size_t grainSize, const std::function<void(size_t begin, size_t end)>& func);
+
+// number of threads ParallelFor can use, including the caller.
+int GetNumThreads();
+
+#endif
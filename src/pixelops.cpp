@@ -0,0 +1,340 @@
+#include "pixelops.h"
+
+#include <mutex>
+#include <string.h>
+
+#include "cubelut.h"
+#include "image.h"
+#include "imagestats.h"
+#include "log.h"
+#include "parallel.h"
+
+// pixels per tile, 16 kb of RGBA, small enough that every stage finds the tile in L1/L2.
+static const size_t TILE_PIXELS = 4096;
+
+// s_premultiplyTable[alpha][color], the same float math as Image::MultiplyAlpha so results match exactly.
+static const uint8_t* GetPremultiplyTable()
+{
+    static std::vector<uint8_t> s_table;
+    static bool s_init = [] {
+        s_table.resize(256 * 256);
+        for (int a = 0; a < 256; a++)
+        {
+            float alpha = (float)a / 255.0f;
+            for (int c = 0; c < 256; c++)
+            {
+                float color = (float)c / 255.0f;
+                s_table[a * 256 + c] = (uint8_t)((color * alpha) * 255.0f);
+            }
+        }
+        return true;
+    }();
+    (void)s_init;
+    return s_table.data();
+}
+
+static PixelOp MakeOp(PixelOpType type)
+{
+    PixelOp op;
+    memset(&op, 0, sizeof(op));
+    op.type = type;
+    return op;
+}
+
+PixelPipeline& PixelPipeline::Premultiply()
+{
+    ops.push_back(MakeOp(PixelOpType::Premultiply));
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::Matrix(const ColorMatrix& matrix)
+{
+    PixelOp op = MakeOp(PixelOpType::Matrix);
+    op.matrix = matrix;
+    ops.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::Lut(const uint8_t table[256], uint8_t channelMask)
+{
+    PixelOp op = MakeOp(PixelOpType::Lut);
+    op.channelMask = channelMask;
+    for (int c = 0; c < 4; c++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            op.lut[c][i] = (channelMask & (1 << c)) ? table[i] : (uint8_t)i;
+        }
+    }
+    ops.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::Clamp(uint8_t minValue, uint8_t maxValue, uint8_t channelMask)
+{
+    PixelOp op = MakeOp(PixelOpType::Clamp);
+    op.clampMin = minValue;
+    op.clampMax = maxValue;
+    op.channelMask = channelMask;
+    ops.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::Swizzle(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    PixelOp op = MakeOp(PixelOpType::Swizzle);
+    op.swizzle[0] = r;
+    op.swizzle[1] = g;
+    op.swizzle[2] = b;
+    op.swizzle[3] = a;
+    ops.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::Lut3D(const CubeLut& lut)
+{
+    PixelOp op = MakeOp(PixelOpType::Lut3D);
+    op.cube = &lut;
+    ops.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::Stats(ImageStats* stats)
+{
+    PixelOp op = MakeOp(PixelOpType::Stats);
+    op.stats = stats;
+    ops.push_back(op);
+    return *this;
+}
+
+void PixelPipeline::Clear()
+{
+    ops.clear();
+}
+
+// clamps are just luts, so they can fold into their neighbours.
+static void ClampToLut(PixelOp& op)
+{
+    for (int c = 0; c < 4; c++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            uint8_t v = (uint8_t)i;
+            if (op.channelMask & (1 << c))
+            {
+                v = v < op.clampMin ? op.clampMin : (v > op.clampMax ? op.clampMax : v);
+            }
+            op.lut[c][i] = v;
+        }
+    }
+    op.type = PixelOpType::Lut;
+}
+
+// folds adjacent stages that compose into a single stage.
+static void FuseOps(const std::vector<PixelOp>& ops, std::vector<PixelOp>& fused)
+{
+    fused.clear();
+    for (const auto& in : ops)
+    {
+        PixelOp op = in;
+        if (op.type == PixelOpType::Clamp)
+        {
+            ClampToLut(op);
+        }
+
+        if (fused.empty() || fused.back().type != op.type)
+        {
+            fused.push_back(op);
+            continue;
+        }
+
+        PixelOp& prev = fused.back();
+        switch (op.type)
+        {
+        case PixelOpType::Matrix:
+            prev.matrix = MultiplyColorMatrix(op.matrix, prev.matrix);
+            break;
+        case PixelOpType::Lut:
+            for (int c = 0; c < 4; c++)
+            {
+                for (int i = 0; i < 256; i++)
+                {
+                    prev.lut[c][i] = op.lut[c][prev.lut[c][i]];
+                }
+            }
+            break;
+        case PixelOpType::Swizzle:
+        {
+            // out[c] = mid[op[c]] = in[prev[op[c]]]
+            uint8_t swizzle[4];
+            for (int c = 0; c < 4; c++)
+            {
+                swizzle[c] = prev.swizzle[op.swizzle[c] & 3];
+            }
+            memcpy(prev.swizzle, swizzle, sizeof(swizzle));
+            break;
+        }
+        default:
+            // premultiplying twice is not the same as once, 3D luts don't compose without resampling, and each
+            // stats stage has its own target, keep both.
+            fused.push_back(op);
+            break;
+        }
+    }
+}
+
+static void RunPremultiply(uint8_t* p, size_t numPixels, int pixelSize)
+{
+    if (pixelSize != 2 && pixelSize != 4)
+    {
+        return;
+    }
+
+    const uint8_t* table = GetPremultiplyTable();
+    const int alpha = pixelSize - 1;
+    for (size_t i = 0; i < numPixels; i++, p += pixelSize)
+    {
+        const uint8_t* row = table + p[alpha] * 256;
+        for (int c = 0; c < alpha; c++)
+        {
+            p[c] = row[p[c]];
+        }
+    }
+}
+
+static void RunLut(uint8_t* p, size_t numPixels, int pixelSize, const uint8_t (*lut)[256])
+{
+    if (pixelSize == 4)
+    {
+        for (size_t i = 0; i < numPixels; i++, p += 4)
+        {
+            p[0] = lut[0][p[0]];
+            p[1] = lut[1][p[1]];
+            p[2] = lut[2][p[2]];
+            p[3] = lut[3][p[3]];
+        }
+    }
+    else
+    {
+        // RA keeps alpha in its second byte, but the masks always call alpha channel 3.
+        const uint8_t* alphaLut = lut[3];
+        for (size_t i = 0; i < numPixels; i++, p += pixelSize)
+        {
+            for (int c = 0; c < pixelSize; c++)
+            {
+                p[c] = (pixelSize == 2 && c == 1) ? alphaLut[p[c]] : lut[c][p[c]];
+            }
+        }
+    }
+}
+
+static void RunSwizzle(uint8_t* p, size_t numPixels, int pixelSize, const uint8_t* swizzle)
+{
+    uint8_t tmp[4];
+    for (size_t i = 0; i < numPixels; i++, p += pixelSize)
+    {
+        memcpy(tmp, p, pixelSize);
+        for (int c = 0; c < pixelSize; c++)
+        {
+            p[c] = tmp[swizzle[c]];
+        }
+    }
+}
+
+bool PixelPipeline::Execute(Image& img) const
+{
+    const int pixelSize = (int)img.GetPixelSize();
+    const size_t numPixels = (size_t)img.width * img.height;
+    if (ops.empty() || numPixels == 0)
+    {
+        return true;
+    }
+
+    for (const auto& op : ops)
+    {
+        if (op.type == PixelOpType::Matrix && pixelSize < 3)
+        {
+            Log::printf("Error: color matrix needs an RGB or RGBA image\n");
+            return false;
+        }
+        if (op.type == PixelOpType::Lut3D && (pixelSize < 3 || op.cube->size < CubeLut::MIN_SIZE))
+        {
+            Log::printf("Error: 3D lut needs a loaded lut and an RGB or RGBA image\n");
+            return false;
+        }
+        if (op.type == PixelOpType::Swizzle)
+        {
+            for (int c = 0; c < pixelSize; c++)
+            {
+                if (op.swizzle[c] >= pixelSize)
+                {
+                    Log::printf("Error: swizzle reads channel %d of a %d channel image\n", op.swizzle[c], pixelSize);
+                    return false;
+                }
+            }
+        }
+    }
+
+    std::vector<PixelOp> fused;
+    FuseOps(ops, fused);
+
+    int numStats = 0;
+    for (const auto& op : fused)
+    {
+        numStats += op.type == PixelOpType::Stats ? 1 : 0;
+    }
+
+    uint8_t* pixels = img.data.data();
+    std::mutex statsMutex;
+    ParallelFor(0, numPixels, TILE_PIXELS * 4, [&](size_t begin, size_t end)
+    {
+        // per-chunk partials, merged once the chunk is done.
+        std::vector<StatsAccumulator> partials(numStats);
+        for (size_t tile = begin; tile < end; tile += TILE_PIXELS)
+        {
+            size_t count = end - tile < TILE_PIXELS ? end - tile : TILE_PIXELS;
+            uint8_t* p = pixels + tile * pixelSize;
+            int statsIndex = 0;
+            for (const auto& op : fused)
+            {
+                switch (op.type)
+                {
+                case PixelOpType::Premultiply:
+                    RunPremultiply(p, count, pixelSize);
+                    break;
+                case PixelOpType::Matrix:
+                    ApplyColorMatrix(p, count, pixelSize, op.matrix);
+                    break;
+                case PixelOpType::Lut:
+                    RunLut(p, count, pixelSize, op.lut);
+                    break;
+                case PixelOpType::Swizzle:
+                    RunSwizzle(p, count, pixelSize, op.swizzle);
+                    break;
+                case PixelOpType::Lut3D:
+                    op.cube->Apply(p, count, pixelSize);
+                    break;
+                case PixelOpType::Stats:
+                    partials[statsIndex++].Add(p, count, pixelSize);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        if (numStats > 0)
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            int statsIndex = 0;
+            for (const auto& op : fused)
+            {
+                if (op.type == PixelOpType::Stats)
+                {
+                    partials[statsIndex++].Flush(*op.stats);
+                }
+            }
+        }
+    });
+    return true;
+}
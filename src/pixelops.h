@@ -0,0 +1,71 @@
+#ifndef PIXELOPS_H
+#define PIXELOPS_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "colormatrix.h"
+
+struct CubeLut;
+struct Image;
+struct ImageStats;
+
+enum class PixelOpType {
+    Premultiply = 0,
+    Matrix,
+    Lut,
+    Clamp,
+    Swizzle,
+    Lut3D,
+    Stats
+};
+
+// one recorded stage, only the members used by its type are meaningful.
+struct PixelOp
+{
+    PixelOpType type;
+    ColorMatrix matrix;
+    uint8_t lut[4][256];   // per channel, channels not in the mask map to themselves
+    uint8_t clampMin;
+    uint8_t clampMax;
+    uint8_t channelMask;   // bits are r, g, b, a, R/RA images use bit 0 for intensity and bit 3 for alpha
+    uint8_t swizzle[4];    // out[c] = in[swizzle[c]]
+    const CubeLut* cube;
+    ImageStats* stats;
+};
+
+// Records per-pixel operations and runs them all in one pass over the image.
+// Execute walks the image a tile at a time and applies every stage to a tile while it is still in cache,
+// so a chain of stages costs about one trip through memory instead of one per stage.
+// Adjacent stages are folded together first: clamps become luts, adjacent luts and adjacent swizzles compose,
+// and adjacent matrices multiply into one (so there is no clamp or rounding between them).
+struct PixelPipeline
+{
+    // multiplies color by alpha, same as Image::MultiplyAlpha, does nothing for R and RGB.
+    PixelPipeline& Premultiply();
+
+    // RGB and RGBA only, alpha is left alone.
+    PixelPipeline& Matrix(const ColorMatrix& matrix);
+
+    // the default masks leave alpha alone for Lut and include it for Clamp.
+    PixelPipeline& Lut(const uint8_t table[256], uint8_t channelMask = 0x7);
+    PixelPipeline& Clamp(uint8_t minValue, uint8_t maxValue, uint8_t channelMask = 0xf);
+
+    // out[c] = in[order[c]], for the channels the image has.
+    PixelPipeline& Swizzle(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+
+    // grades RGB through a 3D lut with tetrahedral interpolation, alpha is left alone. RGB and RGBA only, and
+    // straight color, so it goes before Premultiply. lut is not copied and has to outlive Execute.
+    PixelPipeline& Lut3D(const CubeLut& lut);
+
+    // adds the pixels as they are at this point of the pipeline to stats, which is not cleared first.
+    // the histograms are taken while the tile is in cache, so they cost no extra memory traffic.
+    PixelPipeline& Stats(ImageStats* stats);
+
+    bool Execute(Image& img) const;
+    void Clear();
+
+    std::vector<PixelOp> ops;
+};
+
+#endif
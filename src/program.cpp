@@ -1,10 +1,16 @@
 #include "program.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <GL/glew.h>
+#include <SDL2/SDL.h>
 #define GL_GLEXT_PROTOTYPES 1
 #include <SDL2/SDL_opengl.h>
 #include <SDL2/SDL_opengl_glext.h>
@@ -25,14 +31,8 @@ static void DumpShaderSource(const std::string& source)
     Log::printf("\n");
 }
 
-static bool CompileShader(GLenum type, const std::string& source, GLint* shaderOut)
+static bool CheckShader(GLint shader, const std::string& source)
 {
-    GLint shader = glCreateShader(type);
-    int size = static_cast<int>(source.size());
-    const GLchar* sourcePtr = source.c_str();
-    glShaderSource(shader, 1, (const GLchar**)&sourcePtr, &size);
-    glCompileShader(shader);
-
     GLint compiled;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
     if (!compiled)
@@ -50,29 +50,206 @@ static bool CompileShader(GLenum type, const std::string& source, GLint* shaderO
         }
         return false;
     }
+    return true;
+}
+
+// issues the compile, but does not wait for the result.
+static GLint SubmitShader(GLenum type, const std::string& source)
+{
+    GLint shader = glCreateShader(type);
+    int size = static_cast<int>(source.size());
+    const GLchar* sourcePtr = source.c_str();
+    glShaderSource(shader, 1, (const GLchar**)&sourcePtr, &size);
+    glCompileShader(shader);
+    return shader;
+}
+
+static bool CompileShader(GLenum type, const std::string& source, GLint* shaderOut)
+{
+    GLint shader = SubmitShader(type, source);
+    if (!CheckShader(shader, source))
+    {
+        return false;
+    }
     *shaderOut = shader;
     return true;
 }
 
-Program::Program() : program(0), vertShader(0), fragShader(0)
+//
+// async compilation
+//
+
+struct Program::AsyncJob
+{
+    enum Status
+    {
+        Pending = 0,
+        Done,
+        Abandoned
+    };
+
+    std::string vertFilename;
+    std::string fragFilename;
+    std::string vertSource;
+    std::string fragSource;
+    GLint program = 0;
+    GLint vertShader = 0;
+    GLint fragShader = 0;
+    bool onWorker = false;
+
+    // only used by jobs on the worker thread
+    std::atomic<int> status{Pending};
+};
+
+static void SubmitJob(Program::AsyncJob& job)
+{
+    job.vertShader = SubmitShader(GL_VERTEX_SHADER, job.vertSource);
+    job.fragShader = SubmitShader(GL_FRAGMENT_SHADER, job.fragSource);
+    job.program = glCreateProgram();
+    glAttachShader(job.program, job.vertShader);
+    glAttachShader(job.program, job.fragShader);
+    glLinkProgram(job.program);
+}
+
+static void DeleteJobObjects(Program::AsyncJob& job)
+{
+    glDeleteShader(job.vertShader);
+    glDeleteShader(job.fragShader);
+    glDeleteProgram(job.program);
+}
+
+static std::thread s_compileThread;
+static std::mutex s_compileMutex;
+static std::condition_variable s_compileCond;
+static std::deque<std::shared_ptr<Program::AsyncJob>> s_compileQueue;
+static bool s_compileQuit = false;
+static bool s_compileThreadRunning = false;
+
+static void CompileThreadMain(SDL_Window* window, SDL_GLContext context)
+{
+    SDL_GL_MakeCurrent(window, context);
+    while (true)
+    {
+        std::shared_ptr<Program::AsyncJob> job;
+        {
+            std::unique_lock<std::mutex> lock(s_compileMutex);
+            s_compileCond.wait(lock, [] { return s_compileQuit || !s_compileQueue.empty(); });
+            if (s_compileQueue.empty())
+            {
+                break;
+            }
+            job = s_compileQueue.front();
+            s_compileQueue.pop_front();
+        }
+
+        SubmitJob(*job);
+
+        // only this thread waits on the driver, the status is re-read by the render thread in IsReady()
+        GLint linked;
+        glGetProgramiv(job->program, GL_LINK_STATUS, &linked);
+
+        // objects must be complete before another context in the share group can use them.
+        glFinish();
+
+        int expected = Program::AsyncJob::Pending;
+        if (!job->status.compare_exchange_strong(expected, Program::AsyncJob::Done))
+        {
+            // program was released while we were compiling
+            DeleteJobObjects(*job);
+        }
+    }
+    SDL_GL_MakeCurrent(window, nullptr);
+}
+
+void Program::InitAsyncCompile(SDL_Window* window, void* glContext)
+{
+    if (s_compileThreadRunning)
+    {
+        return;
+    }
+    s_compileQuit = false;
+    s_compileThread = std::thread(CompileThreadMain, window, (SDL_GLContext)glContext);
+    s_compileThreadRunning = true;
+}
+
+void Program::ShutdownAsyncCompile()
+{
+    if (!s_compileThreadRunning)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(s_compileMutex);
+        s_compileQuit = true;
+    }
+    s_compileCond.notify_one();
+    s_compileThread.join();
+    s_compileThreadRunning = false;
+}
+
+static bool UseParallelShaderCompile()
+{
+#ifdef GL_KHR_parallel_shader_compile
+    if (GLEW_KHR_parallel_shader_compile)
+    {
+        static bool s_threadsSet = false;
+        if (!s_threadsSet)
+        {
+            // let the driver pick how many threads to use.
+            glMaxShaderCompilerThreadsKHR(0xffffffff);
+            s_threadsSet = true;
+        }
+        return true;
+    }
+#endif
+    return false;
+}
+
+Program::Program() : program(0), vertShader(0), fragShader(0), state(State::Empty)
 {
 }
 
 Program::~Program()
 {
-    glDeleteShader(vertShader);
-    glDeleteShader(fragShader);
-    glDeleteProgram(program);
+    Release();
 }
 
-bool Program::Load(const std::string& vertFilename, const std::string& fragFilename)
+void Program::Release()
 {
+    if (asyncJob)
+    {
+        if (asyncJob->onWorker)
+        {
+            int expected = AsyncJob::Pending;
+            if (!asyncJob->status.compare_exchange_strong(expected, AsyncJob::Abandoned))
+            {
+                // worker already finished, so the objects are ours to delete.
+                DeleteJobObjects(*asyncJob);
+            }
+        }
+        else
+        {
+            DeleteJobObjects(*asyncJob);
+        }
+        asyncJob.reset();
+    }
+
     glDeleteShader(vertShader);
     glDeleteShader(fragShader);
     glDeleteProgram(program);
+    program = 0;
+    vertShader = 0;
+    fragShader = 0;
+    state = State::Empty;
 
     uniforms.clear();
     attribs.clear();
+}
+
+bool Program::Load(const std::string& vertFilename, const std::string& fragFilename)
+{
+    Release();
+    state = State::Failed;
 
     std::string vertSource, fragSource;
     if (!LoadFile(vertFilename, vertSource))
@@ -104,6 +281,115 @@ bool Program::Load(const std::string& vertFilename, const std::string& fragFilen
     glAttachShader(program, fragShader);
     glLinkProgram(program);
 
+    if (!FinishLink(vertFilename, fragFilename, vertSource, fragSource))
+    {
+        return false;
+    }
+    state = State::Ready;
+    return true;
+}
+
+bool Program::LoadAsync(const std::string& vertFilename, const std::string& fragFilename)
+{
+    Release();
+    state = State::Failed;
+
+    std::shared_ptr<AsyncJob> job = std::make_shared<AsyncJob>();
+    job->vertFilename = vertFilename;
+    job->fragFilename = fragFilename;
+    if (!LoadFile(vertFilename, job->vertSource))
+    {
+        Log::printf("Failed to load vertex shader %s\n", vertFilename.c_str());
+        return false;
+    }
+
+    if (!LoadFile(fragFilename, job->fragSource))
+    {
+        Log::printf("Failed to load fragment shader %s\n", fragFilename.c_str());
+        return false;
+    }
+
+    if (!UseParallelShaderCompile() && s_compileThreadRunning)
+    {
+        job->onWorker = true;
+        {
+            std::lock_guard<std::mutex> lock(s_compileMutex);
+            s_compileQueue.push_back(job);
+        }
+        s_compileCond.notify_one();
+    }
+    else
+    {
+        // with KHR_parallel_shader_compile this returns immediately,
+        // without it we at least avoid querying status until the first IsReady().
+        SubmitJob(*job);
+    }
+
+    asyncJob = job;
+    state = State::Pending;
+    return true;
+}
+
+bool Program::IsReady()
+{
+    if (state != State::Pending)
+    {
+        return state == State::Ready;
+    }
+
+    if (asyncJob->onWorker)
+    {
+        if (asyncJob->status.load() != AsyncJob::Done)
+        {
+            return false;
+        }
+    }
+#ifdef GL_KHR_parallel_shader_compile
+    else if (GLEW_KHR_parallel_shader_compile)
+    {
+        GLint complete = GL_FALSE;
+        glGetProgramiv(asyncJob->program, GL_COMPLETION_STATUS_KHR, &complete);
+        if (!complete)
+        {
+            return false;
+        }
+    }
+#endif
+
+    // take ownership of the gl objects
+    std::shared_ptr<AsyncJob> job = asyncJob;
+    asyncJob.reset();
+    program = job->program;
+    vertShader = job->vertShader;
+    fragShader = job->fragShader;
+
+    if (!CheckShader(vertShader, job->vertSource))
+    {
+        Log::printf("Failed to compile vertex shader %s\n", job->vertFilename.c_str());
+        state = State::Failed;
+        return false;
+    }
+
+    if (!CheckShader(fragShader, job->fragSource))
+    {
+        Log::printf("Failed to compile fragment shader %s\n", job->fragFilename.c_str());
+        state = State::Failed;
+        return false;
+    }
+
+    if (!FinishLink(job->vertFilename, job->fragFilename, job->vertSource, job->fragSource))
+    {
+        state = State::Failed;
+        return false;
+    }
+
+    state = State::Ready;
+    return true;
+}
+
+bool Program::FinishLink(const std::string& vertFilename, const std::string& fragFilename,
+                         const std::string& vertSource, const std::string& fragSource)
+{
     GLint linked;
     glGetProgramiv(program, GL_LINK_STATUS, &linked);
     if (!linked)
@@ -2,14 +2,32 @@
 #define PROGRAM_H
 
 #include <iostream>
+#include <memory>
 #include <unordered_map>
 #include <glm/glm.hpp>
 
+struct SDL_Window;
+
 struct Program
 {
     Program();
     ~Program();
     bool Load(const std::string& vertFilename, const std::string& fragFilename);
+
+    // Submits compile and link but does not wait for the driver to finish.
+    // Poll IsReady() each frame, and keep drawing with a fallback program until it returns true.
+    // Uses GL_KHR_parallel_shader_compile when available, otherwise the async compile thread
+    // (see InitAsyncCompile), otherwise the status query is just deferred until the first poll.
+    bool LoadAsync(const std::string& vertFilename, const std::string& fragFilename);
+    bool IsReady();
+    bool IsPending() const { return state == State::Pending; }
+    bool HasFailed() const { return state == State::Failed; }
+
+    // glContext must be an SDL_GLContext created with SDL_GL_SHARE_WITH_CURRENT_CONTEXT.
+    // It is made current on a worker thread which performs compiles when KHR_parallel_shader_compile is missing.
+    static void InitAsyncCompile(SDL_Window* window, void* glContext);
+    static void ShutdownAsyncCompile();
+
     void Apply() const;
 
     int GetUniformLoc(const std::string& name) const;
@@ -55,9 +73,18 @@ struct Program
     void SetAttrib(int loc, glm::vec3* values, size_t stride = 0) const;
     void SetAttrib(int loc, glm::vec4* values, size_t stride = 0) const;
 
+    enum class State
+    {
+        Empty = 0,
+        Pending,
+        Ready,
+        Failed
+    };
+
     int program;
     int vertShader;
     int fragShader;
+    State state;
 
     struct Variable
     {
@@ -69,6 +96,13 @@ struct Program
     std::unordered_map<std::string, Variable> uniforms;
     std::unordered_map<std::string, Variable> attribs;
     std::string debugName;
+
+    struct AsyncJob;
+    std::shared_ptr<AsyncJob> asyncJob;
+
+    void Release();
+    bool FinishLink(const std::string& vertFilename, const std::string& fragFilename,
+                    const std::string& vertSource, const std::string& fragSource);
 };
 
 #endif
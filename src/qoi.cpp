@@ -0,0 +1,310 @@
+#include "qoi.h"
+
+#include <string.h>
+
+#include "image.h"
+#include "log.h"
+
+static const uint8_t OP_INDEX = 0x00;  // 00xxxxxx
+static const uint8_t OP_DIFF = 0x40;   // 01xxxxxx
+static const uint8_t OP_LUMA = 0x80;   // 10xxxxxx
+static const uint8_t OP_RUN = 0xc0;    // 11xxxxxx
+static const uint8_t OP_RGB = 0xfe;
+static const uint8_t OP_RGBA = 0xff;
+static const uint8_t OP_MASK = 0xc0;
+
+static const size_t HEADER_SIZE = 14;
+static const uint8_t s_endMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// the limit of the reference implementation, keeps width * height * 5 well inside size_t on 32 bit.
+static const uint64_t MAX_PIXELS = 400000000;
+
+// worst case is an OP_RGBA for every pixel
+static const size_t MAX_BYTES_PER_PIXEL = 5;
+
+static inline uint32_t Hash(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+    return (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+}
+
+static inline void WriteBE32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static inline uint32_t ReadBE32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+bool IsQOI(const uint8_t* bytes, size_t size)
+{
+    return size >= 4 && !memcmp(bytes, "qoif", 4);
+}
+
+// CHANNELS is a template parameter so the per pixel loads and stores compile down to straight line code,
+// the only data dependent branches left are the op choices.
+template <int CHANNELS>
+static uint8_t* EncodePixels(const Image& image, uint8_t* out)
+{
+    uint32_t index[64] = {};
+    uint32_t prev = 0xff000000;  // r, g, b = 0, a = 255
+    int run = 0;
+
+    const size_t rowSize = (size_t)image.width * CHANNELS;
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        // qoi rows are top to bottom
+        const uint8_t* src = image.data.data() + (size_t)(image.height - 1 - y) * rowSize;
+        for (uint32_t x = 0; x < image.width; x++, src += CHANNELS)
+        {
+            const uint32_t r = src[0];
+            const uint32_t g = CHANNELS >= 3 ? src[1] : r;
+            const uint32_t b = CHANNELS >= 3 ? src[2] : r;
+            const uint32_t a = CHANNELS == 4 ? src[3] : (CHANNELS == 2 ? src[1] : 255);
+            const uint32_t px = r | (g << 8) | (b << 16) | (a << 24);
+
+            if (px == prev)
+            {
+                if (++run == 62)
+                {
+                    *out++ = OP_RUN | 61;
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                *out++ = (uint8_t)(OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            const uint32_t hash = Hash(r, g, b, a);
+            if (index[hash] == px)
+            {
+                *out++ = (uint8_t)(OP_INDEX | hash);
+            }
+            else if (a != (prev >> 24))
+            {
+                index[hash] = px;
+                out[0] = OP_RGBA;
+                out[1] = (uint8_t)r;
+                out[2] = (uint8_t)g;
+                out[3] = (uint8_t)b;
+                out[4] = (uint8_t)a;
+                out += 5;
+            }
+            else
+            {
+                index[hash] = px;
+                // differences wrap around, as in the spec
+                const int vr = (int8_t)(r - (prev & 0xff));
+                const int vg = (int8_t)(g - ((prev >> 8) & 0xff));
+                const int vb = (int8_t)(b - ((prev >> 16) & 0xff));
+                const int vgr = vr - vg;
+                const int vgb = vb - vg;
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                {
+                    *out++ = (uint8_t)(OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                }
+                else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                {
+                    out[0] = (uint8_t)(OP_LUMA | (vg + 32));
+                    out[1] = (uint8_t)(((vgr + 8) << 4) | (vgb + 8));
+                    out += 2;
+                }
+                else
+                {
+                    out[0] = OP_RGB;
+                    out[1] = (uint8_t)r;
+                    out[2] = (uint8_t)g;
+                    out[3] = (uint8_t)b;
+                    out += 4;
+                }
+            }
+            prev = px;
+        }
+    }
+    if (run > 0)
+    {
+        *out++ = (uint8_t)(OP_RUN | (run - 1));
+    }
+    return out;
+}
+
+bool EncodeQOI(const Image& image, std::vector<uint8_t>& out)
+{
+    const uint64_t numPixels = (uint64_t)image.width * image.height;
+    if (numPixels == 0 || numPixels > MAX_PIXELS)
+    {
+        Log::printf("Error: can't encode a %u x %u image as qoi\n", image.width, image.height);
+        return false;
+    }
+
+    const int channels = (int)image.GetPixelSize();
+    out.resize(HEADER_SIZE + (size_t)numPixels * MAX_BYTES_PER_PIXEL + sizeof(s_endMarker));
+    uint8_t* p = out.data();
+    memcpy(p, "qoif", 4);
+    WriteBE32(p + 4, image.width);
+    WriteBE32(p + 8, image.height);
+    p[12] = (uint8_t)channels;
+    p[13] = 0;  // sRGB with linear alpha
+    p += HEADER_SIZE;
+
+    switch (channels)
+    {
+    case 1:
+        p = EncodePixels<1>(image, p);
+        break;
+    case 2:
+        p = EncodePixels<2>(image, p);
+        break;
+    case 3:
+        p = EncodePixels<3>(image, p);
+        break;
+    default:
+        p = EncodePixels<4>(image, p);
+        break;
+    }
+
+    memcpy(p, s_endMarker, sizeof(s_endMarker));
+    p += sizeof(s_endMarker);
+    out.resize(p - out.data());
+    return true;
+}
+
+template <int CHANNELS>
+static void DecodePixels(const uint8_t* bytes, size_t size, Image& image)
+{
+    uint8_t index[64][4] = {};
+    uint8_t r = 0, g = 0, b = 0, a = 255;
+    int run = 0;
+
+    // every op is at most 5 bytes and the end marker is 8, so no read inside the loop can pass the end.
+    // a truncated stream repeats its last pixel, like the reference decoder.
+    size_t p = HEADER_SIZE;
+    const size_t chunksEnd = size - sizeof(s_endMarker);
+
+    const size_t rowSize = (size_t)image.width * CHANNELS;
+    for (uint32_t y = 0; y < image.height; y++)
+    {
+        uint8_t* dst = image.data.data() + (size_t)(image.height - 1 - y) * rowSize;
+        for (uint32_t x = 0; x < image.width; x++, dst += CHANNELS)
+        {
+            if (run > 0)
+            {
+                run--;
+            }
+            else if (p < chunksEnd)
+            {
+                const uint8_t op = bytes[p++];
+                if (op == OP_RGB)
+                {
+                    r = bytes[p];
+                    g = bytes[p + 1];
+                    b = bytes[p + 2];
+                    p += 3;
+                }
+                else if (op == OP_RGBA)
+                {
+                    r = bytes[p];
+                    g = bytes[p + 1];
+                    b = bytes[p + 2];
+                    a = bytes[p + 3];
+                    p += 4;
+                }
+                else if ((op & OP_MASK) == OP_INDEX)
+                {
+                    r = index[op][0];
+                    g = index[op][1];
+                    b = index[op][2];
+                    a = index[op][3];
+                }
+                else if ((op & OP_MASK) == OP_DIFF)
+                {
+                    r += ((op >> 4) & 3) - 2;
+                    g += ((op >> 2) & 3) - 2;
+                    b += (op & 3) - 2;
+                }
+                else if ((op & OP_MASK) == OP_LUMA)
+                {
+                    const uint8_t next = bytes[p++];
+                    const int vg = (op & 0x3f) - 32;
+                    r += vg - 8 + ((next >> 4) & 0xf);
+                    g += vg;
+                    b += vg - 8 + (next & 0xf);
+                }
+                else
+                {
+                    run = op & 0x3f;
+                }
+
+                uint8_t* entry = index[Hash(r, g, b, a)];
+                entry[0] = r;
+                entry[1] = g;
+                entry[2] = b;
+                entry[3] = a;
+            }
+
+            dst[0] = r;
+            if (CHANNELS == 2)
+            {
+                dst[1] = a;
+            }
+            if (CHANNELS >= 3)
+            {
+                dst[1] = g;
+                dst[2] = b;
+            }
+            if (CHANNELS == 4)
+            {
+                dst[3] = a;
+            }
+        }
+    }
+}
+
+bool DecodeQOI(const uint8_t* bytes, size_t size, Image& image)
+{
+    if (size < HEADER_SIZE + sizeof(s_endMarker) || !IsQOI(bytes, size))
+    {
+        Log::printf("Error: not a qoi file\n");
+        return false;
+    }
+
+    const uint32_t width = ReadBE32(bytes + 4);
+    const uint32_t height = ReadBE32(bytes + 8);
+    const int channels = bytes[12];
+    const uint64_t numPixels = (uint64_t)width * height;
+    if (numPixels == 0 || numPixels > MAX_PIXELS || channels < 1 || channels > 4 || bytes[13] > 1)
+    {
+        Log::printf("Error: bad qoi header, %u x %u, %d channels\n", width, height, channels);
+        return false;
+    }
+
+    static const PixelFormat s_channelsToPixelFormat[4] = {PixelFormat::R, PixelFormat::RA, PixelFormat::RGB, PixelFormat::RGBA};
+    image.width = width;
+    image.height = height;
+    image.pixelFormat = s_channelsToPixelFormat[channels - 1];
+    image.data.resize((size_t)numPixels * channels);
+
+    switch (channels)
+    {
+    case 1:
+        DecodePixels<1>(bytes, size, image);
+        break;
+    case 2:
+        DecodePixels<2>(bytes, size, image);
+        break;
+    case 3:
+        DecodePixels<3>(bytes, size, image);
+        break;
+    default:
+        DecodePixels<4>(bytes, size, image);
+        break;
+    }
+    return true;
+}
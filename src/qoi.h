@@ -0,0 +1,23 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct Image;
+
+// The "Quite OK Image" format, lossless like png but an order of magnitude faster to encode and decode,
+// meant for intermediate files between pipeline stages. https://qoiformat.org/qoi-specification.pdf
+// RGB and RGBA images are standard QOI. R and RA are stored as gray RGB / RGBA pixels with 1 and 2 in the
+// channels field of the header, which only imgtoy reads.
+
+bool IsQOI(const uint8_t* bytes, size_t size);
+
+// replaces out with the encoded file.
+bool EncodeQOI(const Image& image, std::vector<uint8_t>& out);
+
+// alpha is left as stored, see Image::Load for pre-multiplying.
+bool DecodeQOI(const uint8_t* bytes, size_t size, Image& image);
+
+#endif
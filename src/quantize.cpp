@@ -0,0 +1,639 @@
+#include "quantize.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <mutex>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+extern "C" {
+#include <png.h>
+}
+
+#include "log.h"
+#include "parallel.h"
+#include "simd.h"
+#include "util.h"
+
+// colors are packed pre-multiplied RGBA, r in the low byte.
+static inline uint32_t Channel(uint32_t color, int c)
+{
+    return (color >> (c * 8)) & 0xff;
+}
+
+static inline uint32_t PackColor(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+struct ColorCount
+{
+    uint32_t color;
+    uint32_t count;
+};
+
+// every pixel as pre-multiplied RGBA, gray as r = g = b.
+static void GetWorkingColors(const Image& image, bool premultiplied, std::vector<uint32_t>& colors)
+{
+    const size_t numPixels = (size_t)image.width * image.height;
+    const uint32_t channels = image.GetPixelSize();
+    colors.resize(numPixels);
+    ParallelFor(0, numPixels, 4096, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const uint8_t* p = image.data.data() + i * channels;
+            uint32_t r = p[0];
+            uint32_t g = channels >= 3 ? p[1] : r;
+            uint32_t b = channels >= 3 ? p[2] : r;
+            const uint32_t a = channels == 4 ? p[3] : (channels == 2 ? p[1] : 255);
+            if (!premultiplied && a != 255)
+            {
+                r = (r * a + 127) / 255;
+                g = (g * a + 127) / 255;
+                b = (b * a + 127) / 255;
+            }
+            colors[i] = PackColor(r, g, b, a);
+        }
+    });
+}
+
+//
+// median cut
+//
+
+struct ColorBox
+{
+    size_t begin;
+    size_t end;
+    int channel;    // widest channel
+    uint32_t range; // of that channel
+};
+
+static ColorBox MakeBox(const std::vector<ColorCount>& colors, size_t begin, size_t end)
+{
+    uint32_t minValue[4] = {255, 255, 255, 255};
+    uint32_t maxValue[4] = {0, 0, 0, 0};
+    for (size_t i = begin; i < end; i++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            minValue[c] = std::min(minValue[c], Channel(colors[i].color, c));
+            maxValue[c] = std::max(maxValue[c], Channel(colors[i].color, c));
+        }
+    }
+    ColorBox box = {begin, end, 0, 0};
+    for (int c = 0; c < 4; c++)
+    {
+        if (maxValue[c] - minValue[c] > box.range)
+        {
+            box.channel = c;
+            box.range = maxValue[c] - minValue[c];
+        }
+    }
+    return box;
+}
+
+// splits the box with the widest channel at its pixel weighted median until there are maxColors boxes,
+// then returns the weighted mean of each.
+static void MedianCut(std::vector<ColorCount>& colors, int maxColors, std::vector<float>& centroids)
+{
+    std::vector<ColorBox> boxes;
+    boxes.push_back(MakeBox(colors, 0, colors.size()));
+    while ((int)boxes.size() < maxColors)
+    {
+        size_t widest = boxes.size();
+        for (size_t i = 0; i < boxes.size(); i++)
+        {
+            if (boxes[i].end - boxes[i].begin > 1 && (widest == boxes.size() || boxes[i].range > boxes[widest].range))
+            {
+                widest = i;
+            }
+        }
+        if (widest == boxes.size())
+        {
+            break;
+        }
+
+        ColorBox box = boxes[widest];
+        const int c = box.channel;
+        std::sort(colors.begin() + box.begin, colors.begin() + box.end, [c](const ColorCount& x, const ColorCount& y)
+        {
+            return Channel(x.color, c) < Channel(y.color, c);
+        });
+        uint64_t total = 0;
+        for (size_t i = box.begin; i < box.end; i++)
+        {
+            total += colors[i].count;
+        }
+        uint64_t below = 0;
+        size_t split = box.begin + 1;
+        for (size_t i = box.begin; i < box.end - 1; i++)
+        {
+            below += colors[i].count;
+            split = i + 1;
+            if (below * 2 >= total)
+            {
+                break;
+            }
+        }
+        boxes[widest] = MakeBox(colors, box.begin, split);
+        boxes.push_back(MakeBox(colors, split, box.end));
+    }
+
+    centroids.assign(boxes.size() * 4, 0.0f);
+    for (size_t b = 0; b < boxes.size(); b++)
+    {
+        double sum[4] = {};
+        double weight = 0.0;
+        for (size_t i = boxes[b].begin; i < boxes[b].end; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                sum[c] += (double)Channel(colors[i].color, c) * colors[i].count;
+            }
+            weight += colors[i].count;
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            centroids[b * 4 + c] = (float)(sum[c] / weight);
+        }
+    }
+}
+
+//
+// nearest palette entry
+//
+
+// structure of arrays, padded to a multiple of 4 with entries too far away to ever be the nearest.
+struct PaletteSearch
+{
+    void Set(const std::vector<float>& centroids)
+    {
+        size = (int)(centroids.size() / 4);
+        const size_t padded = (size + 3) & ~3;
+        for (int c = 0; c < 4; c++)
+        {
+            channels[c].assign(padded, 1.0e9f);
+            for (int i = 0; i < size; i++)
+            {
+                channels[c][i] = centroids[i * 4 + c];
+            }
+        }
+    }
+
+    int size;
+    std::vector<float> channels[4];
+};
+
+static int FindNearest(const PaletteSearch& palette, const float* color, float* distOut)
+{
+    int best = 0;
+    float bestDist = FLT_MAX;
+    int i = 0;
+#if defined(SIMD_SSE2)
+    const __m128 r = _mm_set1_ps(color[0]);
+    const __m128 g = _mm_set1_ps(color[1]);
+    const __m128 b = _mm_set1_ps(color[2]);
+    const __m128 a = _mm_set1_ps(color[3]);
+    __m128 bestDist4 = _mm_set1_ps(FLT_MAX);
+    __m128i best4 = _mm_setzero_si128();
+    __m128i index4 = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i four = _mm_set1_epi32(4);
+    for (; i < palette.size; i += 4)
+    {
+        const __m128 dr = _mm_sub_ps(_mm_loadu_ps(&palette.channels[0][i]), r);
+        const __m128 dg = _mm_sub_ps(_mm_loadu_ps(&palette.channels[1][i]), g);
+        const __m128 db = _mm_sub_ps(_mm_loadu_ps(&palette.channels[2][i]), b);
+        const __m128 da = _mm_sub_ps(_mm_loadu_ps(&palette.channels[3][i]), a);
+        const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da)));
+        const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(dist, bestDist4));
+        bestDist4 = _mm_min_ps(dist, bestDist4);
+        best4 = _mm_or_si128(_mm_and_si128(closer, index4), _mm_andnot_si128(closer, best4));
+        index4 = _mm_add_epi32(index4, four);
+    }
+    float dists[4];
+    int32_t indices[4];
+    _mm_storeu_ps(dists, bestDist4);
+    _mm_storeu_si128((__m128i*)indices, best4);
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (dists[lane] < bestDist || (dists[lane] == bestDist && indices[lane] < best))
+        {
+            bestDist = dists[lane];
+            best = indices[lane];
+        }
+    }
+#endif
+    for (; i < palette.size; i++)
+    {
+        float dist = 0.0f;
+        for (int c = 0; c < 4; c++)
+        {
+            const float d = palette.channels[c][i] - color[c];
+            dist += d * d;
+        }
+        if (dist < bestDist)
+        {
+            bestDist = dist;
+            best = i;
+        }
+    }
+    if (distOut)
+    {
+        *distOut = bestDist;
+    }
+    return best;
+}
+
+// Lloyd iterations over the histogram, weighted by pixel counts.
+static void RefineKMeans(const std::vector<ColorCount>& colors, int iterations, std::vector<float>& centroids)
+{
+    const size_t numCentroids = centroids.size() / 4;
+    PaletteSearch palette;
+    std::mutex mutex;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        palette.Set(centroids);
+        std::vector<double> sums(numCentroids * 5, 0.0);  // r, g, b, a, weight
+        ParallelFor(0, colors.size(), 4096, [&](size_t begin, size_t end)
+        {
+            std::vector<double> localSums(numCentroids * 5, 0.0);
+            for (size_t i = begin; i < end; i++)
+            {
+                const float color[4] = {(float)Channel(colors[i].color, 0), (float)Channel(colors[i].color, 1),
+                                        (float)Channel(colors[i].color, 2), (float)Channel(colors[i].color, 3)};
+                const int nearest = FindNearest(palette, color, nullptr);
+                double* sum = localSums.data() + nearest * 5;
+                for (int c = 0; c < 4; c++)
+                {
+                    sum[c] += (double)color[c] * colors[i].count;
+                }
+                sum[4] += colors[i].count;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < sums.size(); i++)
+            {
+                sums[i] += localSums[i];
+            }
+        });
+
+        // an entry nothing maps to keeps its old color
+        for (size_t k = 0; k < numCentroids; k++)
+        {
+            if (sums[k * 5 + 4] > 0.0)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    centroids[k * 4 + c] = (float)(sums[k * 5 + c] / sums[k * 5 + 4]);
+                }
+            }
+        }
+    }
+}
+
+//
+// mapping
+//
+
+// 8x8 bayer matrix, values 0 to 63
+static const uint8_t s_bayer8[8][8] = {
+    {0, 32, 8, 40, 2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44, 4, 36, 14, 46, 6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    {3, 35, 11, 43, 1, 33, 9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47, 7, 39, 13, 45, 5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+// keeps a dithered color a valid pre-multiplied color, color channels no larger than alpha.
+static inline void ClampPremultiplied(float* color)
+{
+    color[3] = std::min(std::max(color[3], 0.0f), 255.0f);
+    for (int c = 0; c < 3; c++)
+    {
+        color[c] = std::min(std::max(color[c], 0.0f), color[3]);
+    }
+}
+
+static void MapPixels(const Image& image, const std::vector<uint32_t>& pixels, const std::vector<float>& centroids,
+                      const QuantizeOptions& options, const std::unordered_map<uint32_t, uint8_t>& lookup, IndexedImage& out)
+{
+    PaletteSearch palette;
+    palette.Set(centroids);
+    const uint32_t width = image.width;
+    const uint32_t height = image.height;
+
+    if (options.dither == DitherType::None)
+    {
+        ParallelFor(0, pixels.size(), 4096, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                out.indices[i] = lookup.at(pixels[i]);
+            }
+        });
+    }
+    else if (options.dither == DitherType::Ordered)
+    {
+        // about half the spacing of a palette spread evenly over the color cube.
+        const float strength = 128.0f / cbrtf((float)palette.size);
+        ParallelFor(0, height, 16, [&](size_t begin, size_t end)
+        {
+            for (size_t y = begin; y < end; y++)
+            {
+                for (uint32_t x = 0; x < width; x++)
+                {
+                    const size_t i = y * width + x;
+                    const float alpha = (float)Channel(pixels[i], 3);
+                    const float offset = (s_bayer8[y & 7][x & 7] / 63.0f - 0.5f) * strength * (alpha / 255.0f);
+                    float color[4] = {Channel(pixels[i], 0) + offset, Channel(pixels[i], 1) + offset, Channel(pixels[i], 2) + offset, alpha};
+                    ClampPremultiplied(color);
+                    out.indices[i] = (uint8_t)FindNearest(palette, color, nullptr);
+                }
+            }
+        });
+    }
+    else
+    {
+        // serpentine, the error of each pixel goes 7/16 ahead, 3/16, 5/16 and 1/16 to the next row.
+        std::vector<float> errors[2];
+        errors[0].assign(((size_t)width + 2) * 4, 0.0f);
+        errors[1].assign(((size_t)width + 2) * 4, 0.0f);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            float* current = errors[y & 1].data() + 4;  // one pixel of padding on each side
+            float* next = errors[(y + 1) & 1].data() + 4;
+            std::fill(errors[(y + 1) & 1].begin(), errors[(y + 1) & 1].end(), 0.0f);
+            const bool leftToRight = (y & 1) == 0;
+            const int dir = leftToRight ? 1 : -1;
+            for (uint32_t step = 0; step < width; step++)
+            {
+                const int x = leftToRight ? (int)step : (int)(width - 1 - step);
+                const size_t i = (size_t)y * width + x;
+                float color[4];
+                for (int c = 0; c < 4; c++)
+                {
+                    color[c] = Channel(pixels[i], c) + current[x * 4 + c];
+                }
+                ClampPremultiplied(color);
+                const int nearest = FindNearest(palette, color, nullptr);
+                out.indices[i] = (uint8_t)nearest;
+                for (int c = 0; c < 4; c++)
+                {
+                    const float error = color[c] - palette.channels[c][nearest];
+                    current[(x + dir) * 4 + c] += error * (7.0f / 16.0f);
+                    next[(x - dir) * 4 + c] += error * (3.0f / 16.0f);
+                    next[x * 4 + c] += error * (5.0f / 16.0f);
+                    next[(x + dir) * 4 + c] += error * (1.0f / 16.0f);
+                }
+            }
+        }
+    }
+}
+
+QuantizeOptions::QuantizeOptions() : maxColors(256), dither(DitherType::None), premultiplied(true), iterations(8)
+{
+}
+
+IndexedImage::IndexedImage() : width(0), height(0), exact(false)
+{
+}
+
+bool Quantize(const Image& image, const QuantizeOptions& options, IndexedImage& out)
+{
+    if (image.width == 0 || image.height == 0 || options.maxColors < 2 || options.maxColors > 256)
+    {
+        Log::printf("Error: Quantize() needs a non-empty image and 2 to 256 colors\n");
+        return false;
+    }
+
+    std::vector<uint32_t> pixels;
+    GetWorkingColors(image, options.premultiplied, pixels);
+
+    std::unordered_map<uint32_t, uint32_t> histogram;
+    histogram.reserve(1 << 16);
+    for (uint32_t color : pixels)
+    {
+        histogram[color]++;
+    }
+    std::vector<ColorCount> colors;
+    colors.reserve(histogram.size());
+    for (const auto& entry : histogram)
+    {
+        colors.push_back({entry.first, entry.second});
+    }
+    histogram = std::unordered_map<uint32_t, uint32_t>();
+
+    std::vector<float> centroids;
+    out.exact = (int)colors.size() <= options.maxColors;
+    if (out.exact)
+    {
+        for (const ColorCount& color : colors)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                centroids.push_back((float)Channel(color.color, c));
+            }
+        }
+    }
+    else
+    {
+        MedianCut(colors, options.maxColors, centroids);
+        RefineKMeans(colors, options.iterations, centroids);
+    }
+
+    // entries rounded to what the file can hold, pre-multiplied and then straight
+    const size_t numEntries = centroids.size() / 4;
+    std::vector<uint32_t> entries(numEntries);
+    for (size_t k = 0; k < numEntries; k++)
+    {
+        const uint32_t a = (uint32_t)std::min(std::max(centroids[k * 4 + 3] + 0.5f, 0.0f), 255.0f);
+        uint32_t rgb[3];
+        for (int c = 0; c < 3; c++)
+        {
+            rgb[c] = (uint32_t)std::min(std::max(centroids[k * 4 + c] + 0.5f, 0.0f), (float)a);
+            centroids[k * 4 + c] = (float)rgb[c];
+        }
+        centroids[k * 4 + 3] = (float)a;
+        entries[k] = PackColor(rgb[0], rgb[1], rgb[2], a);
+    }
+
+    // translucent entries first, so tRNS only needs to cover them
+    std::vector<uint8_t> order(numEntries);
+    for (size_t k = 0; k < numEntries; k++)
+    {
+        order[k] = (uint8_t)k;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint8_t x, uint8_t y)
+    {
+        return Channel(entries[x], 3) < 255 && Channel(entries[y], 3) == 255;
+    });
+    std::vector<float> sortedCentroids(centroids.size());
+    for (size_t k = 0; k < numEntries; k++)
+    {
+        memcpy(&sortedCentroids[k * 4], &centroids[order[k] * 4], 4 * sizeof(float));
+    }
+
+    // without dithering every distinct color maps the same way, so each one is searched once.
+    std::unordered_map<uint32_t, uint8_t> lookup;
+    if (options.dither == DitherType::None)
+    {
+        PaletteSearch palette;
+        palette.Set(sortedCentroids);
+        lookup.reserve(colors.size());
+        for (const ColorCount& color : colors)
+        {
+            const float value[4] = {(float)Channel(color.color, 0), (float)Channel(color.color, 1), (float)Channel(color.color, 2),
+                                    (float)Channel(color.color, 3)};
+            lookup[color.color] = (uint8_t)FindNearest(palette, value, nullptr);
+        }
+    }
+
+    out.width = image.width;
+    out.height = image.height;
+    out.indices.resize(pixels.size());
+    MapPixels(image, pixels, sortedCentroids, options, lookup, out);
+
+    out.palette.resize(numEntries * 4);
+    for (size_t k = 0; k < numEntries; k++)
+    {
+        const uint32_t color = entries[order[k]];
+        const uint32_t a = Channel(color, 3);
+        for (int c = 0; c < 3; c++)
+        {
+            out.palette[k * 4 + c] = (uint8_t)(a ? std::min((Channel(color, c) * 255 + a / 2) / a, 255u) : 0);
+        }
+        out.palette[k * 4 + 3] = (uint8_t)a;
+    }
+    return true;
+}
+
+void IndexedImage::Expand(Image& image, PixelFormat pixelFormat, bool multiplyAlpha) const
+{
+    image.width = width;
+    image.height = height;
+    image.pixelFormat = pixelFormat;
+    const uint32_t channels = image.GetPixelSize();
+    image.data.resize(indices.size() * channels);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        const uint8_t* entry = &palette[indices[i] * 4];
+        uint8_t* p = &image.data[i * channels];
+        if (pixelFormat == PixelFormat::RA)
+        {
+            p[0] = entry[0];
+            p[1] = entry[3];
+        }
+        else
+        {
+            memcpy(p, entry, channels);
+        }
+    }
+    if (multiplyAlpha)
+    {
+        image.MultiplyAlpha();
+    }
+}
+
+bool IndexedImage::Save(const std::string& filenameIn) const
+{
+    const std::string filename = GetRootPath() + filenameIn;
+    const int numEntries = (int)(palette.size() / 4);
+    if (numEntries == 0 || numEntries > 256 || indices.size() != (size_t)width * height)
+    {
+        Log::printf("Error: bad palette image for \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    // PLTE, tRNS and the row pointers, libpng reads them during png_write_png.
+    std::vector<png_color> colors(numEntries);
+    std::vector<png_byte> alphas;
+    std::vector<const uint8_t*> rows(height);
+
+#ifdef _WIN32
+    FILE *fp = NULL;
+    fopen_s(&fp, filename.c_str(), "wb");
+#else
+    FILE *fp = fopen(filename.c_str(), "wb");
+#endif
+    if (!fp)
+    {
+        Log::printf("Error: Failed to fopen \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    if (!info)
+    {
+        Log::printf("Error: png_create_write_struct() failed\n");
+        png_destroy_write_struct(&png, (png_infopp)NULL);
+        fclose(fp);
+        return false;
+    }
+    if (setjmp(png_jmpbuf(png)))
+    {
+        Log::printf("Error: failed to write \"%s\"\n", filename.c_str());
+        png_destroy_write_struct(&png, &info);
+        fclose(fp);
+        return false;
+    }
+    png_init_io(png, fp);
+
+    // the smallest bit depth that holds every index, rows are packed from one index per byte.
+    const int bitDepth = numEntries <= 2 ? 1 : (numEntries <= 4 ? 2 : (numEntries <= 16 ? 4 : 8));
+    png_set_IHDR(png, info, width, height, bitDepth, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    for (int k = 0; k < numEntries; k++)
+    {
+        colors[k].red = palette[k * 4 + 0];
+        colors[k].green = palette[k * 4 + 1];
+        colors[k].blue = palette[k * 4 + 2];
+        if (palette[k * 4 + 3] < 255)
+        {
+            alphas.push_back(palette[k * 4 + 3]);
+        }
+    }
+    png_set_PLTE(png, info, colors.data(), numEntries);
+    if (!alphas.empty())
+    {
+        png_set_tRNS(png, info, alphas.data(), (int)alphas.size(), NULL);
+    }
+
+    // png expects rows from top to bottom.
+    for (uint32_t y = 0; y < height; y++)
+    {
+        rows[height - 1 - y] = indices.data() + (size_t)y * width;
+    }
+    png_set_rows(png, info, (png_bytepp)rows.data());
+    png_write_png(png, info, bitDepth < 8 ? PNG_TRANSFORM_PACKING : PNG_TRANSFORM_IDENTITY, NULL);
+    png_destroy_write_struct(&png, &info);
+
+    if (fclose(fp) != 0)
+    {
+        Log::printf("Error: failed to write \"%s\"\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ParseDitherType(const char* name, DitherType* ditherOut)
+{
+    static const char* s_ditherNames[(int)DitherType::NUM_TYPES] = {"none", "ordered", "fs"};
+    for (int i = 0; i < (int)DitherType::NUM_TYPES; i++)
+    {
+        if (!strcmp(name, s_ditherNames[i]))
+        {
+            *ditherOut = (DitherType)i;
+            return true;
+        }
+    }
+    return false;
+}
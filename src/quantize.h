@@ -0,0 +1,53 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+enum class DitherType {
+    None = 0,
+    Ordered,         // 8x8 bayer matrix, no error moves between pixels so it tiles and compresses well
+    FloydSteinberg,  // error diffusion, smoothest gradients
+    NUM_TYPES
+};
+
+struct QuantizeOptions {
+    QuantizeOptions();
+
+    int maxColors;      // 2 to 256
+    DitherType dither;
+    // pixels are pre-multiplied, as Image::Load leaves them. straight alpha is pre-multiplied for the color math.
+    bool premultiplied;
+    int iterations;     // k-means refinements after the median cut
+};
+
+// 8 bit palette image, saved as a PNG_COLOR_TYPE_PALETTE png.
+struct IndexedImage {
+    IndexedImage();
+
+    // palette png, with tRNS when any entry is translucent and fewer bits per pixel when the palette allows.
+    bool Save(const std::string& filename) const;
+
+    // back to pixels in pixelFormat, pre-multiplied or straight. gray formats take the red channel.
+    void Expand(Image& image, PixelFormat pixelFormat, bool multiplyAlpha) const;
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> indices;  // rows bottom to top, like Image
+    std::vector<uint8_t> palette;  // RGBA with straight alpha, as png stores it, translucent entries first
+    bool exact;                    // the image had at most maxColors pre-multiplied colors, none were merged
+};
+
+// Images with at most maxColors distinct colors get exactly those. Otherwise a median cut over the color histogram
+// picks the starting palette, k-means refines it, and pixels map to their nearest entry, with SIMD distance search.
+// Colors are compared pre-multiplied, so fully transparent pixels cost no palette entries and translucent ones weigh
+// less. Any pixel format, gray comes out as gray palette entries.
+bool Quantize(const Image& image, const QuantizeOptions& options, IndexedImage& out);
+
+// returns false if name is not one of none, ordered or fs
+bool ParseDitherType(const char* name, DitherType* ditherOut);
+
+#endif
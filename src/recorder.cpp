@@ -0,0 +1,340 @@
+#include "recorder.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include "convert.h"
+#include "log.h"
+#include "memtrack.h"
+#include "parallel.h"
+#include "util.h"
+
+// frames the encoders can have queued or in progress, per encoder thread.
+static const int FRAMES_PER_ENCODER = 2;
+
+// png encoding is the slow one, a few threads keep up with a window at 60hz without taking every core.
+static const int MAX_IMAGE_ENCODERS = 4;
+
+// Stop waits this long for each readback still in flight.
+static const GLuint64 STOP_TIMEOUT_NS = 1000000000;
+
+static std::string FrameFilename(const std::string& pattern, uint64_t index)
+{
+    char filename[1024];
+    snprintf(filename, sizeof(filename), pattern.c_str(), (int)index);
+    return filename;
+}
+
+// RGBA to RGB, the alpha of the back buffer is whatever blending left there.
+static void DropAlpha(const Image& src, Image& dst)
+{
+    dst.width = src.width;
+    dst.height = src.height;
+    dst.pixelFormat = PixelFormat::RGB;
+    const size_t numPixels = (size_t)src.width * src.height;
+    dst.data.resize(numPixels * 3);
+    const uint8_t* in = src.data.data();
+    uint8_t* out = dst.data.data();
+    for (size_t i = 0; i < numPixels; i++)
+    {
+        out[i * 3 + 0] = in[i * 4 + 0];
+        out[i * 3 + 1] = in[i * 4 + 1];
+        out[i * 3 + 2] = in[i * 4 + 2];
+    }
+}
+
+FrameRecorder::FrameRecorder() : format(RecordFormat::PNG), width(0), height(0), colorStandard(ColorStandard::BT709),
+                                 colorRange(ColorRange::Limited), recording(false), nextReadback(0), syncSupported(false),
+                                 frameBytes(0), quit(false), framesCaptured(0), framesWritten(0), framesDroppedReadback(0),
+                                 framesDroppedEncoder(0), writeErrors(0)
+{
+    for (int i = 0; i < NUM_PBOS; i++)
+    {
+        readbacks[i] = {0, nullptr, 0, false};
+    }
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    Stop();
+}
+
+bool FrameRecorder::Start(const std::string& outputIn, int widthIn, int heightIn, int fpsNum, int fpsDen, ColorStandard standard, ColorRange range)
+{
+    Stop();
+
+    output = outputIn;
+    width = widthIn;
+    height = heightIn;
+    colorStandard = standard;
+    colorRange = range;
+    if (output == "-" || HasExtension(output, ".y4m"))
+    {
+        format = RecordFormat::Y4M;
+    }
+    else if ((HasExtension(output, ".png") || HasExtension(output, ".qoi")) && IsFramePattern(output))
+    {
+        format = HasExtension(output, ".qoi") ? RecordFormat::QOI : RecordFormat::PNG;
+    }
+    else
+    {
+        Log::printf("Error: record output \"%s\" is not a .y4m file or a .png / .qoi pattern with one %%d\n", output.c_str());
+        return false;
+    }
+
+    if (!GLEW_VERSION_3_0)
+    {
+        Log::printf("Error: recording needs gl 3.0 for glMapBufferRange\n");
+        return false;
+    }
+    // without fences the ring depth alone keeps the map from waiting, as long as the gpu is less than
+    // NUM_PBOS - 1 frames behind.
+    syncSupported = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+
+    if (format == RecordFormat::Y4M && !y4mWriter.Open(output, (uint32_t)width, (uint32_t)height, fpsNum, fpsDen, ChromaFormat::C420))
+    {
+        return false;
+    }
+
+    // RGBA is the format every driver reads back without converting on the cpu.
+    frameBytes = (size_t)width * height * 4;
+    for (int i = 0; i < NUM_PBOS; i++)
+    {
+        Readback& readback = readbacks[i];
+        glGenBuffers(1, &readback.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, nullptr, GL_STREAM_READ);
+        readback.fence = nullptr;
+        readback.pending = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    // counted with the textures, it is gpu visible memory of the same kind.
+    MemTrack::Alloc(MemCategory::Texture, frameBytes * NUM_PBOS);
+
+    const int numEncoders = format == RecordFormat::Y4M ? 1 : std::max(1, std::min(MAX_IMAGE_ENCODERS, GetNumThreads() / 2));
+    frames.resize(numEncoders * FRAMES_PER_ENCODER);
+    freeFrames.clear();
+    queuedFrames.clear();
+    for (auto& frame : frames)
+    {
+        frame.image.width = (uint32_t)width;
+        frame.image.height = (uint32_t)height;
+        frame.image.pixelFormat = PixelFormat::RGBA;
+        frame.image.data.resize(frameBytes);
+        freeFrames.push_back(&frame);
+    }
+
+    quit = false;
+    for (int i = 0; i < numEncoders; i++)
+    {
+        encoders.emplace_back([this]()
+        {
+            Image rgb;
+            for (;;)
+            {
+                RecordFrame* frame;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [this] { return quit || !queuedFrames.empty(); });
+                    if (queuedFrames.empty())
+                    {
+                        break;
+                    }
+                    frame = queuedFrames.front();
+                    queuedFrames.erase(queuedFrames.begin());
+                }
+
+                auto encodeStart = std::chrono::steady_clock::now();
+                bool ok;
+                if (format == RecordFormat::Y4M)
+                {
+                    processImage(frame->image, colorStandard, colorRange);
+                    PackYUV(frame->image, y4mPacked, ChromaFormat::C420);
+                    ok = y4mWriter.WriteFrame(y4mPacked);
+                }
+                else
+                {
+                    DropAlpha(frame->image, rgb);
+                    ok = rgb.Save(FrameFilename(output, frame->index));
+                }
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - encodeStart;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                encodeHistogram.Add(elapsed.count());
+                if (ok)
+                {
+                    framesWritten++;
+                }
+                else
+                {
+                    writeErrors++;
+                }
+                freeFrames.push_back(frame);
+                cond.notify_all();
+            }
+        });
+    }
+
+    nextReadback = 0;
+    framesCaptured = 0;
+    framesWritten = 0;
+    framesDroppedReadback = 0;
+    framesDroppedEncoder = 0;
+    writeErrors = 0;
+    recording = true;
+    return true;
+}
+
+// copies a finished readback out of its pbo and queues it for the encoders. returns false, leaving the readback
+// pending, if wait is false and the gpu has not finished it.
+static bool CollectReadback(FrameRecorder& recorder, FrameRecorder::Readback& readback, bool wait)
+{
+    if (readback.fence)
+    {
+        GLsync fence = (GLsync)readback.fence;
+        GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? STOP_TIMEOUT_NS : 0);
+        if (status == GL_TIMEOUT_EXPIRED && !wait)
+        {
+            return false;
+        }
+        glDeleteSync(fence);
+        readback.fence = nullptr;
+    }
+    readback.pending = false;
+
+    RecordFrame* frame = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(recorder.mutex);
+        if (wait)
+        {
+            recorder.cond.wait(lock, [&] { return !recorder.freeFrames.empty(); });
+        }
+        if (recorder.freeFrames.empty())
+        {
+            recorder.framesDroppedEncoder++;
+            return true;
+        }
+        frame = recorder.freeFrames.back();
+        recorder.freeFrames.pop_back();
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, recorder.frameBytes, GL_MAP_READ_BIT);
+    bool mapped = pixels != nullptr;
+    if (mapped)
+    {
+        memcpy(frame->image.data.data(), pixels, recorder.frameBytes);
+        mapped = glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::lock_guard<std::mutex> lock(recorder.mutex);
+    if (!mapped)
+    {
+        recorder.writeErrors++;
+        recorder.freeFrames.push_back(frame);
+        return true;
+    }
+    frame->index = readback.index;
+    recorder.queuedFrames.push_back(frame);
+    recorder.cond.notify_all();
+    return true;
+}
+
+void FrameRecorder::Capture()
+{
+    if (!recording)
+    {
+        return;
+    }
+
+    auto captureStart = std::chrono::steady_clock::now();
+    Readback& readback = readbacks[nextReadback];
+    if (readback.pending && !CollectReadback(*this, readback, false))
+    {
+        // this frame has nowhere to go, the oldest readback is still busy.
+        framesDroppedReadback++;
+        framesCaptured++;
+        captureHistogram.Add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - captureStart).count());
+        return;
+    }
+
+    // with a pack buffer bound, glReadPixels only queues the copy and returns.
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (syncSupported)
+    {
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    readback.index = framesCaptured++;
+    readback.pending = true;
+    nextReadback = (nextReadback + 1) % NUM_PBOS;
+
+    captureHistogram.Add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - captureStart).count());
+}
+
+bool FrameRecorder::Stop()
+{
+    if (!recording)
+    {
+        return true;
+    }
+
+    // oldest first, nextReadback is the one issued longest ago.
+    for (int i = 0; i < NUM_PBOS; i++)
+    {
+        Readback& readback = readbacks[(nextReadback + i) % NUM_PBOS];
+        if (readback.pending)
+        {
+            CollectReadback(*this, readback, true);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        cond.notify_all();
+    }
+    for (auto& encoder : encoders)
+    {
+        encoder.join();
+    }
+    encoders.clear();
+
+    for (int i = 0; i < NUM_PBOS; i++)
+    {
+        glDeleteBuffers(1, &readbacks[i].pbo);
+        readbacks[i].pbo = 0;
+    }
+    MemTrack::Free(MemCategory::Texture, frameBytes * NUM_PBOS);
+    frames.clear();
+    freeFrames.clear();
+    y4mPacked.Release();
+
+    if (format == RecordFormat::Y4M && !y4mWriter.Close())
+    {
+        writeErrors++;
+    }
+    recording = false;
+    return writeErrors == 0;
+}
+
+void FrameRecorder::PrintSummary() const
+{
+    Log::printf("record: %llu frames captured, %llu written to \"%s\"\n", (unsigned long long)framesCaptured,
+                (unsigned long long)framesWritten, output.c_str());
+    if (framesDroppedReadback || framesDroppedEncoder || writeErrors)
+    {
+        Log::printf("record: dropped %llu (readback not ready), %llu (encoders behind), %llu failed to write\n",
+                    (unsigned long long)framesDroppedReadback, (unsigned long long)framesDroppedEncoder, (unsigned long long)writeErrors);
+    }
+    Log::printf("%s", captureHistogram.Summary("capture").c_str());
+    Log::printf("%s", encodeHistogram.Summary("encode").c_str());
+}
@@ -0,0 +1,96 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "colormatrix.h"
+#include "frametimer.h"
+#include "image.h"
+#include "y4m.h"
+
+enum class RecordFormat {
+    PNG = 0,
+    QOI,
+    Y4M
+};
+
+struct RecordFrame
+{
+    Image image;  // RGBA as read back, rows bottom to top
+    uint64_t index;
+};
+
+// Records what the window shows without stalling the frame loop.
+// Each Capture starts an asynchronous glReadPixels of the back buffer into one of NUM_PBOS pixel pack buffers and
+// fences it. The readback is picked up NUM_PBOS - 1 frames later, when the fence has long signaled, so mapping it
+// never waits on the gpu. The pixels are copied out and handed to encoder threads, png and qoi frames on several at
+// once, y4m frames on one so they stay in order.
+// When the readback or the encoders fall behind, frames are dropped and counted rather than waited for.
+struct FrameRecorder
+{
+    static const int NUM_PBOS = 3;
+
+    FrameRecorder();
+    ~FrameRecorder();
+
+    // output is a y4m file (- for stdout), or a printf style png or qoi pattern relative to the root path,
+    // "capture/frame_%05d.png", told apart by extension. a pattern has one %d, optionally zero padded to a width, and
+    // any other '%' written as "%%". y4m frames are converted with standard and range.
+    // requires a current gl context, width x height is the size of the back buffer.
+    bool Start(const std::string& output, int width, int height, int fpsNum, int fpsDen, ColorStandard standard, ColorRange range);
+
+    // after the frame is drawn and before the swap.
+    void Capture();
+
+    // finishes the readbacks in flight, waits for the encoders and closes the output. false if any frame failed to write.
+    bool Stop();
+
+    void PrintSummary() const;
+
+    struct Readback
+    {
+        uint32_t pbo;
+        void* fence;  // GLsync
+        uint64_t index;
+        bool pending;
+    };
+
+    RecordFormat format;
+    std::string output;
+    int width;
+    int height;
+    ColorStandard colorStandard;
+    ColorRange colorRange;
+    bool recording;
+
+    Readback readbacks[NUM_PBOS];
+    int nextReadback;
+    bool syncSupported;
+    size_t frameBytes;
+
+    Y4MWriter y4mWriter;
+    YUVImage y4mPacked;
+
+    std::vector<RecordFrame> frames;
+    std::vector<RecordFrame*> freeFrames;
+    std::vector<RecordFrame*> queuedFrames;  // oldest first
+    std::vector<std::thread> encoders;
+    bool quit;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    uint64_t framesCaptured;
+    uint64_t framesWritten;
+    uint64_t framesDroppedReadback;  // the readback from NUM_PBOS - 1 frames ago was not done yet
+    uint64_t framesDroppedEncoder;   // every buffer was still queued for the encoders
+    uint64_t writeErrors;
+    TimingHistogram captureHistogram;  // cost of Capture on the frame loop
+    TimingHistogram encodeHistogram;
+};
+
+#endif
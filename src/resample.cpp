@@ -0,0 +1,377 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "image.h"
+#include "log.h"
+#include "parallel.h"
+#include "simd.h"
+
+// For every output pixel: the first input pixel and a fixed number of weights.
+// Windows that would run off the edge are folded back onto the edge pixel and shifted inside the image,
+// so every row has exactly taps weights (some may be zero), which keeps the inner loops branch free.
+struct WeightTable
+{
+    int taps;
+    std::vector<int> start;
+    std::vector<float> weights;
+};
+
+static float FilterRadius(ResampleFilter filter)
+{
+    static float s_radius[(int)ResampleFilter::NUM_FILTERS] = {1.0f, 2.0f, 3.0f};
+    return s_radius[(int)filter];
+}
+
+static float Sinc(float x)
+{
+    if (x == 0.0f)
+    {
+        return 1.0f;
+    }
+    x *= 3.14159265358979f;
+    return sinf(x) / x;
+}
+
+static float FilterWeight(ResampleFilter filter, float x)
+{
+    x = fabsf(x);
+    switch (filter)
+    {
+    case ResampleFilter::Bilinear:
+        return x < 1.0f ? 1.0f - x : 0.0f;
+    case ResampleFilter::Bicubic:
+    {
+        const float a = -0.5f;
+        if (x < 1.0f)
+        {
+            return ((a + 2.0f) * x - (a + 3.0f)) * x * x + 1.0f;
+        }
+        else if (x < 2.0f)
+        {
+            return ((a * x - 5.0f * a) * x + 8.0f * a) * x - 4.0f * a;
+        }
+        return 0.0f;
+    }
+    case ResampleFilter::Lanczos3:
+        return x < 3.0f ? Sinc(x) * Sinc(x / 3.0f) : 0.0f;
+    default:
+        return 0.0f;
+    }
+}
+
+static void BuildWeightTable(uint32_t inSize, uint32_t outSize, ResampleFilter filter, WeightTable& table)
+{
+    double scale = (double)inSize / outSize;
+
+    // when minifying, stretch the filter over the input so it also acts as the low-pass filter.
+    double filterScale = std::max(scale, 1.0);
+    double support = FilterRadius(filter) * filterScale;
+
+    int taps = std::min((int)ceil(2.0 * support) + 2, (int)inSize);
+    table.taps = taps;
+    table.start.resize(outSize);
+    table.weights.assign((size_t)outSize * taps, 0.0f);
+
+    for (uint32_t i = 0; i < outSize; i++)
+    {
+        double center = (i + 0.5) * scale;
+        int first = (int)floor(center - support);
+        int last = (int)ceil(center + support);
+        int lo = std::min(std::max(first, 0), (int)inSize - 1);
+        int start = std::min(lo, (int)inSize - taps);
+        table.start[i] = start;
+
+        float* w = &table.weights[(size_t)i * taps];
+        double sum = 0.0;
+        for (int j = first; j < last; j++)
+        {
+            float weight = FilterWeight(filter, (float)((j + 0.5 - center) / filterScale));
+            int k = std::min(std::max(j, 0), (int)inSize - 1) - start;
+            if (k >= 0 && k < taps)
+            {
+                w[k] += weight;
+                sum += weight;
+            }
+        }
+
+        if (sum != 0.0)
+        {
+            float invSum = (float)(1.0 / sum);
+            for (int k = 0; k < taps; k++)
+            {
+                w[k] *= invSum;
+            }
+        }
+    }
+}
+
+#ifdef SIMD_AVX2
+static inline __m256 Madd(__m256 a, __m256 b, __m256 c)
+{
+#ifdef __FMA__
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+#endif
+
+// in: one row of input pixels as floats, out: one row of output pixels
+static void HorizontalPass(const float* in, float* out, uint32_t outWidth, int channels, const WeightTable& table)
+{
+    const int taps = table.taps;
+    if (channels == 4)
+    {
+        for (uint32_t x = 0; x < outWidth; x++)
+        {
+            const float* w = &table.weights[(size_t)x * taps];
+            const float* p = in + (size_t)table.start[x] * 4;
+            int k = 0;
+#if defined(SIMD_AVX2)
+            // two rgba pixels per register
+            __m256 acc = _mm256_setzero_ps();
+            for (; k + 2 <= taps; k += 2)
+            {
+                __m256 weight = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(w[k])), _mm_set1_ps(w[k + 1]), 1);
+                acc = Madd(_mm256_loadu_ps(p + k * 4), weight, acc);
+            }
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            for (; k < taps; k++)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(p + k * 4), _mm_set1_ps(w[k])));
+            }
+            _mm_storeu_ps(out + x * 4, sum);
+#elif defined(SIMD_SSE2)
+            __m128 sum = _mm_setzero_ps();
+            for (; k < taps; k++)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(p + k * 4), _mm_set1_ps(w[k])));
+            }
+            _mm_storeu_ps(out + x * 4, sum);
+#else
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (; k < taps; k++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    sum[c] += w[k] * p[k * 4 + c];
+                }
+            }
+            memcpy(out + x * 4, sum, sizeof(sum));
+#endif
+        }
+    }
+    else
+    {
+        for (uint32_t x = 0; x < outWidth; x++)
+        {
+            const float* w = &table.weights[(size_t)x * taps];
+            const float* p = in + (size_t)table.start[x] * channels;
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            for (int k = 0; k < taps; k++)
+            {
+                for (int c = 0; c < channels; c++)
+                {
+                    sum[c] += w[k] * p[k * channels + c];
+                }
+            }
+            for (int c = 0; c < channels; c++)
+            {
+                out[x * channels + c] = sum[c];
+            }
+        }
+    }
+}
+
+static void LoadRow(float* out, const uint8_t* in, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(out + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(out + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = in[i];
+    }
+}
+
+// out[i] += weight * in[i], for a whole row
+static void AccumulateRow(float* out, const float* in, float weight, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    __m256 w8 = _mm256_set1_ps(weight);
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(out + i, Madd(_mm256_loadu_ps(in + i), w8, _mm256_loadu_ps(out + i)));
+    }
+#elif defined(SIMD_SSE2)
+    __m128 w4 = _mm_set1_ps(weight);
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), w4)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] += weight * in[i];
+    }
+}
+
+#if defined(SIMD_SSE2)
+// clamps and rounds half up, the same as the scalar tail, which _mm_cvtps_epi32 (half to even) wouldn't.
+static inline __m128i RoundClamp4(__m128 v)
+{
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+#endif
+
+// rounds and clamps to [0, 255]
+static void StoreRow(uint8_t* out, const float* in, size_t count)
+{
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = RoundClamp4(_mm_loadu_ps(in + i));
+        __m128i b = RoundClamp4(_mm_loadu_ps(in + i + 4));
+        __m128i c = RoundClamp4(_mm_loadu_ps(in + i + 8));
+        __m128i d = RoundClamp4(_mm_loadu_ps(in + i + 12));
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        float v = std::min(std::max(in[i], 0.0f), 255.0f);
+        out[i] = (uint8_t)(v + 0.5f);
+    }
+}
+
+bool Resample(const Image& src, Image& dst, uint32_t width, uint32_t height, ResampleFilter filter)
+{
+    if (src.width == 0 || src.height == 0 || width == 0 || height == 0 || src.data.empty())
+    {
+        Log::printf("Error: Resample() needs a non-empty source and destination size\n");
+        return false;
+    }
+
+    const int channels = (int)src.GetPixelSize();
+    WeightTable xTable, yTable;
+    BuildWeightTable(src.width, width, filter, xTable);
+    BuildWeightTable(src.height, height, filter, yTable);
+
+    // horizontal pass, every source row to width pixels of floats
+    const size_t srcRowSize = (size_t)src.width * channels;
+    const size_t tmpRowSize = (size_t)width * channels;
+    std::vector<float> tmp(tmpRowSize * src.height);
+    ParallelFor(0, src.height, 16, [&](size_t begin, size_t end)
+    {
+        std::vector<float> row(srcRowSize);
+        for (size_t y = begin; y < end; y++)
+        {
+            LoadRow(row.data(), src.data.data() + y * srcRowSize, srcRowSize);
+            HorizontalPass(row.data(), tmp.data() + y * tmpRowSize, width, channels, xTable);
+        }
+    });
+
+    // vertical pass, straight from the float rows into the destination
+    Image result;
+    result.width = width;
+    result.height = height;
+    result.pixelFormat = src.pixelFormat;
+    result.data.resize(tmpRowSize * height);
+    ParallelFor(0, height, 8, [&](size_t begin, size_t end)
+    {
+        std::vector<float> acc(tmpRowSize);
+        for (size_t y = begin; y < end; y++)
+        {
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            const float* w = &yTable.weights[y * yTable.taps];
+            const float* in = tmp.data() + (size_t)yTable.start[y] * tmpRowSize;
+            for (int k = 0; k < yTable.taps; k++)
+            {
+                if (w[k] != 0.0f)
+                {
+                    AccumulateRow(acc.data(), in + k * tmpRowSize, w[k], tmpRowSize);
+                }
+            }
+            StoreRow(result.data.data() + y * tmpRowSize, acc.data(), tmpRowSize);
+        }
+    });
+
+    dst = std::move(result);
+    return true;
+}
+
+bool DownsampleHalf(const Image& src, Image& dst)
+{
+    if (src.width == 0 || src.height == 0 || src.data.empty() || (src.width == 1 && src.height == 1))
+    {
+        Log::printf("Error: DownsampleHalf() needs a source larger than 1 x 1\n");
+        return false;
+    }
+
+    const size_t channels = src.GetPixelSize();
+    const uint32_t width = std::max(src.width / 2, 1u);
+    const uint32_t height = std::max(src.height / 2, 1u);
+    // a 1 pixel wide or tall source has no second column or row, it is averaged with itself.
+    const size_t xStep = src.width > 1 ? channels : 0;
+    const size_t srcRowSize = (size_t)src.width * channels;
+    const size_t yStep = src.height > 1 ? srcRowSize : 0;
+    const size_t dstRowSize = (size_t)width * channels;
+
+    Image result;
+    result.width = width;
+    result.height = height;
+    result.pixelFormat = src.pixelFormat;
+    result.data.resize(dstRowSize * height);
+    ParallelFor(0, height, 32, [&](size_t begin, size_t end)
+    {
+        for (size_t y = begin; y < end; y++)
+        {
+            const uint8_t* in = src.data.data() + (src.height > 1 ? y * 2 : y) * srcRowSize;
+            uint8_t* out = result.data.data() + y * dstRowSize;
+            for (size_t x = 0; x < width; x++)
+            {
+                const uint8_t* p = in + x * 2 * channels;
+                for (size_t c = 0; c < channels; c++)
+                {
+                    out[x * channels + c] = (uint8_t)((p[c] + p[c + xStep] + p[c + yStep] + p[c + xStep + yStep] + 2) >> 2);
+                }
+            }
+        }
+    });
+
+    dst = std::move(result);
+    return true;
+}
+
+bool ParseResampleFilter(const char* name, ResampleFilter* filterOut)
+{
+    static const char* s_filterNames[(int)ResampleFilter::NUM_FILTERS] = {"bilinear", "bicubic", "lanczos3"};
+    for (int i = 0; i < (int)ResampleFilter::NUM_FILTERS; i++)
+    {
+        if (!strcmp(name, s_filterNames[i]))
+        {
+            *filterOut = (ResampleFilter)i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,27 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+struct Image;
+
+enum class ResampleFilter {
+    Bilinear = 0,
+    Bicubic,   // Catmull-Rom
+    Lanczos3,
+    NUM_FILTERS
+};
+
+// Resizes src to width x height into dst, for any PixelFormat.
+// Separable: a horizontal pass into a float buffer followed by a vertical pass, both multi-threaded over rows.
+// Image::Load pre-multiplies alpha, so filtering here does not bleed color out of transparent pixels.
+bool Resample(const Image& src, Image& dst, uint32_t width, uint32_t height, ResampleFilter filter);
+
+// Halves width and height with a 2x2 box filter, rounding down to at least 1, the sizes of gl mip levels.
+// An odd last row or column is dropped, like glGenerateMipmap on most drivers.
+bool DownsampleHalf(const Image& src, Image& dst);
+
+// returns false if name is not one of bilinear, bicubic or lanczos3
+bool ParseResampleFilter(const char* name, ResampleFilter* filterOut);
+
+#endif
@@ -0,0 +1,24 @@
+// instruction set selection
+
+#ifndef SIMD_H
+#define SIMD_H
+
+// Only what the compiler was allowed to target is used, see IMGTOY_ENABLE_AVX2 in CMakeLists.txt.
+// Every kernel keeps a scalar path for other architectures.
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#endif
+
+#if defined(__SSE4_1__) || defined(SIMD_AVX2)
+#define SIMD_SSE41 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#endif
+
+#if defined(SIMD_SSE2)
+#include <immintrin.h>
+#endif
+
+#endif
@@ -5,7 +5,15 @@
 #include <SDL2/SDL_opengl.h>
 #include <SDL2/SDL_opengl_glext.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "image.h"
+#include "jpeg.h"
+#include "log.h"
+#include "memtrack.h"
+#include "resample.h"
+#include "util.h"
 
 static GLenum filterTypeToGL[] = {
     GL_NEAREST,
@@ -30,6 +38,25 @@ static GLenum pixelFormatToGL[] = {
     GL_RGBA
 };
 
+// drivers store GL_RGB as 4 bytes per texel, it is counted that way.
+static size_t s_pixelFormatToGPUSize[(int)PixelFormat::NUM_FORMATS] = {1, 2, 4, 4};
+
+static size_t EstimateGPUBytes(uint32_t width, uint32_t height, PixelFormat pixelFormat, bool hasMipmaps)
+{
+    size_t bytes = 0;
+    for (;;)
+    {
+        bytes += (size_t)width * height * s_pixelFormatToGPUSize[(int)pixelFormat];
+        if (!hasMipmaps || (width == 1 && height == 1))
+        {
+            break;
+        }
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return bytes;
+}
+
 Texture::Texture(const Image& image, const Params& params)
 {
     glGenTextures(1, &texture);
@@ -46,17 +73,176 @@ Texture::Texture(const Image& image, const Params& params)
     int internalFormat = pf;
     glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, pf, GL_UNSIGNED_BYTE, &image.data[0]);
 
-    if ((int)params.minFilter >= (int)FilterType::NearestMipmapNearest)
+    hasMipmaps = (int)params.minFilter >= (int)FilterType::NearestMipmapNearest;
+    if (hasMipmaps)
     {
         glGenerateMipmap(GL_TEXTURE_2D);
     }
 
     hasAlphaChannel = image.pixelFormat == PixelFormat::RA || image.pixelFormat == PixelFormat::RGBA;
+    width = image.width;
+    height = image.height;
+    pixelFormat = image.pixelFormat;
+    gpuBytes = EstimateGPUBytes(width, height, pixelFormat, hasMipmaps);
+    MemTrack::Alloc(MemCategory::Texture, gpuBytes);
 }
 
 Texture::~Texture()
 {
     glDeleteTextures(1, &texture);
+    MemTrack::Free(MemCategory::Texture, gpuBytes);
+}
+
+void Texture::Update(const Image& image)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    GLenum pf = pixelFormatToGL[(int)image.pixelFormat];
+    if (image.width == width && image.height == height && image.pixelFormat == pixelFormat)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, pf, GL_UNSIGNED_BYTE, &image.data[0]);
+    }
+    else
+    {
+        int internalFormat = pf;
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, pf, GL_UNSIGNED_BYTE, &image.data[0]);
+        width = image.width;
+        height = image.height;
+        pixelFormat = image.pixelFormat;
+        hasAlphaChannel = image.pixelFormat == PixelFormat::RA || image.pixelFormat == PixelFormat::RGBA;
+        MemTrack::Free(MemCategory::Texture, gpuBytes);
+        gpuBytes = EstimateGPUBytes(width, height, pixelFormat, hasMipmaps);
+        MemTrack::Alloc(MemCategory::Texture, gpuBytes);
+    }
+
+    if (hasMipmaps)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+}
+
+static int Log2Floor(uint32_t value)
+{
+    int log2 = 0;
+    while (value > 1)
+    {
+        value >>= 1;
+        log2++;
+    }
+    return log2;
+}
+
+// recomputes the area of every mip level under rect of level 0. pixels of level l are box averages of the
+// blocks of level 0 they cover, blocks stop growing along an axis once the level is 1 pixel wide (or tall) on it.
+static void UpdateMipRegion(const Image& image, const ImageRect& rect)
+{
+    const uint32_t channels = image.GetPixelSize();
+    const int xLevels = Log2Floor(image.width);
+    const int yLevels = Log2Floor(image.height);
+    const GLenum pf = pixelFormatToGL[(int)image.pixelFormat];
+    std::vector<uint8_t> pixels;
+    std::vector<uint32_t> sums;
+    for (int level = 1; level <= std::max(xLevels, yLevels); level++)
+    {
+        const uint32_t levelWidth = std::max(image.width >> level, 1u);
+        const uint32_t levelHeight = std::max(image.height >> level, 1u);
+        const uint32_t blockWidth = 1u << std::min(level, xLevels);
+        const uint32_t blockHeight = 1u << std::min(level, yLevels);
+
+        // odd last rows and columns are dropped by every level below them
+        const uint32_t x0 = rect.x / blockWidth;
+        const uint32_t y0 = rect.y / blockHeight;
+        if (x0 >= levelWidth || y0 >= levelHeight)
+        {
+            break;
+        }
+        const uint32_t x1 = std::min((rect.x + rect.width - 1) / blockWidth + 1, levelWidth);
+        const uint32_t y1 = std::min((rect.y + rect.height - 1) / blockHeight + 1, levelHeight);
+        const uint32_t regionWidth = x1 - x0;
+        const uint32_t regionHeight = y1 - y0;
+
+        const uint32_t blockSize = blockWidth * blockHeight;
+        pixels.resize((size_t)regionWidth * regionHeight * channels);
+        sums.resize((size_t)regionWidth * channels);
+        for (uint32_t y = 0; y < regionHeight; y++)
+        {
+            std::fill(sums.begin(), sums.end(), 0);
+            for (uint32_t by = 0; by < blockHeight; by++)
+            {
+                const uint8_t* src = image.data.data() + (((size_t)(y0 + y) * blockHeight + by) * image.width + (size_t)x0 * blockWidth) * channels;
+                for (uint32_t x = 0; x < regionWidth; x++)
+                {
+                    uint32_t* sum = sums.data() + (size_t)x * channels;
+                    for (uint32_t bx = 0; bx < blockWidth; bx++, src += channels)
+                    {
+                        for (uint32_t c = 0; c < channels; c++)
+                        {
+                            sum[c] += src[c];
+                        }
+                    }
+                }
+            }
+            uint8_t* dst = pixels.data() + (size_t)y * regionWidth * channels;
+            for (size_t i = 0; i < sums.size(); i++)
+            {
+                dst[i] = (uint8_t)((sums[i] + blockSize / 2) / blockSize);
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, level, x0, y0, regionWidth, regionHeight, pf, GL_UNSIGNED_BYTE, pixels.data());
+    }
+}
+
+void Texture::UpdateRegion(const Image& image, const ImageRect& rectIn)
+{
+    if (image.width != width || image.height != height || image.pixelFormat != pixelFormat)
+    {
+        Update(image);
+        return;
+    }
+    if (rectIn.x >= width || rectIn.y >= height || rectIn.width == 0 || rectIn.height == 0)
+    {
+        return;
+    }
+    const ImageRect rect = {rectIn.x, rectIn.y, std::min(rectIn.width, width - rectIn.x), std::min(rectIn.height, height - rectIn.y)};
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, image.width);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, rect.x);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, rect.y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height, pixelFormatToGL[(int)image.pixelFormat], GL_UNSIGNED_BYTE,
+                    image.data.data());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+    if (hasMipmaps)
+    {
+        // past a quarter of the image the gpu rebuilding everything is cheaper than the cpu boxes.
+        if ((uint64_t)rect.width * rect.height * 4 > (uint64_t)width * height)
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        else
+        {
+            UpdateMipRegion(image, rect);
+        }
+    }
+}
+
+void Texture::UpdateDirty(Image& image)
+{
+    for (const ImageRect& rect : image.dirtyRects)
+    {
+        UpdateRegion(image, rect);
+    }
+    image.ClearDirty();
+}
+
+void Texture::UpdateRows(const Image& image, uint32_t firstRow, uint32_t numRows)
+{
+    UpdateRegion(image, {0, firstRow, image.width, numRows});
 }
 
 void Texture::Apply(int unit) const
@@ -64,3 +250,254 @@ void Texture::Apply(int unit) const
     glActiveTexture(GL_TEXTURE0 + unit);
     glBindTexture(GL_TEXTURE_2D, texture);
 }
+
+static int GetNumMipLevels(uint32_t width, uint32_t height)
+{
+    int numLevels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+        numLevels++;
+    }
+    return numLevels;
+}
+
+static Image MakePlaceholder()
+{
+    Image image;
+    image.width = 1;
+    image.height = 1;
+    image.pixelFormat = PixelFormat::RGBA;
+    image.data = {128, 128, 128, 255};
+    return image;
+}
+
+// false once the StreamingTexture is being destroyed.
+static bool ShouldContinue(StreamingTexture* st)
+{
+    std::lock_guard<std::mutex> lock(st->mutex);
+    return !st->quit;
+}
+
+static void SetFullSize(StreamingTexture* st, const Image& image, uint32_t width, uint32_t height)
+{
+    std::lock_guard<std::mutex> lock(st->mutex);
+    st->fullWidth = width;
+    st->fullHeight = height;
+    st->fullPixelFormat = image.pixelFormat;
+    st->fullNumLevels = GetNumMipLevels(width, height);
+}
+
+// image is mip level firstLevel, queues it and every level down to lastLevel, coarsest first.
+static bool PushMipChain(StreamingTexture* st, Image& image, int firstLevel, int lastLevel)
+{
+    std::vector<Image> chain(lastLevel - firstLevel + 1);
+    chain[0] = std::move(image);
+    for (size_t i = 1; i < chain.size(); i++)
+    {
+        if (!DownsampleHalf(chain[i - 1], chain[i]))
+        {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(st->mutex);
+    for (int i = (int)chain.size() - 1; i >= 0; i--)
+    {
+        st->readyLevels.push_back({firstLevel + i, std::move(chain[i]), 0});
+    }
+    return true;
+}
+
+static void DecodeLevels(StreamingTexture* st)
+{
+    std::string file;
+    if (!LoadFile(st->filename, file))
+    {
+        Log::printf("Error: Failed to load texture \"%s\"\n", (GetRootPath() + st->filename).c_str());
+        std::lock_guard<std::mutex> lock(st->mutex);
+        st->failed = true;
+        return;
+    }
+    const uint8_t* bytes = (const uint8_t*)file.data();
+    const size_t size = file.size();
+
+    // levels from previewLevel down are already queued.
+    int previewLevel = -1;
+#ifdef IMGTOY_JPEG
+    uint32_t jpegWidth, jpegHeight;
+    if (IsJPEG(bytes, size) && ReadJPEGSize(bytes, size, &jpegWidth, &jpegHeight))
+    {
+        // the smallest DCT scale, 1/8, is about mip level 3. libjpeg rounds up and mips round down,
+        // so it is resampled to the exact level size when they differ.
+        LoadOptions options;
+        options.minWidth = 1;
+        options.minHeight = 1;
+        Image preview;
+        if (preview.LoadFromMemory(bytes, size, options))
+        {
+            const int level = std::min(3, GetNumMipLevels(jpegWidth, jpegHeight) - 1);
+            const uint32_t levelWidth = std::max(jpegWidth >> level, 1u);
+            const uint32_t levelHeight = std::max(jpegHeight >> level, 1u);
+            if ((preview.width == levelWidth && preview.height == levelHeight) ||
+                Resample(preview, preview, levelWidth, levelHeight, ResampleFilter::Bilinear))
+            {
+                SetFullSize(st, preview, jpegWidth, jpegHeight);
+                if (PushMipChain(st, preview, level, GetNumMipLevels(jpegWidth, jpegHeight) - 1))
+                {
+                    previewLevel = level;
+                }
+            }
+        }
+    }
+#endif
+
+    if (!ShouldContinue(st))
+    {
+        return;
+    }
+
+    Image image;
+    const bool loaded = image.LoadFromMemory(bytes, size);
+    std::string().swap(file);
+    if (!loaded || (previewLevel >= 0 && (image.width != st->fullWidth || image.height != st->fullHeight)))
+    {
+        Log::printf("Error: failed to decode \"%s\"\n", st->filename.c_str());
+        std::lock_guard<std::mutex> lock(st->mutex);
+        st->failed = true;
+        return;
+    }
+
+    if (previewLevel < 0)
+    {
+        SetFullSize(st, image, image.width, image.height);
+        PushMipChain(st, image, 0, GetNumMipLevels(image.width, image.height) - 1);
+    }
+    else if (previewLevel > 0)
+    {
+        PushMipChain(st, image, 0, previewLevel - 1);
+    }
+}
+
+StreamingTexture::StreamingTexture(const std::string& filenameIn, const Texture::Params& params) :
+    texture(MakePlaceholder(), params),
+    filename(filenameIn),
+    numLevels(0),
+    baseLevel(-1),
+    requestTime(std::chrono::steady_clock::now()),
+    isUploading(false),
+    fullWidth(0),
+    fullHeight(0),
+    fullPixelFormat(PixelFormat::RGBA),
+    fullNumLevels(0),
+    failed(false),
+    quit(false)
+{
+    glBindTexture(GL_TEXTURE_2D, texture.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    thread = std::thread(DecodeLevels, this);
+}
+
+StreamingTexture::~StreamingTexture()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    thread.join();
+}
+
+bool StreamingTexture::HasFailed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+void StreamingTexture::Update(size_t budgetBytes)
+{
+    size_t budget = budgetBytes ? budgetBytes : SIZE_MAX;
+    bool uploadedAny = false;
+
+    glBindTexture(GL_TEXTURE_2D, texture.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (;;)
+    {
+        if (!isUploading)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (readyLevels.empty())
+            {
+                break;
+            }
+            uploading = std::move(readyLevels.front());
+            readyLevels.pop_front();
+            isUploading = true;
+
+            if (numLevels == 0)
+            {
+                // the placeholder stays in level 0 until level 0 is allocated, but it is no longer counted.
+                numLevels = fullNumLevels;
+                texture.width = fullWidth;
+                texture.height = fullHeight;
+                texture.pixelFormat = fullPixelFormat;
+                texture.hasAlphaChannel = fullPixelFormat == PixelFormat::RA || fullPixelFormat == PixelFormat::RGBA;
+                MemTrack::Free(MemCategory::Texture, texture.gpuBytes);
+                texture.gpuBytes = 0;
+            }
+        }
+
+        const Image& image = uploading.image;
+        const GLenum pf = pixelFormatToGL[(int)image.pixelFormat];
+        const size_t rowSize = (size_t)image.width * image.GetPixelSize();
+        if (uploading.rowsUploaded == 0)
+        {
+            int internalFormat = pf;
+            glTexImage2D(GL_TEXTURE_2D, uploading.level, internalFormat, image.width, image.height, 0, pf, GL_UNSIGNED_BYTE, nullptr);
+            const size_t levelBytes = EstimateGPUBytes(image.width, image.height, image.pixelFormat, false);
+            texture.gpuBytes += levelBytes;
+            MemTrack::Alloc(MemCategory::Texture, levelBytes);
+        }
+
+        // at least one row per call, so a tiny budget still makes progress.
+        size_t rows = std::min((size_t)(image.height - uploading.rowsUploaded), budget / rowSize);
+        if (rows == 0 && !uploadedAny)
+        {
+            rows = 1;
+        }
+        if (rows == 0)
+        {
+            break;
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, uploading.level, 0, uploading.rowsUploaded, image.width, (GLsizei)rows, pf, GL_UNSIGNED_BYTE,
+                        image.data.data() + uploading.rowsUploaded * rowSize);
+        uploading.rowsUploaded += (uint32_t)rows;
+        budget -= std::min(budget, rows * rowSize);
+        uploadedAny = true;
+
+        if (uploading.rowsUploaded < image.height)
+        {
+            continue;
+        }
+
+        // levels arrive coarsest first, so every level from this one to the last is complete.
+        isUploading = false;
+        if (baseLevel < 0)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - requestTime;
+            Log::printf("\"%s\": level %d (%u x %u) on screen after %.1f ms\n", filename.c_str(), uploading.level,
+                        image.width, image.height, elapsed.count());
+        }
+        baseLevel = uploading.level;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+        if (baseLevel == 0)
+        {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - requestTime;
+            Log::printf("\"%s\": all %d levels (%u x %u) uploaded after %.1f ms\n", filename.c_str(), numLevels,
+                        image.width, image.height, elapsed.count());
+        }
+        uploading.image.Release();
+    }
+}
@@ -1,9 +1,15 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <thread>
 
-struct Image;
+#include "image.h"
 
 enum class FilterType {
     Nearest = 0,
@@ -35,8 +41,80 @@ struct Texture
 
     void Apply(int unit) const;
 
+    // replaces the pixels, for streaming a new frame every draw.
+    // same size and format reuses the storage with glTexSubImage2D, anything else reallocates it.
+    void Update(const Image& image);
+
+    // uploads only rect of image, the rest of the rows are skipped with GL_UNPACK_ROW_LENGTH / SKIP_PIXELS / SKIP_ROWS.
+    // mipmapped textures get just the matching area of every level recomputed (a 2x2 box per level, from level 0),
+    // or a full glGenerateMipmap when the rect is a large part of the image.
+    // falls back to Update if the size or format changed.
+    void UpdateRegion(const Image& image, const ImageRect& rect);
+
+    // UpdateRegion for every dirty rect of image, then clears them.
+    void UpdateDirty(Image& image);
+
+    // full width band of rows [firstRow, firstRow + numRows), see PNGPushDecoder.
+    void UpdateRows(const Image& image, uint32_t firstRow, uint32_t numRows);
+
     uint32_t texture;
+    // estimate of the gl storage, mip chain included, counted in MemTrack as MemCategory::Texture.
+    size_t gpuBytes;
     bool hasAlphaChannel;
+    bool hasMipmaps;
+    uint32_t width;
+    uint32_t height;
+    PixelFormat pixelFormat;
+};
+
+// Texture that is usable the frame it is created and sharpens as its mip levels arrive.
+// Starts as a 1x1 placeholder, a background thread decodes the file and builds the mip chain, and Update uploads
+// the levels coarsest first within a byte budget per frame. GL_TEXTURE_BASE_LEVEL follows the finest complete level,
+// so sampling never touches a level that is still missing. Jpegs show a 1/8 scale DCT decode before the full one.
+struct StreamingTexture
+{
+    // pending level, rows are uploaded bottom up a budget at a time.
+    struct Level
+    {
+        int level;
+        Image image;
+        uint32_t rowsUploaded;
+    };
+
+    // filename is read with LoadFile on the decode thread, mounted archives first.
+    StreamingTexture(const std::string& filename, const Texture::Params& params);
+    // waits for the decode thread, which finishes the decode it is in.
+    ~StreamingTexture();
+
+    // call once per frame, uploads at most budgetBytes (but always at least one row), 0 for no limit.
+    void Update(size_t budgetBytes);
+
+    // every level uploaded.
+    bool IsComplete() const { return baseLevel == 0 && numLevels > 0; }
+    bool HasFailed();
+
+    void Apply(int unit) const { texture.Apply(unit); }
+
+    // the placeholder until the size is known, then the full size image, format and gpuBytes of the levels so far.
+    Texture texture;
+    std::string filename;
+    int numLevels;  // 0 until the decode thread knows the size
+    int baseLevel;  // finest complete level, -1 while showing the placeholder
+    std::chrono::steady_clock::time_point requestTime;
+
+    Level uploading;
+    bool isUploading;
+
+    // shared with the decode thread
+    std::mutex mutex;
+    std::deque<Level> readyLevels;  // coarsest first
+    uint32_t fullWidth;
+    uint32_t fullHeight;
+    PixelFormat fullPixelFormat;
+    int fullNumLevels;
+    bool failed;
+    bool quit;
+    std::thread thread;
 };
 
 #endif
@@ -1,7 +1,19 @@
 #include "util.h"
 
+#include <algorithm>
 #include <cassert>
+#include <ctype.h>
 #include <fstream>
+#include <string.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -12,10 +24,19 @@
 #include <SDL2/SDL_opengl.h>
 #include <SDL2/SDL_opengl_glext.h>
 
+#include "archive.h"
 #include "log.h"
+#include "simd.h"
 
 bool LoadFile(const std::string& filename, std::string& data)
 {
+    ArchiveFile archiveFile;
+    if (ReadFromArchives(filename, archiveFile))
+    {
+        data.assign((const char*)archiveFile.data, archiveFile.size);
+        return true;
+    }
+
     std::ifstream ifs(GetRootPath() + filename, std::ifstream::in);
     if (ifs.good())
     {
@@ -43,6 +64,171 @@ bool SaveFile(const std::string& filename, const std::string& data)
     }
 }
 
+bool HasExtension(const std::string& filename, const char* ext)
+{
+    size_t len = strlen(ext);
+    if (filename.size() < len)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (tolower((unsigned char)filename[filename.size() - len + i]) != ext[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IsFramePattern(const std::string& pattern)
+{
+    int numConversions = 0;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        if (pattern[i] != '%')
+        {
+            continue;
+        }
+        i++;
+        if (i < pattern.size() && pattern[i] == '%')
+        {
+            continue;
+        }
+        while (i < pattern.size() && isdigit((unsigned char)pattern[i]))
+        {
+            i++;
+        }
+        if (i == pattern.size() || pattern[i] != 'd')
+        {
+            return false;
+        }
+        numConversions++;
+    }
+    return numConversions == 1;
+}
+
+MappedFile::MappedFile() : data(nullptr), size(0), mapped(false)
+#ifdef _WIN32
+    , fileHandle(INVALID_HANDLE_VALUE), mappingHandle(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& filenameIn, bool sequential)
+{
+    Close();
+    std::string filename = GetRootPath() + filenameIn;
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0)
+    {
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle)
+        {
+            data = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+            if (data)
+            {
+                size = (size_t)fileSize.QuadPart;
+                mapped = true;
+                return true;
+            }
+        }
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            madvise(addr, (size_t)st.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+            data = (const uint8_t*)addr;
+            size = (size_t)st.st_size;
+            mapped = true;
+        }
+    }
+    // the mapping keeps its own reference to the file.
+    close(fd);
+    if (mapped)
+    {
+        return true;
+    }
+#endif
+
+    // empty files and things that can't be mapped (pipes, some network file systems) are read instead.
+    Close();
+    std::ifstream ifs(filename, std::ifstream::in | std::ifstream::binary);
+    if (!ifs.good())
+    {
+        return false;
+    }
+    buffer.assign((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    data = (const uint8_t*)buffer.data();
+    size = buffer.size();
+    return !ifs.bad();
+}
+
+void MappedFile::Prefetch(size_t offset, size_t length) const
+{
+#ifndef _WIN32
+    if (mapped && offset < size)
+    {
+        // madvise wants a page aligned start
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = offset & ~(pageSize - 1);
+        length = std::min(length + (offset - start), size - start);
+        madvise((void*)(data + start), length, MADV_WILLNEED);
+    }
+#endif
+}
+
+void MappedFile::Close()
+{
+    if (mapped)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+    }
+#ifdef _WIN32
+    if (mappingHandle)
+    {
+        CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+    }
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+        fileHandle = INVALID_HANDLE_VALUE;
+    }
+#endif
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    buffer.clear();
+    buffer.shrink_to_fit();
+}
+
 // returns the number of bytes to advance
 // fills cp_out with the code point at p.
 int NextCodePointUTF8(const char *str, uint32_t *codePointOut)
@@ -65,7 +251,7 @@ int NextCodePointUTF8(const char *str, uint32_t *codePointOut)
     }
     else if ((*p & 0xf8) == 0xf0) // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
     {
-        *codePointOut = ((*p & ~0xf8) << 18) | ((*(p+1) & ~0xc0) << 12) | ((*(p+1) & ~0xc0) << 6) | (*(p+2) & ~0xc0);
+        *codePointOut = ((*p & ~0xf8) << 18) | ((*(p+1) & ~0xc0) << 12) | ((*(p+2) & ~0xc0) << 6) | (*(p+3) & ~0xc0);
         return 4;
     }
     else
@@ -244,6 +430,197 @@ glm::vec3 XformPoint(const glm::mat4& m, const glm::vec3& p)
     return glm::vec3(result.x / result.w, result.y / result.w, result.z / result.w);
 }
 
+void XformPoints(const glm::mat4& m, const Vec3Array& points, Vec3Array& out)
+{
+    const size_t count = points.Size();
+    out.Resize(count);
+    const bool affine = m[0][3] == 0.0f && m[1][3] == 0.0f && m[2][3] == 0.0f && m[3][3] == 1.0f;
+    const float* px = points.x.data();
+    const float* py = points.y.data();
+    const float* pz = points.z.data();
+    float* ox = out.x.data();
+    float* oy = out.y.data();
+    float* oz = out.z.data();
+
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    __m128 rows[4][4];
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            rows[row][col] = _mm_set1_ps(m[col][row]);
+        }
+    }
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(px + i);
+        const __m128 y = _mm_loadu_ps(py + i);
+        const __m128 z = _mm_loadu_ps(pz + i);
+        __m128 result[3];
+        for (int row = 0; row < 3; row++)
+        {
+            result[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rows[row][0], x), _mm_mul_ps(rows[row][1], y)),
+                                     _mm_add_ps(_mm_mul_ps(rows[row][2], z), rows[row][3]));
+        }
+        if (!affine)
+        {
+            const __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rows[3][0], x), _mm_mul_ps(rows[3][1], y)),
+                                        _mm_add_ps(_mm_mul_ps(rows[3][2], z), rows[3][3]));
+            for (int row = 0; row < 3; row++)
+            {
+                result[row] = _mm_div_ps(result[row], w);
+            }
+        }
+        _mm_storeu_ps(ox + i, result[0]);
+        _mm_storeu_ps(oy + i, result[1]);
+        _mm_storeu_ps(oz + i, result[2]);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const float x = px[i];
+        const float y = py[i];
+        const float z = pz[i];
+        float rx = m[0][0] * x + m[1][0] * y + m[2][0] * z + m[3][0];
+        float ry = m[0][1] * x + m[1][1] * y + m[2][1] * z + m[3][1];
+        float rz = m[0][2] * x + m[1][2] * y + m[2][2] * z + m[3][2];
+        if (!affine)
+        {
+            const float w = m[0][3] * x + m[1][3] * y + m[2][3] * z + m[3][3];
+            rx /= w;
+            ry /= w;
+            rz /= w;
+        }
+        ox[i] = rx;
+        oy[i] = ry;
+        oz[i] = rz;
+    }
+}
+
+void SafeMix(const QuatArray& a, const QuatArray& b, const std::vector<float>& alphas, QuatArray& out)
+{
+    const size_t count = a.Size();
+    out.Resize(count);
+    const float* ac[4] = {a.x.data(), a.y.data(), a.z.data(), a.w.data()};
+    const float* bc[4] = {b.x.data(), b.y.data(), b.z.data(), b.w.data()};
+    float* oc[4] = {out.x.data(), out.y.data(), out.z.data(), out.w.data()};
+
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 qa[4];
+        __m128 qb[4];
+        __m128 dot = zero;
+        for (int c = 0; c < 4; c++)
+        {
+            qa[c] = _mm_loadu_ps(ac[c] + i);
+            qb[c] = _mm_loadu_ps(bc[c] + i);
+            dot = _mm_add_ps(dot, _mm_mul_ps(qa[c], qb[c]));
+        }
+
+        // flip b where the dot is negative, so the blend takes the short way around.
+        const __m128 flip = _mm_and_ps(_mm_cmplt_ps(dot, zero), signBit);
+        const __m128 alpha = _mm_loadu_ps(alphas.data() + i);
+        const __m128 beta = _mm_sub_ps(one, alpha);
+        __m128 q[4];
+        __m128 lengthSq = zero;
+        for (int c = 0; c < 4; c++)
+        {
+            q[c] = _mm_add_ps(_mm_mul_ps(qa[c], beta), _mm_mul_ps(_mm_xor_ps(qb[c], flip), alpha));
+            lengthSq = _mm_add_ps(lengthSq, _mm_mul_ps(q[c], q[c]));
+        }
+
+        // glm::normalize gives the identity for a zero length quat.
+        const __m128 length = _mm_sqrt_ps(lengthSq);
+        const __m128 degenerate = _mm_cmple_ps(length, zero);
+        const __m128 safeLength = _mm_or_ps(_mm_and_ps(degenerate, one), _mm_andnot_ps(degenerate, length));
+        for (int c = 0; c < 4; c++)
+        {
+            __m128 value = _mm_div_ps(q[c], safeLength);
+            const __m128 identity = c == 3 ? one : zero;
+            value = _mm_or_ps(_mm_and_ps(degenerate, identity), _mm_andnot_ps(degenerate, value));
+            _mm_storeu_ps(oc[c] + i, value);
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out.Set(i, SafeMix(a.Get(i), b.Get(i), alphas[i]));
+    }
+}
+
+void MakeMat4(const Vec3Array& scales, const QuatArray& rotations, const Vec3Array& translations, std::vector<glm::mat4>& out)
+{
+    const size_t count = rotations.Size();
+    out.resize(count);
+
+    size_t i = 0;
+#if defined(SIMD_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(rotations.x.data() + i);
+        const __m128 y = _mm_loadu_ps(rotations.y.data() + i);
+        const __m128 z = _mm_loadu_ps(rotations.z.data() + i);
+        const __m128 w = _mm_loadu_ps(rotations.w.data() + i);
+        const __m128 sx = _mm_loadu_ps(scales.x.data() + i);
+        const __m128 sy = _mm_loadu_ps(scales.y.data() + i);
+        const __m128 sz = _mm_loadu_ps(scales.z.data() + i);
+
+        // the rotation applied to each scaled axis, as rotation * vec3 expands.
+        const __m128 xx = _mm_mul_ps(x, x);
+        const __m128 yy = _mm_mul_ps(y, y);
+        const __m128 zz = _mm_mul_ps(z, z);
+        const __m128 xy = _mm_mul_ps(x, y);
+        const __m128 xz = _mm_mul_ps(x, z);
+        const __m128 yz = _mm_mul_ps(y, z);
+        const __m128 wx = _mm_mul_ps(w, x);
+        const __m128 wy = _mm_mul_ps(w, y);
+        const __m128 wz = _mm_mul_ps(w, z);
+        __m128 columns[4][4] = {
+            {_mm_mul_ps(sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)))),
+             _mm_mul_ps(sx, _mm_mul_ps(two, _mm_add_ps(xy, wz))),
+             _mm_mul_ps(sx, _mm_mul_ps(two, _mm_sub_ps(xz, wy))),
+             zero},
+            {_mm_mul_ps(sy, _mm_mul_ps(two, _mm_sub_ps(xy, wz))),
+             _mm_mul_ps(sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)))),
+             _mm_mul_ps(sy, _mm_mul_ps(two, _mm_add_ps(yz, wx))),
+             zero},
+            {_mm_mul_ps(sz, _mm_mul_ps(two, _mm_add_ps(xz, wy))),
+             _mm_mul_ps(sz, _mm_mul_ps(two, _mm_sub_ps(yz, wx))),
+             _mm_mul_ps(sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)))),
+             zero},
+            {_mm_loadu_ps(translations.x.data() + i),
+             _mm_loadu_ps(translations.y.data() + i),
+             _mm_loadu_ps(translations.z.data() + i),
+             one}
+        };
+
+        // each column holds one component of four matrices, transposed it is one column of each matrix.
+        float* dst = (float*)&out[i];
+        for (int col = 0; col < 4; col++)
+        {
+            _MM_TRANSPOSE4_PS(columns[col][0], columns[col][1], columns[col][2], columns[col][3]);
+            for (int element = 0; element < 4; element++)
+            {
+                _mm_storeu_ps(dst + element * 16 + col * 4, columns[col][element]);
+            }
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = MakeMat4(scales.Get(i), rotations.Get(i), translations.Get(i));
+    }
+}
+
 glm::vec3 RandomColor()
 {
     return glm::vec3(glm::linearRand(0.0f, 1.0f), glm::linearRand(0.0f, 1.0f), glm::linearRand(0.0f, 1.0f));
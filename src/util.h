@@ -8,11 +8,45 @@
 
 #include <SDL2/SDL.h>
 #include <string>
+#include <vector>
 
 // returns true on success, false on failure
 bool LoadFile(const std::string& filename, std::string& result);
 bool SaveFile(const std::string& filename, const std::string& data);
 
+// case insensitive, ext is lower case with its dot, ".png".
+bool HasExtension(const std::string& filename, const char* ext);
+
+// true if pattern has exactly one %d, optionally zero padded to a width, and any other '%' written as "%%",
+// so it is safe to pass to snprintf as the format with one int.
+bool IsFramePattern(const std::string& pattern);
+
+// Read only view of a whole file, mapped into memory where the os allows it, read into a buffer otherwise.
+// The bytes are only valid until Close, and a file truncated by someone else while mapped can fault on access.
+struct MappedFile
+{
+    MappedFile();
+    ~MappedFile();
+
+    // filename is relative to the root path.
+    // sequential tells the os the file is read front to back once, so it can read ahead and drop pages behind.
+    bool Open(const std::string& filename, bool sequential = true);
+    void Close();
+
+    // asks the os to start reading a range that is about to be used, for files opened with sequential = false.
+    void Prefetch(size_t offset, size_t length) const;
+
+    const uint8_t* data;
+    size_t size;
+
+    bool mapped;
+    std::string buffer;  // fallback when mapping fails
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+};
+
 // Iterate over codepoints in a utf-8 encoded string
 int NextCodePointUTF8(const char *str, uint32_t *codePointOut);
 
@@ -42,6 +76,45 @@ void DecomposeSwingTwist(const glm::quat& rotation, const glm::vec3& twistAxis,
 
 glm::vec3 XformPoint(const glm::mat4& m, const glm::vec3& p);
 
+// Structure of arrays batches for the batch math below, element i is (x[i], y[i], z[i]).
+// Each component is contiguous so SIMD loads four elements of it at once.
+struct Vec3Array
+{
+    void Resize(size_t size) { x.resize(size); y.resize(size); z.resize(size); }
+    size_t Size() const { return x.size(); }
+    glm::vec3 Get(size_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+    void Set(size_t i, const glm::vec3& v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+};
+
+struct QuatArray
+{
+    void Resize(size_t size) { x.resize(size); y.resize(size); z.resize(size); w.resize(size); }
+    size_t Size() const { return x.size(); }
+    glm::quat Get(size_t i) const { return glm::quat(w[i], x[i], y[i], z[i]); }
+    void Set(size_t i, const glm::quat& q) { x[i] = q.x; y[i] = q.y; z[i] = q.z; w[i] = q.w; }
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> w;
+};
+
+// Batch versions of the helpers above, same results as calling them per element (to rounding).
+// Outputs are resized to match, and may be the same array as an input.
+
+// affine matrices (bottom row 0 0 0 1) skip the divide by w.
+void XformPoints(const glm::mat4& m, const Vec3Array& points, Vec3Array& out);
+
+// per element alpha, a and b the same size.
+void SafeMix(const QuatArray& a, const QuatArray& b, const std::vector<float>& alphas, QuatArray& out);
+
+// one matrix per element, written as glm::mat4 so they can go straight into a uniform or vertex buffer.
+void MakeMat4(const Vec3Array& scales, const QuatArray& rotations, const Vec3Array& translations, std::vector<glm::mat4>& out);
+
 glm::vec3 RandomColor();
 
 const std::string& GetRootPath();
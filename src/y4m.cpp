@@ -0,0 +1,384 @@
+#include "y4m.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "log.h"
+#include "parallel.h"
+#include "util.h"
+
+// frames are big, fewer bigger reads and writes keep the pipe moving.
+static const size_t STREAM_BUFFER_SIZE = 1 << 20;
+
+static FILE* OpenStream(const std::string& filenameIn, bool write, bool* ownsFileOut)
+{
+    FILE* fp = nullptr;
+    if (filenameIn == "-")
+    {
+        fp = write ? stdout : stdin;
+#ifdef _WIN32
+        _setmode(_fileno(fp), _O_BINARY);
+#endif
+        *ownsFileOut = false;
+    }
+    else
+    {
+        std::string filename = GetRootPath() + filenameIn;
+#ifdef _WIN32
+        fopen_s(&fp, filename.c_str(), write ? "wb" : "rb");
+#else
+        fp = fopen(filename.c_str(), write ? "wb" : "rb");
+#endif
+        *ownsFileOut = true;
+    }
+    if (fp)
+    {
+        setvbuf(fp, nullptr, _IOFBF, STREAM_BUFFER_SIZE);
+    }
+    return fp;
+}
+
+// reads up to and including '\n', returns false on eof or if the line does not fit.
+static bool ReadLine(FILE* fp, char* line, size_t size)
+{
+    size_t len = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF)
+    {
+        if (c == '\n')
+        {
+            line[len] = 0;
+            return true;
+        }
+        if (len + 1 >= size)
+        {
+            return false;
+        }
+        line[len++] = (char)c;
+    }
+    return false;
+}
+
+static const char* s_chromaTags[(int)ChromaFormat::NUM_FORMATS] = {"420jpeg", "422", "444", "mono"};
+
+static bool ParseChroma(const char* tag, ChromaFormat* chromaOut)
+{
+    // every 420 siting variant has the same plane layout. whole tags only, 420p10 and the other high bit depth
+    // tags share the prefix but have 16 bit samples.
+    static const char* s_420Tags[] = {"420", "420jpeg", "420paldv", "420mpeg2"};
+    for (const char* name : s_420Tags)
+    {
+        if (!strcmp(tag, name))
+        {
+            *chromaOut = ChromaFormat::C420;
+            return true;
+        }
+    }
+    for (int i = 1; i < (int)ChromaFormat::NUM_FORMATS; i++)
+    {
+        if (!strcmp(tag, s_chromaTags[i]))
+        {
+            *chromaOut = (ChromaFormat)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+// Y4MReader
+//
+
+Y4MReader::Y4MReader() : width(0), height(0), fpsNum(30), fpsDen(1), chromaFormat(ChromaFormat::C420), framesRead(0), failed(false), fp(nullptr), ownsFile(false)
+{
+}
+
+Y4MReader::~Y4MReader()
+{
+    Close();
+}
+
+bool Y4MReader::Open(const std::string& filename)
+{
+    Close();
+    failed = true;
+
+    fp = OpenStream(filename, false, &ownsFile);
+    if (!fp)
+    {
+        Log::printf("Error: Failed to open \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    char header[1024];
+    if (!ReadLine(fp, header, sizeof(header)) || strncmp(header, "YUV4MPEG2 ", 10))
+    {
+        Log::printf("Error: \"%s\" is not a y4m stream\n", filename.c_str());
+        return false;
+    }
+
+    // space separated tags, the first letter says what it is
+    chromaFormat = ChromaFormat::C420;
+    char* next = header + 10;
+    while (*next)
+    {
+        char* tag = next;
+        while (*next && *next != ' ')
+        {
+            next++;
+        }
+        if (*next)
+        {
+            *(next++) = 0;
+        }
+
+        switch (tag[0])
+        {
+        case 'W':
+            width = (uint32_t)atoi(tag + 1);
+            break;
+        case 'H':
+            height = (uint32_t)atoi(tag + 1);
+            break;
+        case 'F':
+            if (sscanf(tag + 1, "%d:%d", &fpsNum, &fpsDen) != 2 || fpsNum <= 0 || fpsDen <= 0)
+            {
+                fpsNum = 30;
+                fpsDen = 1;
+            }
+            break;
+        case 'C':
+            if (!ParseChroma(tag + 1, &chromaFormat))
+            {
+                Log::printf("Error: unsupported y4m chroma \"%s\", only 8 bit 420, 422, 444 and mono are read\n", tag + 1);
+                return false;
+            }
+            break;
+        default:
+            // interlacing, aspect ratio and extensions don't change the frame layout.
+            break;
+        }
+    }
+
+    if (width == 0 || height == 0)
+    {
+        Log::printf("Error: y4m header of \"%s\" has no size\n", filename.c_str());
+        return false;
+    }
+
+    framesRead = 0;
+    failed = false;
+    return true;
+}
+
+bool Y4MReader::ReadFrame(YUVImage& frame)
+{
+    if (failed || !fp)
+    {
+        return false;
+    }
+
+    char line[256];
+    if (!ReadLine(fp, line, sizeof(line)))
+    {
+        // a clean end of stream is eof right where the next FRAME would start.
+        failed = !feof(fp);
+        return false;
+    }
+    if (strncmp(line, "FRAME", 5))
+    {
+        Log::printf("Error: bad y4m frame header after %llu frames\n", (unsigned long long)framesRead);
+        failed = true;
+        return false;
+    }
+
+    frame.Resize(width, height, chromaFormat);
+    if (fread(frame.y.data(), 1, frame.y.size(), fp) != frame.y.size() ||
+        fread(frame.u.data(), 1, frame.u.size(), fp) != frame.u.size() ||
+        fread(frame.v.data(), 1, frame.v.size(), fp) != frame.v.size())
+    {
+        Log::printf("Error: truncated y4m frame %llu\n", (unsigned long long)framesRead);
+        failed = true;
+        return false;
+    }
+
+    framesRead++;
+    return true;
+}
+
+void Y4MReader::Close()
+{
+    if (fp && ownsFile)
+    {
+        fclose(fp);
+    }
+    fp = nullptr;
+    ownsFile = false;
+}
+
+//
+// Y4MWriter
+//
+
+Y4MWriter::Y4MWriter() : width(0), height(0), chromaFormat(ChromaFormat::C420), framesWritten(0), fp(nullptr), ownsFile(false)
+{
+}
+
+Y4MWriter::~Y4MWriter()
+{
+    Close();
+}
+
+bool Y4MWriter::Open(const std::string& filename, uint32_t widthIn, uint32_t heightIn, int fpsNum, int fpsDen, ChromaFormat chromaFormatIn)
+{
+    Close();
+    width = widthIn;
+    height = heightIn;
+    chromaFormat = chromaFormatIn;
+    framesWritten = 0;
+
+    fp = OpenStream(filename, true, &ownsFile);
+    if (!fp)
+    {
+        Log::printf("Error: Failed to fopen \"%s\"\n", filename.c_str());
+        return false;
+    }
+
+    if (fprintf(fp, "YUV4MPEG2 W%u H%u F%d:%d Ip A1:1 C%s\n", width, height, fpsNum, fpsDen, s_chromaTags[(int)chromaFormat]) < 0)
+    {
+        Log::printf("Error: failed to write y4m header to \"%s\"\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Y4MWriter::WriteFrame(const YUVImage& frame)
+{
+    if (!fp)
+    {
+        return false;
+    }
+    if (frame.width != width || frame.height != height || frame.chromaFormat != chromaFormat)
+    {
+        Log::printf("Error: frame does not match y4m stream being written\n");
+        return false;
+    }
+
+    if (fputs("FRAME\n", fp) < 0 ||
+        fwrite(frame.y.data(), 1, frame.y.size(), fp) != frame.y.size() ||
+        fwrite(frame.u.data(), 1, frame.u.size(), fp) != frame.u.size() ||
+        fwrite(frame.v.data(), 1, frame.v.size(), fp) != frame.v.size())
+    {
+        return false;
+    }
+    framesWritten++;
+    return true;
+}
+
+bool Y4MWriter::Close()
+{
+    if (!fp)
+    {
+        return false;
+    }
+    bool result = fflush(fp) == 0;
+    if (ownsFile)
+    {
+        result = (fclose(fp) == 0) && result;
+    }
+    fp = nullptr;
+    ownsFile = false;
+    return result;
+}
+
+//
+// packing
+//
+
+void UnpackYUV(const YUVImage& src, Image& dst)
+{
+    dst.width = src.width;
+    dst.height = src.height;
+    dst.pixelFormat = PixelFormat::RGB;
+    dst.data.resize((size_t)src.width * src.height * 3);
+
+    const uint32_t chromaWidth = src.GetChromaWidth();
+    const int xShift = chromaWidth < src.width ? 1 : 0;
+    const int yShift = src.GetChromaHeight() < src.height ? 1 : 0;
+    const bool mono = src.chromaFormat == ChromaFormat::Mono;
+    ParallelFor(0, src.height, 32, [&](size_t begin, size_t end)
+    {
+        for (size_t y = begin; y < end; y++)
+        {
+            const uint8_t* yRow = src.y.data() + (size_t)y * src.width;
+            const uint8_t* uRow = mono ? nullptr : src.u.data() + (size_t)(y >> yShift) * chromaWidth;
+            const uint8_t* vRow = mono ? nullptr : src.v.data() + (size_t)(y >> yShift) * chromaWidth;
+            uint8_t* out = dst.data.data() + (size_t)(src.height - 1 - y) * src.width * 3;
+            for (uint32_t x = 0; x < src.width; x++)
+            {
+                out[x * 3 + 0] = yRow[x];
+                out[x * 3 + 1] = mono ? 128 : uRow[x >> xShift];
+                out[x * 3 + 2] = mono ? 128 : vRow[x >> xShift];
+            }
+        }
+    });
+}
+
+void PackYUV(const Image& src, YUVImage& dst, ChromaFormat chromaFormat)
+{
+    dst.Resize(src.width, src.height, chromaFormat);
+
+    const int pixelSize = (int)src.GetPixelSize();
+    const bool hasChroma = pixelSize >= 3;
+    const size_t rowSize = (size_t)src.width * pixelSize;
+
+    // rows come out top to bottom, Image rows are bottom to top.
+    auto srcRow = [&](uint32_t y) { return src.data.data() + (size_t)(src.height - 1 - y) * rowSize; };
+
+    ParallelFor(0, src.height, 32, [&](size_t begin, size_t end)
+    {
+        for (size_t y = begin; y < end; y++)
+        {
+            const uint8_t* in = srcRow((uint32_t)y);
+            uint8_t* out = dst.y.data() + y * src.width;
+            for (uint32_t x = 0; x < src.width; x++)
+            {
+                out[x] = in[x * pixelSize];
+            }
+        }
+    });
+
+    const uint32_t chromaWidth = dst.GetChromaWidth();
+    const uint32_t chromaHeight = dst.GetChromaHeight();
+    const uint32_t xStep = chromaWidth < src.width ? 2 : 1;
+    const uint32_t yStep = chromaHeight < src.height ? 2 : 1;
+    ParallelFor(0, chromaHeight, 16, [&](size_t begin, size_t end)
+    {
+        for (uint32_t cy = (uint32_t)begin; cy < (uint32_t)end; cy++)
+        {
+            // odd sizes repeat the last row or column
+            const uint8_t* row0 = srcRow(cy * yStep);
+            const uint8_t* row1 = srcRow(std::min(cy * yStep + yStep - 1, src.height - 1));
+            uint8_t* uOut = dst.u.data() + (size_t)cy * chromaWidth;
+            uint8_t* vOut = dst.v.data() + (size_t)cy * chromaWidth;
+            for (uint32_t cx = 0; cx < chromaWidth; cx++)
+            {
+                if (!hasChroma)
+                {
+                    uOut[cx] = 128;
+                    vOut[cx] = 128;
+                    continue;
+                }
+                size_t x0 = (size_t)cx * xStep * pixelSize;
+                size_t x1 = (size_t)std::min(cx * xStep + xStep - 1, src.width - 1) * pixelSize;
+                uOut[cx] = (uint8_t)((row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1] + 2) >> 2);
+                vOut[cx] = (uint8_t)((row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2] + 2) >> 2);
+            }
+        }
+    });
+}
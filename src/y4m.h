@@ -0,0 +1,64 @@
+#ifndef Y4M_H
+#define Y4M_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "image.h"
+
+// Reads raw YUV frames from a YUV4MPEG2 stream, as written by ffmpeg -f yuv4mpegpipe.
+// 420 (all siting variants), 422, 444 and mono 8 bit streams are supported.
+struct Y4MReader
+{
+    Y4MReader();
+    ~Y4MReader();
+
+    // "-" reads stdin, anything else is relative to the root path.
+    bool Open(const std::string& filename);
+
+    // returns false at the end of the stream or on error (failed tells them apart).
+    bool ReadFrame(YUVImage& frame);
+    void Close();
+
+    uint32_t width;
+    uint32_t height;
+    int fpsNum;
+    int fpsDen;
+    ChromaFormat chromaFormat;
+    uint64_t framesRead;
+    bool failed;
+
+    FILE* fp;
+    bool ownsFile;
+};
+
+// Writes a YUV4MPEG2 stream, one FRAME per WriteFrame.
+struct Y4MWriter
+{
+    Y4MWriter();
+    ~Y4MWriter();
+
+    // "-" writes stdout, anything else is relative to the root path.
+    bool Open(const std::string& filename, uint32_t width, uint32_t height, int fpsNum, int fpsDen, ChromaFormat chromaFormat);
+    bool WriteFrame(const YUVImage& frame);
+    bool Close();
+
+    uint32_t width;
+    uint32_t height;
+    ChromaFormat chromaFormat;
+    uint64_t framesWritten;
+
+    FILE* fp;
+    bool ownsFile;
+};
+
+// planar to interleaved, chroma is replicated up to full resolution (mono gets 128).
+// dst is RGB with Y, U and V in the first, second and third channel, rows bottom to top like every Image.
+void UnpackYUV(const YUVImage& src, Image& dst);
+
+// interleaved YUV (the output of processImage) to planar, chroma is averaged down to chromaFormat.
+// R and RA images only have luma, their chroma planes are 128.
+void PackYUV(const Image& src, YUVImage& dst, ChromaFormat chromaFormat);
+
+#endif
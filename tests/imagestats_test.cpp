@@ -0,0 +1,51 @@
+// ImageStats clip counts at and around limited range limits, returns non-zero on failure.
+
+#include <stdio.h>
+
+#include "imagestats.h"
+
+static int s_failures = 0;
+
+static void Check(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        s_failures++;
+    }
+}
+
+int main()
+{
+    // luma exactly at video black and white, then one step past each.
+    const uint8_t atLimits[] = {16, 235, 16, 235, 128};
+    const uint8_t pastLimits[] = {15, 236, 0, 255};
+
+    ImageStats stats;
+    stats.SetLimits(0, 16, 235);
+    stats.Accumulate(atLimits, sizeof(atLimits), 1);
+    Check(stats.channels[0].ClippedLow() == 0, "16 is not clipped low");
+    Check(stats.channels[0].ClippedHigh() == 0, "235 is not clipped high");
+
+    stats.Accumulate(pastLimits, sizeof(pastLimits), 1);
+    Check(stats.channels[0].ClippedLow() == 2, "15 and 0 are clipped low");
+    Check(stats.channels[0].ClippedHigh() == 2, "236 and 255 are clipped high");
+    Check(stats.channels[0].Count() == 9, "every value is counted");
+
+    // chroma limits are 16..240, per channel of an RGB pixel.
+    const uint8_t chroma[] = {16, 16, 240, 235, 15, 241};
+    ImageStats yuv;
+    yuv.SetLimits(0, 16, 235);
+    yuv.SetLimits(1, 16, 240);
+    yuv.SetLimits(2, 16, 240);
+    yuv.Accumulate(chroma, 2, 3);
+    Check(yuv.channels[0].ClippedLow() == 0 && yuv.channels[0].ClippedHigh() == 0, "luma at its limits");
+    Check(yuv.channels[1].ClippedLow() == 1 && yuv.channels[1].ClippedHigh() == 0, "u 16 is legal, 15 is not");
+    Check(yuv.channels[2].ClippedLow() == 0 && yuv.channels[2].ClippedHigh() == 1, "v 240 is legal, 241 is not");
+
+    if (s_failures == 0)
+    {
+        printf("imagestats_test passed\n");
+    }
+    return s_failures == 0 ? 0 : 1;
+}